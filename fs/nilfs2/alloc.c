@@ -13,6 +13,8 @@
 #include <linux/fs.h>
 #include <linux/bitops.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/random.h>
 #include "mdt.h"
 #include "alloc.h"
 
@@ -157,12 +159,25 @@ nilfs_palloc_group_desc_add_entries(struct nilfs_palloc_group_desc *desc,
 	return nfree;
 }
 
+/**
+ * nilfs_palloc_add_free_count - adjust maintained count of free entries
+ * @inode: inode of metadata file using this allocator
+ * @n: delta to be added
+ */
+static void nilfs_palloc_add_free_count(struct inode *inode, s64 n)
+{
+	struct nilfs_palloc_cache *cache = NILFS_MDT(inode)->mi_palloc_cache;
+
+	if (atomic64_read(&cache->nfrees) >= 0)
+		atomic64_add(n, &cache->nfrees);
+}
+
 /**
  * nilfs_palloc_entry_blkoff - get block offset of an entry block
  * @inode: inode of metadata file using this allocator
  * @nr: serial number of the entry (e.g. inode number)
  */
-static unsigned long
+unsigned long
 nilfs_palloc_entry_blkoff(const struct inode *inode, __u64 nr)
 {
 	unsigned long group, group_offset;
@@ -187,6 +202,8 @@ static void nilfs_palloc_desc_block_init(struct inode *inode,
 	__le32 nfrees;
 
 	nfrees = cpu_to_le32(nilfs_palloc_entries_per_group(inode));
+	nilfs_palloc_add_free_count(inode,
+		(s64)nilfs_palloc_entries_per_group(inode) * n);
 	while (n-- > 0) {
 		desc->pg_nfrees = nfrees;
 		desc++;
@@ -321,6 +338,52 @@ int nilfs_palloc_get_entry_block(struct inode *inode, __u64 nr,
 				      &cache->prev_entry, &cache->lock);
 }
 
+static int nilfs_palloc_cmp_blkoff(const void *a, const void *b)
+{
+	unsigned long blkoff_a = *(const unsigned long *)a;
+	unsigned long blkoff_b = *(const unsigned long *)b;
+
+	return blkoff_a < blkoff_b ? -1 : blkoff_a > blkoff_b;
+}
+
+/**
+ * nilfs_palloc_readahead_entries - read ahead entry blocks
+ * @inode: inode of metadata file using this allocator
+ * @nrs: array of serial numbers of entries
+ * @nitems: number of entries in @nrs
+ *
+ * nilfs_palloc_readahead_entries() issues readahead of the entry blocks
+ * covering the entries of @nrs in block offset order, reading each block
+ * only once.  It does not wait for the reads.
+ */
+void nilfs_palloc_readahead_entries(struct inode *inode, const __u64 *nrs,
+				    size_t nitems)
+{
+	unsigned long blkoffs[NILFS_PALLOC_RA_BLOCKS];
+	unsigned long blkoff;
+	size_t i, j, n = 0;
+
+	for (i = 0; i < nitems; i++) {
+		blkoff = nilfs_palloc_entry_blkoff(inode, nrs[i]);
+		for (j = 0; j < n && blkoffs[j] != blkoff; j++)
+			;
+		if (j < n)
+			continue;
+		if (n == NILFS_PALLOC_RA_BLOCKS) {
+			sort(blkoffs, n, sizeof(blkoffs[0]),
+			     nilfs_palloc_cmp_blkoff, NULL);
+			nilfs_mdt_readahead(inode, blkoffs, n);
+			n = 0;
+		}
+		blkoffs[n++] = blkoff;
+	}
+	if (n) {
+		sort(blkoffs, n, sizeof(blkoffs[0]), nilfs_palloc_cmp_blkoff,
+		     NULL);
+		nilfs_mdt_readahead(inode, blkoffs, n);
+	}
+}
+
 /**
  * nilfs_palloc_delete_entry_block - delete an entry block
  * @inode: inode of metadata file using this allocator
@@ -426,6 +489,27 @@ nilfs_palloc_rest_groups_in_desc_block(const struct inode *inode,
 		     max - curr + 1);
 }
 
+/**
+ * nilfs_palloc_update_desc_blocks - update cached number of descriptor blocks
+ * @inode: inode of metadata file using this allocator
+ * @ndescblocks: number of group descriptor blocks known to be in use
+ *
+ * The cached number is only raised since descriptor blocks are never
+ * deleted, and only once it has been counted from the block mapping.  It is
+ * dropped by nilfs_palloc_clear_cache() when the metadata file is rolled
+ * back.
+ */
+static void nilfs_palloc_update_desc_blocks(struct inode *inode,
+					    unsigned long ndescblocks)
+{
+	struct nilfs_palloc_cache *cache = NILFS_MDT(inode)->mi_palloc_cache;
+
+	spin_lock(&cache->lock);
+	if (cache->ndescblocks && cache->ndescblocks < ndescblocks)
+		cache->ndescblocks = ndescblocks;
+	spin_unlock(&cache->lock);
+}
+
 /**
  * nilfs_palloc_count_desc_blocks - count descriptor blocks number
  * @inode: inode of metadata file using this allocator
@@ -434,14 +518,27 @@ nilfs_palloc_rest_groups_in_desc_block(const struct inode *inode,
 static int nilfs_palloc_count_desc_blocks(struct inode *inode,
 					    unsigned long *desc_blocks)
 {
+	struct nilfs_palloc_cache *cache = NILFS_MDT(inode)->mi_palloc_cache;
 	__u64 blknum;
 	int ret;
 
+	spin_lock(&cache->lock);
+	*desc_blocks = cache->ndescblocks;
+	spin_unlock(&cache->lock);
+	if (*desc_blocks)
+		return 0;
+
 	ret = nilfs_bmap_last_key(NILFS_I(inode)->i_bmap, &blknum);
-	if (likely(!ret))
+	if (likely(!ret)) {
 		*desc_blocks = DIV_ROUND_UP(
 			(unsigned long)blknum,
 			NILFS_MDT(inode)->mi_blocks_per_desc_block);
+
+		spin_lock(&cache->lock);
+		if (cache->ndescblocks < *desc_blocks)
+			cache->ndescblocks = *desc_blocks;
+		spin_unlock(&cache->lock);
+	}
 	return ret;
 }
 
@@ -464,11 +561,16 @@ static inline bool nilfs_palloc_mdt_file_can_grow(struct inode *inode,
  * @inode: inode of metadata file using this allocator
  * @nused: current number of used entries
  * @nmaxp: max number of entries [out]
+ *
+ * If the count of free entries is maintained, it is used instead of the
+ * number of descriptor blocks.
  */
 int nilfs_palloc_count_max_entries(struct inode *inode, u64 nused, u64 *nmaxp)
 {
+	struct nilfs_palloc_cache *cache = NILFS_MDT(inode)->mi_palloc_cache;
 	unsigned long desc_blocks = 0;
 	u64 entries_per_desc_block, nmax;
+	s64 nfrees;
 	int err;
 
 	err = nilfs_palloc_count_desc_blocks(inode, &desc_blocks);
@@ -477,7 +579,11 @@ int nilfs_palloc_count_max_entries(struct inode *inode, u64 nused, u64 *nmaxp)
 
 	entries_per_desc_block = (u64)nilfs_palloc_entries_per_group(inode) *
 				nilfs_palloc_groups_per_desc_block(inode);
-	nmax = entries_per_desc_block * desc_blocks;
+	nfrees = atomic64_read(&cache->nfrees);
+	if (nfrees >= 0)
+		nmax = nused + nfrees;
+	else
+		nmax = entries_per_desc_block * desc_blocks;
 
 	if (nused == nmax &&
 			nilfs_palloc_mdt_file_can_grow(inode, desc_blocks))
@@ -490,6 +596,103 @@ int nilfs_palloc_count_max_entries(struct inode *inode, u64 nused, u64 *nmaxp)
 	return 0;
 }
 
+/**
+ * nilfs_palloc_init_free_count - start maintaining count of free entries
+ * @inode: inode of metadata file using this allocator
+ * @nused: current number of used entries
+ *
+ * Description: nilfs_palloc_init_free_count() counts the free entries from
+ * the number of descriptor blocks and @nused, and then keeps the count up
+ * to date as entries are allocated and freed, and as descriptor blocks
+ * are added.  It must be called before the allocator is used.
+ *
+ * Return Value: On success, 0 is returned.  On error, one of the following
+ * negative error codes is returned, and the count is not maintained.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-ERANGE - @nused exceeds the number of entries.
+ */
+int nilfs_palloc_init_free_count(struct inode *inode, u64 nused)
+{
+	struct nilfs_palloc_cache *cache = NILFS_MDT(inode)->mi_palloc_cache;
+	unsigned long desc_blocks = 0;
+	u64 nmax;
+	int err;
+
+	err = nilfs_palloc_count_desc_blocks(inode, &desc_blocks);
+	if (unlikely(err))
+		return err;
+
+	nmax = (u64)nilfs_palloc_entries_per_group(inode) *
+		nilfs_palloc_groups_per_desc_block(inode) * desc_blocks;
+	if (nused > nmax)
+		return -ERANGE;
+
+	atomic64_set(&cache->nfrees, nmax - nused);
+	return 0;
+}
+
+/**
+ * nilfs_palloc_spread_target - choose a target group to spread entries over
+ * @inode: inode of metadata file using this allocator
+ * @maxgroup: last group number to be considered
+ * @target: place to store the first entry number of the chosen group
+ *
+ * nilfs_palloc_spread_target() looks at the groups in [0, @maxgroup] that
+ * the first group descriptor block describes, and chooses the first group,
+ * starting from a random one, whose number of free entries is not less
+ * than the average.  Allocating unrelated sets of entries from the chosen
+ * groups keeps each set close together while filling groups evenly.
+ *
+ * Return Value: On success, 0 is returned and the first entry number of
+ * the chosen group is stored in the place pointed by @target.  On error,
+ * one of the following negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ */
+int nilfs_palloc_spread_target(struct inode *inode, unsigned long maxgroup,
+			       __u64 *target)
+{
+	struct nilfs_palloc_group_desc *desc;
+	struct buffer_head *desc_bh;
+	unsigned long ngroups, group, i;
+	u64 total = 0;
+	void *desc_kaddr;
+	int ret;
+
+	ngroups = min3(maxgroup + 1, nilfs_palloc_groups_count(inode),
+		       nilfs_palloc_groups_per_desc_block(inode));
+
+	ret = nilfs_palloc_get_desc_block(inode, 0, 1, &desc_bh);
+	if (ret < 0)
+		return ret;
+
+	desc_kaddr = kmap(desc_bh->b_page);
+	desc = nilfs_palloc_block_get_group_desc(inode, 0, desc_bh,
+						 desc_kaddr);
+	for (i = 0; i < ngroups; i++)
+		total += nilfs_palloc_group_desc_nfrees(
+			&desc[i], nilfs_mdt_bgl_lock(inode, i));
+
+	group = get_random_u32_below(ngroups);
+	for (i = 0; i < ngroups; i++, group = (group + 1) % ngroups) {
+		if ((u64)nilfs_palloc_group_desc_nfrees(
+			    &desc[group], nilfs_mdt_bgl_lock(inode, group)) *
+		    ngroups >= total)
+			break;
+	}
+	kunmap(desc_bh->b_page);
+	brelse(desc_bh);
+
+	*target = (__u64)group * nilfs_palloc_entries_per_group(inode);
+	return 0;
+}
+
 /**
  * nilfs_palloc_prepare_alloc_entry - prepare to allocate a persistent object
  * @inode: inode of metadata file using this allocator
@@ -536,6 +739,8 @@ int nilfs_palloc_prepare_alloc_entry(struct inode *inode,
 					inode, group, 1, &bitmap_bh);
 				if (ret < 0)
 					goto out_desc;
+				nilfs_palloc_update_desc_blocks(inode,
+					group / nilfs_palloc_groups_per_desc_block(inode) + 1);
 				bitmap_kaddr = kmap(bitmap_bh->b_page);
 				bitmap = bitmap_kaddr + bh_offset(bitmap_bh);
 				pos = nilfs_palloc_find_available_slot(
@@ -545,6 +750,7 @@ int nilfs_palloc_prepare_alloc_entry(struct inode *inode,
 					/* found a free entry */
 					nilfs_palloc_group_desc_add_entries(
 						desc, lock, -1);
+					nilfs_palloc_add_free_count(inode, -1);
 					req->pr_entry_nr =
 						entries_per_group * group + pos;
 					kunmap(desc_bh->b_page);
@@ -612,13 +818,15 @@ void nilfs_palloc_commit_free_entry(struct inode *inode,
 	bitmap = bitmap_kaddr + bh_offset(req->pr_bitmap_bh);
 	lock = nilfs_mdt_bgl_lock(inode, group);
 
-	if (!nilfs_clear_bit_atomic(lock, group_offset, bitmap))
+	if (!nilfs_clear_bit_atomic(lock, group_offset, bitmap)) {
 		nilfs_warn(inode->i_sb,
 			   "%s (ino=%lu): entry number %llu already freed",
 			   __func__, inode->i_ino,
 			   (unsigned long long)req->pr_entry_nr);
-	else
+	} else {
 		nilfs_palloc_group_desc_add_entries(desc, lock, 1);
+		nilfs_palloc_add_free_count(inode, 1);
+	}
 
 	kunmap(req->pr_bitmap_bh->b_page);
 	kunmap(req->pr_desc_bh->b_page);
@@ -653,13 +861,15 @@ void nilfs_palloc_abort_alloc_entry(struct inode *inode,
 	bitmap = bitmap_kaddr + bh_offset(req->pr_bitmap_bh);
 	lock = nilfs_mdt_bgl_lock(inode, group);
 
-	if (!nilfs_clear_bit_atomic(lock, group_offset, bitmap))
+	if (!nilfs_clear_bit_atomic(lock, group_offset, bitmap)) {
 		nilfs_warn(inode->i_sb,
 			   "%s (ino=%lu): entry number %llu already freed",
 			   __func__, inode->i_ino,
 			   (unsigned long long)req->pr_entry_nr);
-	else
+	} else {
 		nilfs_palloc_group_desc_add_entries(desc, lock, 1);
+		nilfs_palloc_add_free_count(inode, 1);
+	}
 
 	kunmap(req->pr_bitmap_bh->b_page);
 	kunmap(req->pr_desc_bh->b_page);
@@ -715,6 +925,65 @@ void nilfs_palloc_abort_free_entry(struct inode *inode,
 	req->pr_desc_bh = NULL;
 }
 
+/**
+ * nilfs_palloc_find_used_entry - find an entry in use
+ * @inode: inode of metadata file using this allocator
+ * @nr: entry number to start searching from [in, out]
+ * @max: upper limit (exclusive) of entry numbers to search
+ *
+ * nilfs_palloc_find_used_entry() looks up the bitmaps of groups for the
+ * first entry in use whose number is in the range [*@nr, @max).  Groups
+ * whose bitmap block has not been allocated are skipped.
+ *
+ * Return Value: On success, 0 is returned and the number of the entry is
+ * stored in the place pointed by @nr.  On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-ENOENT - No entry in use was found.
+ */
+int nilfs_palloc_find_used_entry(struct inode *inode, __u64 *nr, __u64 max)
+{
+	const unsigned long epg = nilfs_palloc_entries_per_group(inode);
+	struct buffer_head *bitmap_bh;
+	unsigned long group, group_offset, end, pos;
+	unsigned char *bitmap;
+	void *bitmap_kaddr;
+	__u64 group_min_nr;
+	int ret;
+
+	while (*nr < max) {
+		group = nilfs_palloc_group(inode, *nr, &group_offset);
+		group_min_nr = (__u64)group * epg;
+
+		ret = nilfs_palloc_get_bitmap_block(inode, group, 0,
+						    &bitmap_bh);
+		if (ret == -ENOENT) {
+			*nr = group_min_nr + epg;
+			continue;
+		} else if (ret < 0) {
+			return ret;
+		}
+
+		end = min_t(__u64, epg, max - group_min_nr);
+		bitmap_kaddr = kmap(bitmap_bh->b_page);
+		bitmap = bitmap_kaddr + bh_offset(bitmap_bh);
+		pos = nilfs_find_next_bit(bitmap, end, group_offset);
+		kunmap(bitmap_bh->b_page);
+		brelse(bitmap_bh);
+
+		if (pos < end) {
+			*nr = group_min_nr + pos;
+			return 0;
+		}
+		*nr = group_min_nr + epg;
+	}
+	return -ENOENT;
+}
+
 /**
  * nilfs_palloc_freev - deallocate a set of persistent objects
  * @inode: inode of metadata file using this allocator
@@ -819,6 +1088,7 @@ int nilfs_palloc_freev(struct inode *inode, __u64 *entry_nrs, size_t nitems)
 			inode, group, desc_bh, desc_kaddr);
 		nfree = nilfs_palloc_group_desc_add_entries(desc, lock, n);
 		kunmap_atomic(desc_kaddr);
+		nilfs_palloc_add_free_count(inode, n);
 		mark_buffer_dirty(desc_bh);
 		nilfs_mdt_mark_dirty(inode);
 		brelse(desc_bh);
@@ -839,6 +1109,8 @@ void nilfs_palloc_setup_cache(struct inode *inode,
 {
 	NILFS_MDT(inode)->mi_palloc_cache = cache;
 	spin_lock_init(&cache->lock);
+	cache->ndescblocks = 0;
+	atomic64_set(&cache->nfrees, -1);
 }
 
 void nilfs_palloc_clear_cache(struct inode *inode)
@@ -852,6 +1124,8 @@ void nilfs_palloc_clear_cache(struct inode *inode)
 	cache->prev_desc.bh = NULL;
 	cache->prev_bitmap.bh = NULL;
 	cache->prev_entry.bh = NULL;
+	cache->ndescblocks = 0;
+	atomic64_set(&cache->nfrees, -1);
 	spin_unlock(&cache->lock);
 }
 
@@ -28,13 +28,22 @@ nilfs_palloc_entries_per_group(const struct inode *inode)
 	return 1UL << (inode->i_blkbits + 3 /* log2(8 = CHAR_BITS) */);
 }
 
+/* Maximum number of entry blocks read ahead at a time */
+#define NILFS_PALLOC_RA_BLOCKS	16
+
 int nilfs_palloc_init_blockgroup(struct inode *, unsigned int);
 int nilfs_palloc_get_entry_block(struct inode *, __u64, int,
 				 struct buffer_head **);
+unsigned long nilfs_palloc_entry_blkoff(const struct inode *, __u64);
+void nilfs_palloc_readahead_entries(struct inode *inode, const __u64 *nrs,
+				    size_t nitems);
 void *nilfs_palloc_block_get_entry(const struct inode *, __u64,
 				   const struct buffer_head *, void *);
 
 int nilfs_palloc_count_max_entries(struct inode *, u64, u64 *);
+int nilfs_palloc_init_free_count(struct inode *inode, u64 nused);
+int nilfs_palloc_spread_target(struct inode *inode, unsigned long maxgroup,
+			       __u64 *target);
 
 /**
  * nilfs_palloc_req - persistent allocator request and reply
@@ -59,6 +68,7 @@ void nilfs_palloc_commit_free_entry(struct inode *, struct nilfs_palloc_req *);
 int nilfs_palloc_prepare_free_entry(struct inode *, struct nilfs_palloc_req *);
 void nilfs_palloc_abort_free_entry(struct inode *, struct nilfs_palloc_req *);
 int nilfs_palloc_freev(struct inode *, __u64 *, size_t);
+int nilfs_palloc_find_used_entry(struct inode *inode, __u64 *nr, __u64 max);
 
 #define nilfs_set_bit_atomic		ext2_set_bit_atomic
 #define nilfs_clear_bit_atomic		ext2_clear_bit_atomic
@@ -81,12 +91,18 @@ struct nilfs_bh_assoc {
  * @prev_desc: blockgroup descriptors cache
  * @prev_bitmap: blockgroup bitmap cache
  * @prev_entry: translation entries cache
+ * @ndescblocks: number of group descriptor blocks in use, or zero if it has
+ *               not been counted yet
+ * @nfrees: number of free entries described by the group descriptor blocks,
+ *          or negative if it is not maintained
  */
 struct nilfs_palloc_cache {
 	spinlock_t lock;
 	struct nilfs_bh_assoc prev_desc;
 	struct nilfs_bh_assoc prev_bitmap;
 	struct nilfs_bh_assoc prev_entry;
+	unsigned long ndescblocks;
+	atomic64_t nfrees;
 };
 
 void nilfs_palloc_setup_cache(struct inode *inode,
@@ -0,0 +1,478 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit benchmark of the NILFS persistent object allocator
+ *
+ * The allocator is exercised on a metadata file inode that lives only in
+ * memory: the inode is attached to a pseudo super block whose the_nilfs
+ * has no log writer, so every block created by the allocator stays dirty
+ * in the page cache and no I/O is ever issued.
+ */
+
+#include <kunit/test.h>
+#include <linux/fs_context.h>
+#include <linux/pseudo_fs.h>
+#include <linux/mount.h>
+#include <linux/magic.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/sort.h>
+#include "nilfs.h"
+#include "mdt.h"
+#include "alloc.h"
+
+/* Number of groups making up the region that is filled before measuring */
+#define NILFS_PALLOC_TEST_NGROUPS	4
+
+/* Number of timed allocations per thread */
+#define NILFS_PALLOC_TEST_NOPS		8192
+
+/* Number of entries held by a thread before they are freed again */
+#define NILFS_PALLOC_TEST_BATCH		64
+
+/* Number of entries released by one nilfs_palloc_freev() call */
+#define NILFS_PALLOC_TEST_FREEV_BATCH	1024
+
+#define NILFS_PALLOC_TEST_MAX_THREADS	8
+
+enum {
+	NILFS_PALLOC_FILL_SEQUENTIAL,	/* used entries packed at the head */
+	NILFS_PALLOC_FILL_STRIDED,	/* used entries evenly interleaved */
+	NILFS_PALLOC_FILL_RANDOM,	/* used entries randomly scattered */
+};
+
+/**
+ * struct nilfs_palloc_bench_param - benchmark case description
+ * @name: name of the case
+ * @entry_size: size of the persistent object
+ * @fill: percentage of the region used before measuring
+ * @pattern: how the used entries are laid out in the region
+ * @nthreads: number of threads allocating and freeing concurrently
+ */
+struct nilfs_palloc_bench_param {
+	const char *name;
+	unsigned int entry_size;
+	unsigned int fill;
+	int pattern;
+	unsigned int nthreads;
+};
+
+static const struct nilfs_palloc_bench_param nilfs_palloc_bench_params[] = {
+	{ "dat-empty", 32, 0, NILFS_PALLOC_FILL_SEQUENTIAL, 1 },
+	{ "dat-half", 32, 50, NILFS_PALLOC_FILL_SEQUENTIAL, 1 },
+	{ "dat-full", 32, 99, NILFS_PALLOC_FILL_SEQUENTIAL, 1 },
+	{ "dat-half-strided", 32, 50, NILFS_PALLOC_FILL_STRIDED, 1 },
+	{ "dat-full-strided", 32, 99, NILFS_PALLOC_FILL_STRIDED, 1 },
+	{ "dat-half-random", 32, 50, NILFS_PALLOC_FILL_RANDOM, 1 },
+	{ "dat-full-random", 32, 99, NILFS_PALLOC_FILL_RANDOM, 1 },
+	{ "ifile-half", 128, 50, NILFS_PALLOC_FILL_SEQUENTIAL, 1 },
+	{ "ifile-full-random", 128, 99, NILFS_PALLOC_FILL_RANDOM, 1 },
+	{ "dat-empty-mt", 32, 0, NILFS_PALLOC_FILL_SEQUENTIAL, 4 },
+	{ "dat-half-mt", 32, 50, NILFS_PALLOC_FILL_SEQUENTIAL, 4 },
+	{ "dat-full-mt", 32, 99, NILFS_PALLOC_FILL_SEQUENTIAL, 4 },
+	{ "dat-full-random-mt", 32, 99, NILFS_PALLOC_FILL_RANDOM, 4 },
+	{ "ifile-full-strided-mt", 128, 99, NILFS_PALLOC_FILL_STRIDED, 4 },
+};
+
+static void
+nilfs_palloc_bench_param_to_desc(const struct nilfs_palloc_bench_param *p,
+				 char *desc)
+{
+	strscpy(desc, p->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(nilfs_palloc_bench, nilfs_palloc_bench_params,
+		  nilfs_palloc_bench_param_to_desc);
+
+/**
+ * struct nilfs_palloc_test_ctx - per-test context
+ * @mnt: pseudo file system mount holding the super block
+ * @nilfs: minimal the_nilfs object attached to the super block
+ * @inode: metadata file inode using the allocator
+ * @cache: persistent object allocator cache of @inode
+ */
+struct nilfs_palloc_test_ctx {
+	struct vfsmount *mnt;
+	struct the_nilfs *nilfs;
+	struct inode *inode;
+	struct nilfs_palloc_cache cache;
+};
+
+/**
+ * struct nilfs_palloc_bench_thread - per-thread state of a timed run
+ * @inode: metadata file inode using the allocator
+ * @nops: number of allocations to perform
+ * @alloc_ns: total time spent in allocations [out]
+ * @free_ns: total time spent in deallocations [out]
+ * @err: error code [out]
+ * @done: completion signaled when the thread finishes
+ */
+struct nilfs_palloc_bench_thread {
+	struct inode *inode;
+	unsigned int nops;
+	u64 alloc_ns;
+	u64 free_ns;
+	int err;
+	struct completion done;
+};
+
+static const struct super_operations nilfs_palloc_test_sops = {
+	.alloc_inode	= nilfs_alloc_inode,
+	.free_inode	= nilfs_free_inode,
+	.evict_inode	= nilfs_evict_inode,
+};
+
+static int nilfs_palloc_test_init_fs_context(struct fs_context *fc)
+{
+	struct pseudo_fs_context *ctx = init_pseudo(fc, NILFS_SUPER_MAGIC);
+
+	if (!ctx)
+		return -ENOMEM;
+	ctx->ops = &nilfs_palloc_test_sops;
+	return 0;
+}
+
+static struct file_system_type nilfs_palloc_test_fs_type = {
+	.name			= "nilfs2_palloc_test",
+	.init_fs_context	= nilfs_palloc_test_init_fs_context,
+	.kill_sb		= kill_anon_super,
+};
+
+static int nilfs_palloc_test_alloc(struct inode *inode, __u64 *nr)
+{
+	struct nilfs_palloc_req req = {
+		.pr_entry_nr = *nr, .pr_entry_bh = NULL
+	};
+	int ret;
+
+	ret = nilfs_palloc_prepare_alloc_entry(inode, &req);
+	if (ret)
+		return ret;
+	ret = nilfs_palloc_get_entry_block(inode, req.pr_entry_nr, 1,
+					   &req.pr_entry_bh);
+	if (ret) {
+		nilfs_palloc_abort_alloc_entry(inode, &req);
+		return ret;
+	}
+	nilfs_palloc_commit_alloc_entry(inode, &req);
+	mark_buffer_dirty(req.pr_entry_bh);
+	brelse(req.pr_entry_bh);
+	*nr = req.pr_entry_nr;
+	return 0;
+}
+
+static int nilfs_palloc_test_free(struct inode *inode, __u64 nr)
+{
+	struct nilfs_palloc_req req = {
+		.pr_entry_nr = nr, .pr_entry_bh = NULL
+	};
+	int ret;
+
+	ret = nilfs_palloc_prepare_free_entry(inode, &req);
+	if (ret)
+		return ret;
+	ret = nilfs_palloc_get_entry_block(inode, req.pr_entry_nr, 0,
+					   &req.pr_entry_bh);
+	if (ret) {
+		nilfs_palloc_abort_free_entry(inode, &req);
+		return ret;
+	}
+	mark_buffer_dirty(req.pr_entry_bh);
+	brelse(req.pr_entry_bh);
+	nilfs_palloc_commit_free_entry(inode, &req);
+	return 0;
+}
+
+static int nilfs_palloc_test_setup(struct kunit *test, unsigned int entry_size)
+{
+	struct nilfs_palloc_test_ctx *ctx = test->priv;
+	struct nilfs_inode raw_inode = {
+		.i_mode = cpu_to_le16(S_IFREG),
+		.i_links_count = cpu_to_le16(1),
+	};
+	struct super_block *sb;
+	struct inode *inode;
+	int err;
+
+	ctx->mnt = kern_mount(&nilfs_palloc_test_fs_type);
+	if (IS_ERR(ctx->mnt)) {
+		err = PTR_ERR(ctx->mnt);
+		ctx->mnt = NULL;
+		return err;
+	}
+	sb = ctx->mnt->mnt_sb;
+
+	ctx->nilfs = kunit_kzalloc(test, sizeof(*ctx->nilfs), GFP_KERNEL);
+	if (!ctx->nilfs)
+		return -ENOMEM;
+	init_rwsem(&ctx->nilfs->ns_sem);
+	init_rwsem(&ctx->nilfs->ns_segctor_sem);
+	ctx->nilfs->ns_sb = sb;
+	ctx->nilfs->ns_cno = 1;
+	ctx->nilfs->ns_blocksize_bits = sb->s_blocksize_bits;
+	ctx->nilfs->ns_blocksize = sb->s_blocksize;
+	ctx->nilfs->ns_first_ino = NILFS_USER_INO;
+	sb->s_fs_info = ctx->nilfs;
+
+	/*
+	 * Use the inode number of DAT so that the bmap uses physical block
+	 * pointers and never needs a DAT to translate B-tree node blocks.
+	 */
+	inode = nilfs_iget_locked(sb, NULL, NILFS_DAT_INO);
+	if (!inode)
+		return -ENOMEM;
+
+	err = nilfs_mdt_init(inode, NILFS_MDT_GFP, sizeof(struct nilfs_mdt_info));
+	if (err)
+		goto failed;
+
+	err = nilfs_palloc_init_blockgroup(inode, entry_size);
+	if (err)
+		goto failed;
+
+	nilfs_palloc_setup_cache(inode, &ctx->cache);
+
+	err = nilfs_read_inode_common(inode, &raw_inode);
+	if (err)
+		goto failed;
+
+	unlock_new_inode(inode);
+	ctx->inode = inode;
+	return 0;
+
+ failed:
+	iget_failed(inode);
+	return err;
+}
+
+static int nilfs_palloc_test_init(struct kunit *test)
+{
+	test->priv = kunit_kzalloc(test, sizeof(struct nilfs_palloc_test_ctx),
+				   GFP_KERNEL);
+	return test->priv ? 0 : -ENOMEM;
+}
+
+static void nilfs_palloc_test_exit(struct kunit *test)
+{
+	struct nilfs_palloc_test_ctx *ctx = test->priv;
+
+	iput(ctx->inode);	/* iput(NULL) is safe */
+	if (ctx->mnt)
+		kern_unmount(ctx->mnt);
+}
+
+static int nilfs_palloc_test_cmp_nr(const void *a, const void *b)
+{
+	const __u64 *nr1 = a, *nr2 = b;
+
+	return *nr1 < *nr2 ? -1 : *nr1 > *nr2;
+}
+
+/**
+ * nilfs_palloc_test_fill - bring the allocator to the requested fill level
+ * @test: test context
+ * @param: benchmark case description
+ * @nentries: number of entries in the region [out]
+ *
+ * The region is first allocated entirely for the fragmented patterns, and
+ * the unused part is then released with nilfs_palloc_freev() so that the
+ * remaining entries are spread over all groups of the region.
+ */
+static int nilfs_palloc_test_fill(struct kunit *test,
+				  const struct nilfs_palloc_bench_param *param,
+				  unsigned long *nentries)
+{
+	struct nilfs_palloc_test_ctx *ctx = test->priv;
+	struct inode *inode = ctx->inode;
+	unsigned long region, nfill, i, nfrees = 0;
+	__u64 *frees, nr;
+	bool keep;
+	int ret = 0;
+
+	region = nilfs_palloc_entries_per_group(inode) *
+		NILFS_PALLOC_TEST_NGROUPS;
+	*nentries = region;
+
+	if (param->pattern == NILFS_PALLOC_FILL_SEQUENTIAL) {
+		nfill = region * param->fill / 100;
+		for (i = 0; i < nfill; i++) {
+			nr = 0;
+			ret = nilfs_palloc_test_alloc(inode, &nr);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	frees = kvmalloc_array(region, sizeof(*frees), GFP_KERNEL);
+	if (!frees)
+		return -ENOMEM;
+
+	for (i = 0; i < region; i++) {
+		nr = i;
+		ret = nilfs_palloc_test_alloc(inode, &nr);
+		if (ret)
+			goto out;
+
+		if (param->pattern == NILFS_PALLOC_FILL_STRIDED)
+			keep = (i * param->fill) % 100 < param->fill;
+		else
+			keep = get_random_u32_below(100) < param->fill;
+		if (!keep)
+			frees[nfrees++] = nr;
+	}
+
+	sort(frees, nfrees, sizeof(*frees), nilfs_palloc_test_cmp_nr, NULL);
+	for (i = 0; i < nfrees; i += NILFS_PALLOC_TEST_FREEV_BATCH) {
+		ret = nilfs_palloc_freev(inode, frees + i,
+					 min_t(unsigned long, nfrees - i,
+					       NILFS_PALLOC_TEST_FREEV_BATCH));
+		if (ret)
+			break;
+	}
+ out:
+	kvfree(frees);
+	return ret;
+}
+
+static int nilfs_palloc_bench_thread_fn(void *data)
+{
+	struct nilfs_palloc_bench_thread *th = data;
+	__u64 nrs[NILFS_PALLOC_TEST_BATCH];
+	unsigned int i, j, n;
+	u64 t0;
+	int ret = 0;
+
+	for (i = 0; i < th->nops && !ret; i += n) {
+		n = min_t(unsigned int, th->nops - i, NILFS_PALLOC_TEST_BATCH);
+
+		t0 = ktime_get_ns();
+		for (j = 0; j < n; j++) {
+			nrs[j] = 0;
+			ret = nilfs_palloc_test_alloc(th->inode, &nrs[j]);
+			if (ret) {
+				n = j;
+				break;
+			}
+		}
+		th->alloc_ns += ktime_get_ns() - t0;
+
+		t0 = ktime_get_ns();
+		for (j = 0; j < n; j++) {
+			int err = nilfs_palloc_test_free(th->inode, nrs[j]);
+
+			if (err && !ret)
+				ret = err;
+		}
+		th->free_ns += ktime_get_ns() - t0;
+		cond_resched();
+	}
+	th->err = ret;
+	complete(&th->done);
+	return 0;
+}
+
+/**
+ * nilfs_palloc_test_freev_bench - measure batched deallocation
+ * @test: test context
+ * @ns_per_entry: average time to free an entry [out]
+ */
+static int nilfs_palloc_test_freev_bench(struct kunit *test, u64 *ns_per_entry)
+{
+	struct nilfs_palloc_test_ctx *ctx = test->priv;
+	__u64 *nrs;
+	unsigned int i;
+	u64 t0, elapsed;
+	int ret = 0;
+
+	nrs = kvmalloc_array(NILFS_PALLOC_TEST_FREEV_BATCH, sizeof(*nrs),
+			     GFP_KERNEL);
+	if (!nrs)
+		return -ENOMEM;
+
+	for (i = 0; i < NILFS_PALLOC_TEST_FREEV_BATCH; i++) {
+		nrs[i] = 0;
+		ret = nilfs_palloc_test_alloc(ctx->inode, &nrs[i]);
+		if (ret)
+			goto out;
+	}
+	sort(nrs, NILFS_PALLOC_TEST_FREEV_BATCH, sizeof(*nrs),
+	     nilfs_palloc_test_cmp_nr, NULL);
+
+	t0 = ktime_get_ns();
+	ret = nilfs_palloc_freev(ctx->inode, nrs,
+				 NILFS_PALLOC_TEST_FREEV_BATCH);
+	elapsed = ktime_get_ns() - t0;
+	*ns_per_entry = div_u64(elapsed, NILFS_PALLOC_TEST_FREEV_BATCH);
+ out:
+	kvfree(nrs);
+	return ret;
+}
+
+static void nilfs_palloc_bench(struct kunit *test)
+{
+	const struct nilfs_palloc_bench_param *param = test->param_value;
+	struct nilfs_palloc_test_ctx *ctx = test->priv;
+	struct nilfs_palloc_bench_thread *threads;
+	struct task_struct *task;
+	unsigned long nentries;
+	u64 alloc_ns = 0, free_ns = 0, freev_ns = 0, nops, t0, wall;
+	unsigned int i;
+	int ret;
+
+	KUNIT_ASSERT_LE(test, param->nthreads, NILFS_PALLOC_TEST_MAX_THREADS);
+	KUNIT_ASSERT_EQ(test, nilfs_palloc_test_setup(test, param->entry_size),
+			0);
+	KUNIT_ASSERT_EQ(test, nilfs_palloc_test_fill(test, param, &nentries),
+			0);
+
+	threads = kunit_kcalloc(test, param->nthreads, sizeof(*threads),
+				GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, threads);
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < param->nthreads; i++) {
+		threads[i].inode = ctx->inode;
+		threads[i].nops = NILFS_PALLOC_TEST_NOPS;
+		init_completion(&threads[i].done);
+		task = kthread_run(nilfs_palloc_bench_thread_fn, &threads[i],
+				   "nilfs_palloc_bench/%u", i);
+		if (IS_ERR(task)) {
+			threads[i].err = PTR_ERR(task);
+			complete(&threads[i].done);
+		}
+	}
+	for (i = 0; i < param->nthreads; i++) {
+		wait_for_completion(&threads[i].done);
+		KUNIT_EXPECT_EQ(test, threads[i].err, 0);
+		alloc_ns += threads[i].alloc_ns;
+		free_ns += threads[i].free_ns;
+	}
+	wall = ktime_get_ns() - t0;
+
+	ret = nilfs_palloc_test_freev_bench(test, &freev_ns);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+
+	nops = (u64)NILFS_PALLOC_TEST_NOPS * param->nthreads;
+	kunit_info(test,
+		   "%s: entry %u bytes, %u%% of %lu entries used, %u thread(s): alloc %llu ns/op, free %llu ns/op, freev %llu ns/entry, %llu ops/s\n",
+		   param->name, param->entry_size, param->fill, nentries,
+		   param->nthreads, div64_u64(alloc_ns, nops),
+		   div64_u64(free_ns, nops), freev_ns,
+		   div64_u64(nops * NSEC_PER_SEC, max_t(u64, wall, 1)));
+}
+
+static struct kunit_case nilfs_palloc_test_cases[] = {
+	KUNIT_CASE_PARAM(nilfs_palloc_bench, nilfs_palloc_bench_gen_params),
+	{},
+};
+
+static struct kunit_suite nilfs_palloc_test_suite = {
+	.name = "nilfs2_palloc",
+	.init = nilfs_palloc_test_init,
+	.exit = nilfs_palloc_test_exit,
+	.test_cases = nilfs_palloc_test_cases,
+};
+
+kunit_test_suites(&nilfs_palloc_test_suite);
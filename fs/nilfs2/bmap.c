@@ -26,6 +26,13 @@ struct inode *nilfs_bmap_get_dat(const struct nilfs_bmap *bmap)
 	return nilfs->ns_dat;
 }
 
+#ifdef CONFIG_NILFS2_FS_INODE_STATS
+void nilfs_bmap_stat_dat_alloc(const struct nilfs_bmap *bmap)
+{
+	nilfs_inode_stat_add(bmap->b_inode, NILFS_ISTAT_DAT_ALLOCS, 1);
+}
+#endif
+
 static int nilfs_bmap_convert_error(struct nilfs_bmap *bmap,
 				     const char *fname, int err)
 {
@@ -91,6 +98,36 @@ int nilfs_bmap_lookup_at_level(struct nilfs_bmap *bmap, __u64 key, int level,
 	return nilfs_bmap_convert_error(bmap, __func__, ret);
 }
 
+/**
+ * nilfs_bmap_lookup_ptr - find the pointer to a data block
+ * @bmap: bmap
+ * @key: key
+ * @ptrp: place to store the pointer associated to @key
+ *
+ * Description: nilfs_bmap_lookup_ptr() is the same as nilfs_bmap_lookup()
+ * except that it does not translate virtual block numbers.  This allows to
+ * get the virtual block number of a block not yet assigned a disk block.
+ *
+ * Return Value: On success, 0 is returned and the pointer associated with
+ * @key is stored in the place pointed by @ptrp. On error, one of the
+ * following negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-ENOENT - A record associated with @key does not exist.
+ */
+int nilfs_bmap_lookup_ptr(struct nilfs_bmap *bmap, __u64 key, __u64 *ptrp)
+{
+	int ret;
+
+	down_read(&bmap->b_sem);
+	ret = bmap->b_ops->bop_lookup(bmap, key, 1, ptrp);
+	up_read(&bmap->b_sem);
+	return nilfs_bmap_convert_error(bmap, __func__, ret);
+}
+
 int nilfs_bmap_lookup_contig(struct nilfs_bmap *bmap, __u64 key, __u64 *ptrp,
 			     unsigned int maxblocks)
 {
@@ -256,6 +293,42 @@ int nilfs_bmap_delete(struct nilfs_bmap *bmap, __u64 key)
 	return nilfs_bmap_convert_error(bmap, __func__, ret);
 }
 
+/**
+ * nilfs_bmap_replace - replace the pointer to a data block
+ * @bmap: bmap
+ * @key: key
+ * @ptr: virtual block number of a block shared with another file
+ *
+ * Description: nilfs_bmap_replace() ends the virtual block number
+ * associated with @key and associates @key with @ptr instead.  The
+ * caller must have counted the new reference to @ptr with
+ * nilfs_dat_share().
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-ENOENT - A record associated with @key does not exist.
+ *
+ * %-EOPNOTSUPP - @bmap does not use virtual block numbers.
+ */
+int nilfs_bmap_replace(struct nilfs_bmap *bmap, __u64 key, __u64 ptr)
+{
+	int ret;
+
+	if (!NILFS_BMAP_USE_VBN(bmap) || !bmap->b_ops->bop_replace)
+		return -EOPNOTSUPP;
+
+	down_write(&bmap->b_sem);
+	ret = bmap->b_ops->bop_replace(bmap, key, ptr);
+	up_write(&bmap->b_sem);
+
+	return nilfs_bmap_convert_error(bmap, __func__, ret);
+}
+
 static int nilfs_bmap_do_truncate(struct nilfs_bmap *bmap, __u64 key)
 {
 	__u64 lastkey;
@@ -51,6 +51,7 @@ struct nilfs_bmap_operations {
 				 unsigned int);
 	int (*bop_insert)(struct nilfs_bmap *, __u64, __u64);
 	int (*bop_delete)(struct nilfs_bmap *, __u64);
+	int (*bop_replace)(struct nilfs_bmap *, __u64, __u64);
 	void (*bop_clear)(struct nilfs_bmap *);
 
 	int (*bop_propagate)(struct nilfs_bmap *, struct buffer_head *);
@@ -148,6 +149,7 @@ void nilfs_bmap_write(struct nilfs_bmap *, struct nilfs_inode *);
 int nilfs_bmap_lookup_contig(struct nilfs_bmap *, __u64, __u64 *, unsigned int);
 int nilfs_bmap_insert(struct nilfs_bmap *bmap, __u64 key, unsigned long rec);
 int nilfs_bmap_delete(struct nilfs_bmap *bmap, __u64 key);
+int nilfs_bmap_replace(struct nilfs_bmap *bmap, __u64 key, __u64 ptr);
 int nilfs_bmap_seek_key(struct nilfs_bmap *bmap, __u64 start, __u64 *keyp);
 int nilfs_bmap_last_key(struct nilfs_bmap *bmap, __u64 *keyp);
 int nilfs_bmap_truncate(struct nilfs_bmap *bmap, __u64 key);
@@ -157,6 +159,7 @@ void nilfs_bmap_lookup_dirty_buffers(struct nilfs_bmap *, struct list_head *);
 int nilfs_bmap_assign(struct nilfs_bmap *, struct buffer_head **,
 		      unsigned long, union nilfs_binfo *);
 int nilfs_bmap_lookup_at_level(struct nilfs_bmap *, __u64, int, __u64 *);
+int nilfs_bmap_lookup_ptr(struct nilfs_bmap *bmap, __u64 key, __u64 *ptrp);
 int nilfs_bmap_mark(struct nilfs_bmap *, __u64, int);
 
 void nilfs_bmap_init_gc(struct nilfs_bmap *);
@@ -175,6 +178,12 @@ static inline int nilfs_bmap_lookup(struct nilfs_bmap *bmap, __u64 key,
  */
 struct inode *nilfs_bmap_get_dat(const struct nilfs_bmap *);
 
+#ifdef CONFIG_NILFS2_FS_INODE_STATS
+void nilfs_bmap_stat_dat_alloc(const struct nilfs_bmap *);
+#else
+static inline void nilfs_bmap_stat_dat_alloc(const struct nilfs_bmap *bmap) {}
+#endif
+
 static inline int nilfs_bmap_prepare_alloc_ptr(struct nilfs_bmap *bmap,
 					       union nilfs_bmap_ptr_req *req,
 					       struct inode *dat)
@@ -190,8 +199,10 @@ static inline void nilfs_bmap_commit_alloc_ptr(struct nilfs_bmap *bmap,
 					       union nilfs_bmap_ptr_req *req,
 					       struct inode *dat)
 {
-	if (dat)
+	if (dat) {
 		nilfs_dat_commit_alloc(dat, &req->bpr_req);
+		nilfs_bmap_stat_dat_alloc(bmap);
+	}
 }
 
 static inline void nilfs_bmap_abort_alloc_ptr(struct nilfs_bmap *bmap,
@@ -43,6 +43,43 @@ void nilfs_btnode_cache_clear(struct address_space *btnc)
 	truncate_inode_pages(btnc, 0);
 }
 
+/**
+ * nilfs_btnode_forget_blocks - invalidate cached node blocks
+ * @btnc: B-tree node cache
+ * @blocknrs: array of block numbers to be invalidated
+ * @nitems: number of elements in @blocknrs
+ *
+ * nilfs_btnode_forget_blocks() clears the uptodate flag of node blocks
+ * cached for @blocknrs so that they are read again from disk if the block
+ * numbers are looked up later.  Dirty blocks are left untouched.
+ */
+void nilfs_btnode_forget_blocks(struct address_space *btnc, __u64 *blocknrs,
+				size_t nitems)
+{
+	unsigned int bits = PAGE_SHIFT - btnc->host->i_blkbits;
+	struct buffer_head *bh;
+	struct page *page;
+	unsigned int n;
+	size_t i;
+
+	for (i = 0; i < nitems; i++) {
+		page = find_lock_page(btnc, blocknrs[i] >> bits);
+		if (!page)
+			continue;
+		if (page_has_buffers(page)) {
+			bh = page_buffers(page);
+			for (n = blocknrs[i] & ((1UL << bits) - 1); n > 0; n--)
+				bh = bh->b_this_page;
+			if (!buffer_dirty(bh)) {
+				clear_buffer_uptodate(bh);
+				ClearPageUptodate(page);
+			}
+		}
+		unlock_page(page);
+		put_page(page);
+	}
+}
+
 struct buffer_head *
 nilfs_btnode_create_block(struct address_space *btnc, __u64 blocknr)
 {
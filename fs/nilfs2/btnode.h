@@ -32,6 +32,8 @@ struct nilfs_btnode_chkey_ctxt {
 
 void nilfs_init_btnc_inode(struct inode *btnc_inode);
 void nilfs_btnode_cache_clear(struct address_space *);
+void nilfs_btnode_forget_blocks(struct address_space *btnc, __u64 *blocknrs,
+				size_t nitems);
 struct buffer_head *nilfs_btnode_create_block(struct address_space *btnc,
 					      __u64 blocknr);
 int nilfs_btnode_submit_block(struct address_space *, __u64, sector_t,
@@ -1607,6 +1607,41 @@ static int nilfs_btree_delete(struct nilfs_bmap *btree, __u64 key)
 	return ret;
 }
 
+static int nilfs_btree_replace(struct nilfs_bmap *btree, __u64 key, __u64 ptr)
+{
+	const int level = NILFS_BTREE_LEVEL_NODE_MIN;
+	struct nilfs_btree_path *path;
+	struct nilfs_btree_node *node;
+	union nilfs_bmap_ptr_req req;
+	struct inode *dat;
+	int ncmax, ret;
+
+	path = nilfs_btree_alloc_path();
+	if (path == NULL)
+		return -ENOMEM;
+
+	ret = nilfs_btree_do_lookup(btree, path, key, &req.bpr_ptr, level, 0);
+	if (ret < 0)
+		goto out;
+
+	dat = nilfs_bmap_get_dat(btree);
+	ret = nilfs_bmap_prepare_end_ptr(btree, &req, dat);
+	if (ret < 0)
+		goto out;
+	nilfs_bmap_commit_end_ptr(btree, &req, dat);
+
+	node = nilfs_btree_get_node(btree, path, level, &ncmax);
+	nilfs_btree_node_set_ptr(node, path[level].bp_index, ptr, ncmax);
+	if (path[level].bp_bh && !buffer_dirty(path[level].bp_bh))
+		mark_buffer_dirty(path[level].bp_bh);
+	if (!nilfs_bmap_dirty(btree))
+		nilfs_bmap_set_dirty(btree);
+
+out:
+	nilfs_btree_free_path(path);
+	return ret;
+}
+
 static int nilfs_btree_seek_key(const struct nilfs_bmap *btree, __u64 start,
 				__u64 *keyp)
 {
@@ -1949,6 +1984,7 @@ static void nilfs_btree_commit_update_v(struct nilfs_bmap *btree,
 	nilfs_dat_commit_update(dat, &path[level].bp_oldreq.bpr_req,
 				&path[level].bp_newreq.bpr_req,
 				btree->b_ptr_type == NILFS_BMAP_PTR_VS);
+	nilfs_bmap_stat_dat_alloc(btree);
 
 	if (buffer_nilfs_node(path[level].bp_bh)) {
 		nilfs_btnode_commit_change_key(
@@ -2359,6 +2395,7 @@ static const struct nilfs_bmap_operations nilfs_btree_ops = {
 	.bop_lookup_contig	=	nilfs_btree_lookup_contig,
 	.bop_insert		=	nilfs_btree_insert,
 	.bop_delete		=	nilfs_btree_delete,
+	.bop_replace		=	nilfs_btree_replace,
 	.bop_clear		=	NULL,
 
 	.bop_propagate		=	nilfs_btree_propagate,
@@ -2381,6 +2418,7 @@ static const struct nilfs_bmap_operations nilfs_btree_ops_gc = {
 	.bop_lookup_contig	=	NULL,
 	.bop_insert		=	NULL,
 	.bop_delete		=	NULL,
+	.bop_replace		=	NULL,
 	.bop_clear		=	NULL,
 
 	.bop_propagate		=	nilfs_btree_propagate_gc,
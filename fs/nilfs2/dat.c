@@ -11,6 +11,7 @@
 #include <linux/buffer_head.h>
 #include <linux/string.h>
 #include <linux/errno.h>
+#include <linux/bitmap.h>
 #include "nilfs.h"
 #include "mdt.h"
 #include "alloc.h"
@@ -20,16 +21,40 @@
 #define NILFS_CNO_MIN	((__u64)1)
 #define NILFS_CNO_MAX	(~(__u64)0)
 
+/* Maximum number of changed entries tracked for deferred DAT blocks */
+#define NILFS_DAT_MAX_DELTAS	256
+
+/*
+ * A DAT block is written in full once more than 1/NILFS_DAT_DELTA_RATIO of
+ * its entries have changed since it was last written.
+ */
+#define NILFS_DAT_DELTA_RATIO	8
+
 /**
  * struct nilfs_dat_info - on-memory private data of DAT file
  * @mi: on-memory private data of metadata file
  * @palloc_cache: persistent object allocator cache of DAT file
  * @shadow: shadow map of DAT file
+ * @delta_lock: lock protecting the delta fields below
+ * @delta_nrs: entries changed since their blocks were last written
+ * @delta_deferred: entries of @delta_nrs whose blocks are deferred by the
+ *	current construction
+ * @ndeltas: number of entries in @delta_nrs
+ * @nrecords: number of entries reserved in the super root
+ * @max_records: number of entries that fit in a super root
+ * @delta_flush: flag to write all dirty DAT blocks with the next super root
  */
 struct nilfs_dat_info {
 	struct nilfs_mdt_info mi;
 	struct nilfs_palloc_cache palloc_cache;
 	struct nilfs_shadow_map shadow;
+	spinlock_t delta_lock;
+	__u64 delta_nrs[NILFS_DAT_MAX_DELTAS];
+	DECLARE_BITMAP(delta_deferred, NILFS_DAT_MAX_DELTAS);
+	unsigned int ndeltas;
+	unsigned int nrecords;
+	unsigned int max_records;
+	bool delta_flush;
 };
 
 static inline struct nilfs_dat_info *NILFS_DAT_I(struct inode *dat)
@@ -37,6 +62,29 @@ static inline struct nilfs_dat_info *NILFS_DAT_I(struct inode *dat)
 	return (struct nilfs_dat_info *)NILFS_MDT(dat);
 }
 
+static void nilfs_dat_track_entry(struct inode *dat, __u64 vblocknr)
+{
+	struct nilfs_dat_info *di = NILFS_DAT_I(dat);
+	unsigned int i;
+
+	if (!nilfs_has_dat_deltas(dat->i_sb->s_fs_info))
+		return;
+
+	spin_lock(&di->delta_lock);
+	if (di->delta_flush)
+		goto out;
+	for (i = 0; i < di->ndeltas; i++) {
+		if (di->delta_nrs[i] == vblocknr)
+			goto out;
+	}
+	if (di->ndeltas < NILFS_DAT_MAX_DELTAS)
+		di->delta_nrs[di->ndeltas++] = vblocknr;
+	else
+		di->delta_flush = true; /* too many to carry by super roots */
+ out:
+	spin_unlock(&di->delta_lock);
+}
+
 static int nilfs_dat_prepare_entry(struct inode *dat,
 				   struct nilfs_palloc_req *req, int create)
 {
@@ -62,6 +110,7 @@ static void nilfs_dat_commit_entry(struct inode *dat,
 {
 	mark_buffer_dirty(req->pr_entry_bh);
 	nilfs_mdt_mark_dirty(dat);
+	nilfs_dat_track_entry(dat, req->pr_entry_nr);
 	brelse(req->pr_entry_bh);
 }
 
@@ -97,6 +146,7 @@ void nilfs_dat_commit_alloc(struct inode *dat, struct nilfs_palloc_req *req)
 	entry->de_start = cpu_to_le64(NILFS_CNO_MIN);
 	entry->de_end = cpu_to_le64(NILFS_CNO_MAX);
 	entry->de_blocknr = cpu_to_le64(0);
+	entry->de_rsv = cpu_to_le64(0);
 	kunmap_atomic(kaddr);
 
 	nilfs_palloc_commit_alloc_entry(dat, req);
@@ -198,13 +248,23 @@ void nilfs_dat_commit_end(struct inode *dat, struct nilfs_palloc_req *req,
 			  int dead)
 {
 	struct nilfs_dat_entry *entry;
-	__u64 start, end;
+	__u64 start, end, nshared;
 	sector_t blocknr;
 	void *kaddr;
 
 	kaddr = kmap_atomic(req->pr_entry_bh->b_page);
 	entry = nilfs_palloc_block_get_entry(dat, req->pr_entry_nr,
 					     req->pr_entry_bh, kaddr);
+	if (nilfs_has_shared_blocks(dat->i_sb->s_fs_info)) {
+		/* a shared block lives on while another file refers to it */
+		nshared = le64_to_cpu(entry->de_rsv);
+		if (nshared) {
+			entry->de_rsv = cpu_to_le64(nshared - 1);
+			kunmap_atomic(kaddr);
+			nilfs_dat_commit_entry(dat, req);
+			return;
+		}
+	}
 	end = start = le64_to_cpu(entry->de_start);
 	if (!dead) {
 		end = nilfs_mdt_cno(dat);
@@ -296,6 +356,88 @@ int nilfs_dat_mark_dirty(struct inode *dat, __u64 vblocknr)
 	return ret;
 }
 
+static int nilfs_dat_adjust_share(struct inode *dat, __u64 vblocknr,
+				  bool share)
+{
+	struct buffer_head *entry_bh;
+	struct nilfs_dat_entry *entry;
+	__u64 nshared;
+	void *kaddr;
+	int ret;
+
+	ret = nilfs_palloc_get_entry_block(dat, vblocknr, 0, &entry_bh);
+	if (ret < 0)
+		return ret;
+
+	kaddr = kmap_atomic(entry_bh->b_page);
+	entry = nilfs_palloc_block_get_entry(dat, vblocknr, entry_bh, kaddr);
+	nshared = le64_to_cpu(entry->de_rsv);
+	if (share) {
+		if (entry->de_blocknr == cpu_to_le64(0) ||
+		    entry->de_end != cpu_to_le64(NILFS_CNO_MAX))
+			ret = -ESTALE;
+		else
+			entry->de_rsv = cpu_to_le64(nshared + 1);
+	} else {
+		if (WARN_ON(!nshared))
+			ret = -EINVAL;
+		else
+			entry->de_rsv = cpu_to_le64(nshared - 1);
+	}
+	kunmap_atomic(kaddr);
+
+	if (!ret) {
+		mark_buffer_dirty(entry_bh);
+		nilfs_mdt_mark_dirty(dat);
+		nilfs_dat_track_entry(dat, vblocknr);
+	}
+	brelse(entry_bh);
+	return ret;
+}
+
+/**
+ * nilfs_dat_share - add a reference to a block from another file
+ * @dat: DAT file inode
+ * @vblocknr: virtual block number of the block
+ *
+ * Description: nilfs_dat_share() counts a reference to the block of
+ * @vblocknr from a file other than its first owner, so that ending the
+ * block in one of the files does not end the lifetime of the block.
+ * This requires NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS.
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-ESTALE - The block has not been written or its lifetime has ended.
+ */
+int nilfs_dat_share(struct inode *dat, __u64 vblocknr)
+{
+	return nilfs_dat_adjust_share(dat, vblocknr, true);
+}
+
+/**
+ * nilfs_dat_unshare - cancel a reference added by nilfs_dat_share()
+ * @dat: DAT file inode
+ * @vblocknr: virtual block number of the block
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-EINVAL - The block is not shared.
+ */
+int nilfs_dat_unshare(struct inode *dat, __u64 vblocknr)
+{
+	return nilfs_dat_adjust_share(dat, vblocknr, false);
+}
+
 /**
  * nilfs_dat_freev - free virtual block numbers
  * @dat: DAT file inode
@@ -316,7 +458,13 @@ int nilfs_dat_mark_dirty(struct inode *dat, __u64 vblocknr)
  */
 int nilfs_dat_freev(struct inode *dat, __u64 *vblocknrs, size_t nitems)
 {
-	return nilfs_palloc_freev(dat, vblocknrs, nitems);
+	int ret;
+
+	ret = nilfs_palloc_freev(dat, vblocknrs, nitems);
+	if (!ret)
+		nilfs_forget_snapshot_nodes(dat->i_sb->s_fs_info, vblocknrs,
+					    nitems);
+	return ret;
 }
 
 /**
@@ -380,6 +528,7 @@ int nilfs_dat_move(struct inode *dat, __u64 vblocknr, sector_t blocknr)
 
 	mark_buffer_dirty(entry_bh);
 	nilfs_mdt_mark_dirty(dat);
+	nilfs_dat_track_entry(dat, vblocknr);
 
 	brelse(entry_bh);
 
@@ -480,6 +629,228 @@ ssize_t nilfs_dat_get_vinfo(struct inode *dat, void *buf, unsigned int visz,
 	return nvi;
 }
 
+/**
+ * nilfs_dat_defer_block - decide whether to leave a DAT block unwritten
+ * @dat: DAT file inode
+ * @bh: dirty buffer of the DAT block
+ *
+ * Description: nilfs_dat_defer_block() allows the log writer to skip a
+ * dirty entry block whose changes can instead be carried by the super root
+ * as nilfs_dat_delta records.  This is the case when the block is
+ * unchanged on disk except for a small number of tracked entries, and the
+ * entries fit in the super root with those of the other deferred blocks.
+ * The block stays dirty in memory until it is finally written.
+ *
+ * Return Value: true if the block should not be written by the current
+ * construction, false otherwise.
+ */
+bool nilfs_dat_defer_block(struct inode *dat, struct buffer_head *bh)
+{
+	struct nilfs_dat_info *di = NILFS_DAT_I(dat);
+	struct nilfs_bmap *bmap = NILFS_I(dat)->i_bmap;
+	unsigned long blkoff = nilfs_bmap_data_get_key(bmap, bh);
+	unsigned int i, n = 0, limit;
+	bool deferred = false;
+	__u64 blocknr;
+
+	/* a frozen copy for the cleaner is only dropped by writing the block */
+	if (buffer_nilfs_redirected(bh))
+		return false;
+
+	/* nilfs_segctor_complete_write() keeps b_blocknr of DAT blocks */
+	if (bh->b_blocknr == 0 || nilfs_bmap_lookup(bmap, blkoff, &blocknr) ||
+	    blocknr != bh->b_blocknr)
+		return false; /* the block is not on disk as it is mapped */
+
+	limit = max_t(unsigned int, 1, NILFS_MDT(dat)->mi_entries_per_block /
+		      NILFS_DAT_DELTA_RATIO);
+
+	spin_lock(&di->delta_lock);
+	if (di->delta_flush)
+		goto out;
+	for (i = 0; i < di->ndeltas; i++) {
+		if (nilfs_palloc_entry_blkoff(dat, di->delta_nrs[i]) != blkoff)
+			continue;
+		if (test_bit(i, di->delta_deferred)) {
+			deferred = true; /* already reserved by this construction */
+			goto out;
+		}
+		n++;
+	}
+	if (n == 0 || n > limit || di->nrecords + n > di->max_records)
+		goto out;
+
+	for (i = 0; i < di->ndeltas; i++) {
+		if (nilfs_palloc_entry_blkoff(dat, di->delta_nrs[i]) == blkoff)
+			set_bit(i, di->delta_deferred);
+	}
+	di->nrecords += n;
+	deferred = true;
+ out:
+	spin_unlock(&di->delta_lock);
+	return deferred;
+}
+
+/**
+ * nilfs_dat_reset_deltas - cancel the blocks deferred by a construction
+ * @dat: DAT file inode
+ */
+void nilfs_dat_reset_deltas(struct inode *dat)
+{
+	struct nilfs_dat_info *di = NILFS_DAT_I(dat);
+
+	spin_lock(&di->delta_lock);
+	bitmap_zero(di->delta_deferred, NILFS_DAT_MAX_DELTAS);
+	di->nrecords = 0;
+	spin_unlock(&di->delta_lock);
+}
+
+/**
+ * nilfs_dat_write_deltas - store entries of deferred blocks in a super root
+ * @dat: DAT file inode
+ * @buf: area of the super root following the metadata file inodes
+ * @size: size of @buf in bytes
+ *
+ * Description: nilfs_dat_write_deltas() copies the current contents of
+ * the entries reserved by nilfs_dat_defer_block() to @buf as an array of
+ * struct nilfs_dat_delta.  The caller must hold the segment semaphore for
+ * writing, which keeps the reserved entries from changing.
+ *
+ * Return Value: On success, the number of bytes stored in @buf is
+ * returned.  On error, one of the following negative error codes is
+ * returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-E2BIG - The entries do not fit in @buf.
+ */
+ssize_t nilfs_dat_write_deltas(struct inode *dat, void *buf, size_t size)
+{
+	struct nilfs_dat_info *di = NILFS_DAT_I(dat);
+	struct nilfs_dat_delta *delta = buf;
+	struct buffer_head *entry_bh;
+	struct nilfs_dat_entry *entry;
+	void *kaddr;
+	unsigned int i;
+	int ret;
+
+	for_each_set_bit(i, di->delta_deferred, di->ndeltas) {
+		if (WARN_ON((void *)(delta + 1) > buf + size))
+			return -E2BIG;
+
+		ret = nilfs_palloc_get_entry_block(dat, di->delta_nrs[i], 0,
+						   &entry_bh);
+		if (ret < 0)
+			return ret;
+
+		kaddr = kmap_atomic(entry_bh->b_page);
+		entry = nilfs_palloc_block_get_entry(dat, di->delta_nrs[i],
+						     entry_bh, kaddr);
+		delta->dd_vblocknr = cpu_to_le64(di->delta_nrs[i]);
+		delta->dd_entry = *entry;
+		kunmap_atomic(kaddr);
+		brelse(entry_bh);
+		delta++;
+	}
+	return (void *)delta - buf;
+}
+
+/**
+ * nilfs_dat_commit_deltas - update the tracked entries after a super root
+ * @dat: DAT file inode
+ *
+ * Description: nilfs_dat_commit_deltas() is called when a super root has
+ * been written.  Entries of the written DAT blocks are forgotten, and those
+ * of the deferred blocks are kept to be carried by following super roots.
+ */
+void nilfs_dat_commit_deltas(struct inode *dat)
+{
+	struct nilfs_dat_info *di = NILFS_DAT_I(dat);
+	unsigned int i, n = 0;
+
+	spin_lock(&di->delta_lock);
+	for_each_set_bit(i, di->delta_deferred, di->ndeltas)
+		di->delta_nrs[n++] = di->delta_nrs[i];
+	di->ndeltas = n;
+	bitmap_zero(di->delta_deferred, NILFS_DAT_MAX_DELTAS);
+	di->nrecords = 0;
+	if (n == 0)
+		di->delta_flush = false;
+	spin_unlock(&di->delta_lock);
+}
+
+/**
+ * nilfs_dat_flush_deltas - write all deferred DAT blocks at the next chance
+ * @dat: DAT file inode
+ *
+ * Description: nilfs_dat_flush_deltas() makes the next super root be
+ * written together with every dirty DAT block, so that the DAT on disk
+ * no longer depends on super root records.  This is used when the log
+ * writer is stopped.
+ *
+ * Return Value: true if DAT blocks have been deferred, false otherwise.
+ */
+bool nilfs_dat_flush_deltas(struct inode *dat)
+{
+	struct nilfs_dat_info *di = NILFS_DAT_I(dat);
+	bool pending;
+
+	spin_lock(&di->delta_lock);
+	pending = di->ndeltas > 0;
+	if (pending)
+		di->delta_flush = true;
+	spin_unlock(&di->delta_lock);
+	return pending;
+}
+
+/**
+ * nilfs_dat_read_deltas - apply DAT entries carried by a super root
+ * @dat: DAT file inode
+ * @buf: area of the super root following the metadata file inodes
+ * @size: size of @buf in bytes
+ *
+ * Description: nilfs_dat_read_deltas() overwrites DAT entries with the
+ * nilfs_dat_delta records stored by nilfs_dat_write_deltas().  The entry
+ * blocks are left dirty, and the entries are tracked again so that the
+ * following super roots keep carrying them until the blocks are written.
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-EINVAL - A record refers to a missing DAT block.
+ */
+int nilfs_dat_read_deltas(struct inode *dat, const void *buf, size_t size)
+{
+	const struct nilfs_dat_delta *delta = buf;
+	struct nilfs_palloc_req req;
+	struct nilfs_dat_entry *entry;
+	size_t i, n = size / sizeof(*delta);
+	void *kaddr;
+	int ret;
+
+	for (i = 0; i < n; i++, delta++) {
+		req.pr_entry_nr = le64_to_cpu(delta->dd_vblocknr);
+		ret = nilfs_dat_prepare_entry(dat, &req, 0);
+		if (ret < 0)
+			return ret;
+
+		kaddr = kmap_atomic(req.pr_entry_bh->b_page);
+		entry = nilfs_palloc_block_get_entry(dat, req.pr_entry_nr,
+						     req.pr_entry_bh, kaddr);
+		*entry = delta->dd_entry;
+		kunmap_atomic(kaddr);
+
+		nilfs_dat_commit_entry(dat, &req);
+	}
+	return 0;
+}
+
 /**
  * nilfs_dat_read - read or get dat inode
  * @sb: super block instance
@@ -491,6 +862,7 @@ int nilfs_dat_read(struct super_block *sb, size_t entry_size,
 		   struct nilfs_inode *raw_inode, struct inode **inodep)
 {
 	static struct lock_class_key dat_lock_key;
+	struct the_nilfs *nilfs = sb->s_fs_info;
 	struct inode *dat;
 	struct nilfs_dat_info *di;
 	int err;
@@ -521,6 +893,10 @@ int nilfs_dat_read(struct super_block *sb, size_t entry_size,
 
 	di = NILFS_DAT_I(dat);
 	lockdep_set_class(&di->mi.mi_sem, &dat_lock_key);
+	spin_lock_init(&di->delta_lock);
+	di->max_records = (min_t(unsigned int, sb->s_blocksize, U16_MAX) -
+			   NILFS_SR_BYTES(nilfs->ns_inode_size)) /
+		sizeof(struct nilfs_dat_delta);
 	nilfs_palloc_setup_cache(dat, &di->palloc_cache);
 	err = nilfs_mdt_setup_shadow_map(dat, &di->shadow);
 	if (err)
@@ -37,10 +37,19 @@ void nilfs_dat_abort_update(struct inode *, struct nilfs_palloc_req *,
 			    struct nilfs_palloc_req *);
 
 int nilfs_dat_mark_dirty(struct inode *, __u64);
+int nilfs_dat_share(struct inode *dat, __u64 vblocknr);
+int nilfs_dat_unshare(struct inode *dat, __u64 vblocknr);
 int nilfs_dat_freev(struct inode *, __u64 *, size_t);
 int nilfs_dat_move(struct inode *, __u64, sector_t);
 ssize_t nilfs_dat_get_vinfo(struct inode *, void *, unsigned int, size_t);
 
+bool nilfs_dat_defer_block(struct inode *dat, struct buffer_head *bh);
+void nilfs_dat_reset_deltas(struct inode *dat);
+ssize_t nilfs_dat_write_deltas(struct inode *dat, void *buf, size_t size);
+void nilfs_dat_commit_deltas(struct inode *dat);
+bool nilfs_dat_flush_deltas(struct inode *dat);
+int nilfs_dat_read_deltas(struct inode *dat, const void *buf, size_t size);
+
 int nilfs_dat_read(struct super_block *sb, size_t entry_size,
 		   struct nilfs_inode *raw_inode, struct inode **inodep);
 
@@ -32,6 +32,7 @@
 #include <linux/pagemap.h>
 #include "nilfs.h"
 #include "page.h"
+#include "ifile.h"
 
 static inline unsigned int nilfs_rec_len_from_disk(__le16 dlen)
 {
@@ -260,6 +261,37 @@ static void nilfs_set_de_type(struct nilfs_dir_entry *de, struct inode *inode)
 	de->file_type = nilfs_type_by_mode[(mode & S_IFMT)>>S_SHIFT];
 }
 
+/* Inode numbers collected at a time for readahead of disk inodes */
+#define NILFS_READDIR_RA_BATCH	32
+
+/*
+ * Directory listings are usually followed by a stat of every entry, which
+ * would read the disk inodes one ifile block after another.  Read ahead the
+ * ifile blocks of the entries remaining in a directory page before they
+ * are emitted so that they are fetched in bulk.
+ */
+static void nilfs_readdir_readahead(struct inode *dir,
+				    struct nilfs_dir_entry *de, char *limit)
+{
+	struct inode *ifile = NILFS_I(dir)->i_root->ifile;
+	__u64 inos[NILFS_READDIR_RA_BATCH];
+	unsigned int n = 0;
+
+	for ( ; (char *)de <= limit; de = nilfs_next_entry(de)) {
+		if (de->rec_len == 0)
+			break;
+		if (!de->inode)
+			continue;
+		inos[n++] = le64_to_cpu(de->inode);
+		if (n == ARRAY_SIZE(inos)) {
+			nilfs_ifile_readahead_inodes(ifile, inos, n);
+			n = 0;
+		}
+	}
+	if (n)
+		nilfs_ifile_readahead_inodes(ifile, inos, n);
+}
+
 static int nilfs_readdir(struct file *file, struct dir_context *ctx)
 {
 	loff_t pos = ctx->pos;
@@ -286,6 +318,7 @@ static int nilfs_readdir(struct file *file, struct dir_context *ctx)
 		de = (struct nilfs_dir_entry *)(kaddr + offset);
 		limit = kaddr + nilfs_last_byte(inode, n) -
 			NILFS_DIR_REC_LEN(1);
+		nilfs_readdir_readahead(inode, de, limit);
 		for ( ; (char *)de <= limit; de = nilfs_next_entry(de)) {
 			if (de->rec_len == 0) {
 				nilfs_error(sb, "zero-length directory entry");
@@ -161,6 +161,29 @@ static int nilfs_direct_delete(struct nilfs_bmap *bmap, __u64 key)
 	return ret;
 }
 
+static int nilfs_direct_replace(struct nilfs_bmap *bmap, __u64 key, __u64 ptr)
+{
+	union nilfs_bmap_ptr_req req;
+	struct inode *dat;
+	int ret;
+
+	if (key > NILFS_DIRECT_KEY_MAX ||
+	    nilfs_direct_get_ptr(bmap, key) == NILFS_BMAP_INVALID_PTR)
+		return -ENOENT;
+
+	dat = nilfs_bmap_get_dat(bmap);
+	req.bpr_ptr = nilfs_direct_get_ptr(bmap, key);
+
+	ret = nilfs_bmap_prepare_end_ptr(bmap, &req, dat);
+	if (!ret) {
+		nilfs_bmap_commit_end_ptr(bmap, &req, dat);
+		nilfs_direct_set_ptr(bmap, key, ptr);
+		if (!nilfs_bmap_dirty(bmap))
+			nilfs_bmap_set_dirty(bmap);
+	}
+	return ret;
+}
+
 static int nilfs_direct_seek_key(const struct nilfs_bmap *direct, __u64 start,
 				 __u64 *keyp)
 {
@@ -276,6 +299,7 @@ static int nilfs_direct_propagate(struct nilfs_bmap *bmap,
 			return ret;
 		nilfs_dat_commit_update(dat, &oldreq, &newreq,
 					bmap->b_ptr_type == NILFS_BMAP_PTR_VS);
+		nilfs_bmap_stat_dat_alloc(bmap);
 		set_buffer_nilfs_volatile(bh);
 		nilfs_direct_set_ptr(bmap, key, newreq.pr_entry_nr);
 	} else
@@ -354,6 +378,7 @@ static const struct nilfs_bmap_operations nilfs_direct_ops = {
 	.bop_lookup_contig	=	nilfs_direct_lookup_contig,
 	.bop_insert		=	nilfs_direct_insert,
 	.bop_delete		=	nilfs_direct_delete,
+	.bop_replace		=	nilfs_direct_replace,
 	.bop_clear		=	NULL,
 
 	.bop_propagate		=	nilfs_direct_propagate,
@@ -0,0 +1,453 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * NILFS evacuation of trailing segments for online shrink
+ *
+ * The segments cut off by a shrink must be clean.  Instead of leaving it
+ * to the cleaner daemon to empty them, the resize limits the range of
+ * allocatable segments to the remaining part, moves the head of logs out
+ * of the trailing segments, and relocates live blocks of each trailing
+ * segment through the garbage collection path.  The segments are processed
+ * a bounded number at a time so that the GC inodes and the descriptor
+ * arrays stay small, and so that the cleaner daemon can interleave.
+ */
+
+#include <linux/buffer_head.h>
+#include <linux/sched/signal.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include "nilfs.h"
+#include "segment.h"
+#include "sufile.h"
+#include "dat.h"
+
+/* Trailing segments relocated per log */
+#define NILFS_EVACUATE_BATCH	8
+
+/**
+ * struct nilfs_evacuation - trailing segments being evacuated
+ * @sb: super block instance
+ * @vdescs: descriptors of blocks of virtual block numbers to be moved
+ * @bdescs: descriptors of DAT blocks to be moved
+ * @segnums: segment numbers freed after the blocks are moved
+ * @nvdescs: number of entries in @vdescs
+ * @nbdescs: number of entries in @bdescs
+ * @nsegs: number of entries in @segnums
+ */
+struct nilfs_evacuation {
+	struct super_block *sb;
+	struct nilfs_vdesc *vdescs;
+	struct nilfs_bdesc *bdescs;
+	__u64 segnums[NILFS_EVACUATE_BATCH];
+	size_t nvdescs;
+	size_t nbdescs;
+	size_t nsegs;
+};
+
+/**
+ * nilfs_evacuate_scan_log - add descriptors of blocks in a log
+ * @ev: evacuation state
+ * @bh: buffer head of the summary block of the log
+ * @sum: segment summary of the log
+ *
+ * Return Value: On success, 0 is returned. On error, %-EIO is returned.
+ */
+static int nilfs_evacuate_scan_log(struct nilfs_evacuation *ev,
+				   struct buffer_head *bh,
+				   struct nilfs_segment_summary *sum)
+{
+	struct the_nilfs *nilfs = ev->sb->s_fs_info;
+	unsigned long nblocks = le32_to_cpu(sum->ss_nblocks);
+	u32 nfinfo = le32_to_cpu(sum->ss_nfinfo);
+	unsigned int flags = le16_to_cpu(sum->ss_flags);
+	sector_t blocknr, end;
+	unsigned int offset;
+	int err = -EIO;
+
+	get_bh(bh);
+	end = bh->b_blocknr + nblocks;
+	blocknr = bh->b_blocknr +
+		DIV_ROUND_UP(le32_to_cpu(sum->ss_sumbytes), nilfs->ns_blocksize);
+	offset = le16_to_cpu(sum->ss_bytes);
+
+	for (; nfinfo > 0; nfinfo--) {
+		struct nilfs_finfo *finfo;
+		unsigned long i, nblk, ndatablk, nrun = 0;
+		__u64 cno, run_vblocknr = 0, run_blkoff = 0;
+		ino_t ino;
+
+		finfo = nilfs_read_summary_info(nilfs, &bh, &offset,
+						sizeof(*finfo));
+		if (unlikely(!finfo))
+			goto out;
+
+		ino = le64_to_cpu(finfo->fi_ino);
+		cno = le64_to_cpu(finfo->fi_cno);
+		nblk = le32_to_cpu(finfo->fi_nblocks);
+		ndatablk = le32_to_cpu(finfo->fi_ndatablk);
+		if (unlikely(ndatablk > nblk || nblk > end - blocknr))
+			goto out;
+
+		for (i = 0; i < nblk; i++, blocknr++) {
+			if (ino != NILFS_DAT_INO && i < ndatablk && !nrun) {
+				nrun = nilfs_read_data_binfo(nilfs, &bh, &offset,
+							     flags, ndatablk - i,
+							     &run_vblocknr,
+							     &run_blkoff);
+				if (unlikely(!nrun))
+					goto out;
+			}
+			if (ino == NILFS_DAT_INO) {
+				struct nilfs_bdesc *bdesc;
+				struct nilfs_binfo_dat *binfo;
+
+				binfo = nilfs_read_summary_info(
+					nilfs, &bh, &offset, sizeof(*binfo));
+				if (unlikely(!binfo))
+					goto out;
+
+				bdesc = &ev->bdescs[ev->nbdescs++];
+				bdesc->bd_ino = ino;
+				bdesc->bd_oblocknr = blocknr;
+				bdesc->bd_blocknr = 0;
+				bdesc->bd_offset = le64_to_cpu(binfo->bi_blkoff);
+				bdesc->bd_level = i < ndatablk ? 0 : binfo->bi_level;
+				bdesc->bd_pad = 0;
+			} else {
+				struct nilfs_vdesc *vdesc;
+
+				vdesc = &ev->vdescs[ev->nvdescs++];
+				memset(vdesc, 0, sizeof(*vdesc));
+				vdesc->vd_ino = ino;
+				vdesc->vd_cno = cno;
+				vdesc->vd_blocknr = blocknr;
+				if (i < ndatablk) {
+					vdesc->vd_vblocknr = run_vblocknr++;
+					vdesc->vd_offset = run_blkoff++;
+					nrun--;
+				} else {
+					__le64 *vblocknr;
+
+					vblocknr = nilfs_read_summary_info(
+						nilfs, &bh, &offset,
+						sizeof(*vblocknr));
+					if (unlikely(!vblocknr))
+						goto out;
+					vdesc->vd_vblocknr = le64_to_cpup(vblocknr);
+					vdesc->vd_flags = 1;	/* node block */
+				}
+			}
+		}
+	}
+	err = 0;
+ out:
+	brelse(bh);
+	return err;
+}
+
+/**
+ * nilfs_evacuate_scan_segment - add descriptors of blocks in a segment
+ * @ev: evacuation state
+ * @segnum: segment number
+ * @si: segment usage information of @segnum
+ *
+ * Logs are read from the head of the segment while they are consistent
+ * and share the sequence number of the first one.  The number of written
+ * blocks in @si is only a lower bound of the end of the logs because the
+ * cleaner may have lowered it to the number of live blocks.
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error or broken log.
+ */
+static int nilfs_evacuate_scan_segment(struct nilfs_evacuation *ev,
+				       __u64 segnum,
+				       const struct nilfs_suinfo *si)
+{
+	struct the_nilfs *nilfs = ev->sb->s_fs_info;
+	struct nilfs_segment_summary *sum;
+	struct buffer_head *bh;
+	sector_t pseg_start, seg_start, seg_end;
+	unsigned long nblocks;
+	u64 seg_seq = 0;
+	int err = 0;
+
+	nilfs_get_segment_range(nilfs, segnum, &seg_start, &seg_end);
+
+	for (pseg_start = seg_start; pseg_start <= seg_end;
+	     pseg_start += nblocks) {
+		bh = nilfs_read_log_header(nilfs, pseg_start, &sum);
+		if (unlikely(!bh)) {
+			err = -EIO;
+			goto failed;
+		}
+
+		if (pseg_start == seg_start)
+			seg_seq = le64_to_cpu(sum->ss_seq);
+
+		nblocks = le32_to_cpu(sum->ss_nblocks);
+		if (nilfs_validate_log(nilfs, seg_seq, bh, sum) ||
+		    nblocks > seg_end - pseg_start + 1) {
+			brelse(bh);
+			break;
+		}
+
+		err = nilfs_evacuate_scan_log(ev, bh, sum);
+		brelse(bh);
+		if (unlikely(err))
+			goto failed;
+	}
+
+	if (pseg_start < seg_start + si->sui_nblocks) {
+		err = -EIO;
+		goto failed;
+	}
+	ev->segnums[ev->nsegs++] = segnum;
+	return 0;
+
+failed:
+	nilfs_err(ev->sb, "error %d reading logs in segment %llu", err,
+		  (unsigned long long)segnum);
+	return err;
+}
+
+static int nilfs_evacuate_vdesc_cmp(const void *a, const void *b)
+{
+	const struct nilfs_vdesc *va = a, *vb = b;
+
+	if (va->vd_ino != vb->vd_ino)
+		return va->vd_ino < vb->vd_ino ? -1 : 1;
+	if (va->vd_cno != vb->vd_cno)
+		return va->vd_cno < vb->vd_cno ? -1 : 1;
+	if (va->vd_blocknr != vb->vd_blocknr)
+		return va->vd_blocknr < vb->vd_blocknr ? -1 : 1;
+	return 0;
+}
+
+/**
+ * nilfs_evacuate_filter - drop descriptors of dead virtual blocks
+ * @ev: evacuation state
+ *
+ * A block is kept unless its DAT entry is gone, maps it elsewhere, or
+ * shows that it was overwritten before it belonged to any checkpoint.
+ * Blocks that are only protected by snapshots or recent checkpoints are
+ * kept as well, so nothing reachable is lost when the segment is freed.
+ * The kept descriptors are sorted by inode and checkpoint number as
+ * nilfs_ioctl_move_blocks() requires.
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ */
+static int nilfs_evacuate_filter(struct nilfs_evacuation *ev)
+{
+	struct the_nilfs *nilfs = ev->sb->s_fs_info;
+	struct nilfs_vdesc *vdesc;
+	struct nilfs_vinfo vinfo;
+	size_t i, n;
+	ssize_t ret = 0;
+
+	down_read(&nilfs->ns_segctor_sem);
+	for (i = 0, n = 0; i < ev->nvdescs; i++) {
+		vdesc = &ev->vdescs[i];
+		vinfo.vi_vblocknr = vdesc->vd_vblocknr;
+		/* entry blocks of freed entries may have been deleted */
+		ret = nilfs_dat_get_vinfo(nilfs->ns_dat, &vinfo, sizeof(vinfo),
+					  1);
+		if (ret == -ENOENT)
+			continue;
+		if (ret < 0)
+			break;
+		if (vinfo.vi_blocknr != vdesc->vd_blocknr ||
+		    vinfo.vi_start == vinfo.vi_end)
+			continue;
+		vdesc->vd_period.p_start = vinfo.vi_start;
+		vdesc->vd_period.p_end = vinfo.vi_end;
+		ev->vdescs[n++] = *vdesc;
+	}
+	up_read(&nilfs->ns_segctor_sem);
+	if (ret < 0 && ret != -ENOENT)
+		return ret;
+
+	ev->nvdescs = n;
+	sort(ev->vdescs, n, sizeof(*ev->vdescs), nilfs_evacuate_vdesc_cmp,
+	     NULL);
+	return 0;
+}
+
+/**
+ * nilfs_evacuate_collect - gather blocks of a batch of trailing segments
+ * @ev: evacuation state
+ * @segnump: segment number to start looking [in, out]
+ * @nsegs: number of segments of the file system
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EBUSY - An active segment is found.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ */
+static int nilfs_evacuate_collect(struct nilfs_evacuation *ev,
+				  __u64 *segnump, __u64 nsegs)
+{
+	struct the_nilfs *nilfs = ev->sb->s_fs_info;
+	struct nilfs_suinfo si[NILFS_EVACUATE_BATCH];
+	__u64 segnum = *segnump;
+	ssize_t n;
+	int i, err = 0;
+
+	ev->nvdescs = ev->nbdescs = ev->nsegs = 0;
+
+	while (segnum < nsegs && ev->nsegs < NILFS_EVACUATE_BATCH) {
+		n = nilfs_sufile_get_suinfo(
+			nilfs->ns_sufile, segnum, si, sizeof(si[0]),
+			min_t(__u64, NILFS_EVACUATE_BATCH - ev->nsegs,
+			      nsegs - segnum));
+		if (n <= 0) {
+			err = n ? n : -EIO;
+			goto out;
+		}
+
+		for (i = 0; i < n; i++, segnum++) {
+			/* erroneous segments are dropped by the truncation */
+			if (nilfs_suinfo_clean(&si[i]) ||
+			    nilfs_suinfo_error(&si[i]))
+				continue;
+			if (nilfs_suinfo_active(&si[i])) {
+				err = -EBUSY;
+				goto out;
+			}
+			err = nilfs_evacuate_scan_segment(ev, segnum, &si[i]);
+			if (err)
+				goto out;
+		}
+	}
+	err = nilfs_evacuate_filter(ev);
+out:
+	*segnump = segnum;
+	return err;
+}
+
+/**
+ * nilfs_evacuate_relocate - move collected blocks and free their segments
+ * @ev: evacuation state
+ *
+ * Return Value: On success, 0 is returned. On error, a negative error code
+ * is returned.
+ */
+static int nilfs_evacuate_relocate(struct nilfs_evacuation *ev)
+{
+	struct the_nilfs *nilfs = ev->sb->s_fs_info;
+	struct nilfs_argv argv[5] = {
+		{ .v_size = sizeof(struct nilfs_vdesc),
+		  .v_nmembs = ev->nvdescs },
+		{ .v_size = sizeof(struct nilfs_period) },
+		{ .v_size = sizeof(__u64) },
+		{ .v_size = sizeof(struct nilfs_bdesc),
+		  .v_nmembs = ev->nbdescs },
+		{ .v_size = sizeof(__u64), .v_nmembs = ev->nsegs },
+	};
+	void *kbufs[5] = { ev->vdescs, NULL, NULL, ev->bdescs, ev->segnums };
+	int ret;
+
+	ret = nilfs_ioctl_move_blocks(ev->sb, &argv[0], kbufs[0]);
+	if (ret < 0) {
+		nilfs_err(ev->sb,
+			  "error %d evacuating segments: cannot read source blocks",
+			  ret);
+	} else {
+		if (nilfs_sb_need_update(nilfs))
+			set_nilfs_discontinued(nilfs);
+		ret = nilfs_clean_segments(ev->sb, argv, kbufs);
+	}
+	nilfs_remove_all_gcinodes(nilfs);
+	return ret;
+}
+
+/**
+ * nilfs_evacuate_segments - empty the segments cut off by a shrink
+ * @sb: super block instance
+ * @newnsegs: number of segments after the shrink
+ *
+ * Description: nilfs_evacuate_segments() limits the range of allocatable
+ * segments below @newnsegs, moves the head of logs there, and relocates
+ * live blocks of the segments from @newnsegs on.  The emptied segments are
+ * freed.  Checkpoints and virtual block numbers are left untouched.  The
+ * caller is responsible for resetting the range of allocatable segments.
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EBUSY - A trailing segment cannot be made inactive.
+ *
+ * %-EINTR - Interrupted by a fatal signal.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-ENOSPC - No clean segment left.
+ *
+ * %-ERANGE - @newnsegs is out of range.
+ *
+ * %-EROFS - Read only filesystem.
+ */
+int nilfs_evacuate_segments(struct super_block *sb, __u64 newnsegs)
+{
+	struct the_nilfs *nilfs = sb->s_fs_info;
+	struct nilfs_evacuation ev = { .sb = sb };
+	size_t maxblocks;
+	__u64 segnum, nsegs;
+	int ret;
+
+	nsegs = nilfs_sufile_get_nsegments(nilfs->ns_sufile);
+	if (!newnsegs || newnsegs >= nsegs)
+		return -ERANGE;
+
+	maxblocks = NILFS_EVACUATE_BATCH * nilfs->ns_blocks_per_segment;
+	ret = -ENOMEM;
+	ev.vdescs = vmalloc(array_size(maxblocks, sizeof(*ev.vdescs)));
+	ev.bdescs = vmalloc(array_size(maxblocks, sizeof(*ev.bdescs)));
+	if (!ev.vdescs || !ev.bdescs)
+		goto out;
+
+	ret = nilfs_sufile_set_alloc_range(nilfs->ns_sufile, 0, newnsegs - 1);
+	if (ret < 0)
+		goto out;
+
+	ret = nilfs_move_log_head(sb, newnsegs);
+	if (ret < 0)
+		goto out;
+
+	segnum = newnsegs;
+	while (segnum < nsegs) {
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		/* wait for the running garbage collection to finish */
+		if (test_and_set_bit(THE_NILFS_GC_RUNNING, &nilfs->ns_flags)) {
+			schedule_timeout_killable(HZ / 10);
+			continue;
+		}
+
+		ret = nilfs_evacuate_collect(&ev, &segnum, nsegs);
+		if (!ret && ev.nsegs)
+			ret = nilfs_evacuate_relocate(&ev);
+
+		clear_nilfs_gc_running(nilfs);
+		if (ret < 0)
+			break;
+		cond_resched();
+	}
+out:
+	vfree(ev.bdescs);
+	vfree(ev.vdescs);
+	return ret;
+}
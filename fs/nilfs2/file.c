@@ -10,7 +10,15 @@
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <linux/writeback.h>
+#include <linux/pagemap.h>
+#include <linux/uio.h>
+#include <linux/buffer_head.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
 #include "nilfs.h"
+#include "mdt.h"
+#include "dat.h"
 #include "segment.h"
 
 int nilfs_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
@@ -42,6 +50,94 @@ int nilfs_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
 	return err;
 }
 
+/* Maximum number of pages whose holes are filled ahead of write faults */
+#define NILFS_MKWRITE_AROUND_PAGES	16
+
+/**
+ * nilfs_mkwrite_around - fill holes of pages following a faulting page
+ * @vma: virtual memory area of the fault
+ * @index: page index of the faulting page
+ *
+ * Writers filling a shared mapping sequentially fault on one hole page
+ * after another, each of which costs a transaction.  If the page before
+ * the faulting one is dirty, nilfs_mkwrite_around() fills the holes of
+ * the cached, up-to-date and clean pages that follow it in the mapping,
+ * and marks the new blocks dirty, within the transaction of the faulting
+ * page.  Blocks already on disk and blocks beyond the end of the file are
+ * left clean.
+ * Later write faults on those pages then find them mapped to disk and
+ * need no transaction.  Pages that cannot be locked immediately end the
+ * batch.
+ *
+ * Return Value: number of blocks made dirty.
+ */
+static unsigned int nilfs_mkwrite_around(struct vm_area_struct *vma,
+					 pgoff_t index)
+{
+	struct inode *inode = file_inode(vma->vm_file);
+	struct address_space *mapping = inode->i_mapping;
+	unsigned int nr_blocks = 0;
+	struct buffer_head *bh, *head;
+	struct folio *folio;
+	pgoff_t last;
+	loff_t size;
+	size_t len, start;
+	bool seq;
+
+	if (index == 0)
+		return 0;
+	folio = filemap_get_folio(mapping, index - 1);
+	if (IS_ERR(folio))
+		return 0;
+	seq = folio_test_dirty(folio);
+	folio_put(folio);
+	if (!seq)
+		return 0;
+
+	size = i_size_read(inode);
+	if (!size)
+		return 0;
+	last = min3(index + NILFS_MKWRITE_AROUND_PAGES,
+		    (pgoff_t)((size - 1) >> PAGE_SHIFT),
+		    vma->vm_pgoff + vma_pages(vma) - 1);
+
+	while (++index <= last) {
+		folio = filemap_get_folio(mapping, index);
+		if (IS_ERR(folio))
+			break;
+		if (!folio_trylock(folio)) {
+			folio_put(folio);
+			break;
+		}
+		if (folio->mapping != mapping || folio_test_large(folio) ||
+		    !folio_test_uptodate(folio) || folio_test_dirty(folio) ||
+		    folio_test_writeback(folio) ||
+		    folio_test_mappedtodisk(folio))
+			goto next;
+
+		len = min_t(loff_t, PAGE_SIZE, size - folio_pos(folio));
+		if (__block_write_begin(&folio->page, 0, len, nilfs_get_block))
+			goto next;
+
+		/* dirty only the blocks just allocated to fill holes */
+		bh = head = folio_buffers(folio);
+		start = 0;
+		do {
+			if (buffer_delay(bh)) {
+				set_buffer_uptodate(bh);
+				clear_buffer_new(bh);
+				mark_buffer_dirty(bh);
+				nr_blocks++;
+			}
+			start += bh->b_size;
+		} while (bh = bh->b_this_page, bh != head && start < len);
+next:
+		folio_unlock(folio);
+		folio_put(folio);
+	}
+	return nr_blocks;
+}
+
 static vm_fault_t nilfs_page_mkwrite(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
@@ -101,7 +197,8 @@ static vm_fault_t nilfs_page_mkwrite(struct vm_fault *vmf)
 		nilfs_transaction_abort(inode->i_sb);
 		goto out;
 	}
-	nilfs_set_file_dirty(inode, 1 << (PAGE_SHIFT - inode->i_blkbits));
+	nilfs_set_file_dirty(inode, (1 << (PAGE_SHIFT - inode->i_blkbits)) +
+			     nilfs_mkwrite_around(vma, page->index));
 	nilfs_transaction_commit(inode->i_sb);
 
  mapped:
@@ -124,14 +221,694 @@ static int nilfs_file_mmap(struct file *file, struct vm_area_struct *vma)
 	return 0;
 }
 
+/**
+ * nilfs_same_blocks - test if two inodes map a page to the same blocks
+ * @inode: inode of a snapshot
+ * @live: inode of the same file in the current checkpoint
+ * @index: page index
+ *
+ * Since a virtual block number is never reassigned while any checkpoint
+ * refers to it, the page at @index has the same contents in both inodes if
+ * all of its blocks are mapped to the same virtual block numbers.  Pages
+ * with holes are not regarded as the same to leave them to the snapshot.
+ */
+static bool nilfs_same_blocks(struct inode *inode, struct inode *live,
+			      pgoff_t index)
+{
+	unsigned int bits = PAGE_SHIFT - inode->i_blkbits;
+	__u64 blkoff = (__u64)index << bits;
+	__u64 ptr, live_ptr;
+	int i;
+
+	for (i = 0; i < (1 << bits); i++) {
+		if (nilfs_bmap_lookup(NILFS_I(inode)->i_bmap, blkoff + i,
+				      &ptr) < 0 ||
+		    nilfs_bmap_lookup(NILFS_I(live)->i_bmap, blkoff + i,
+				      &live_ptr) < 0 ||
+		    ptr != live_ptr)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Test if a folio of the live inode can be read in place of the page of
+ * the snapshot.  Must be called with the folio locked.
+ */
+static bool nilfs_shared_folio_valid(struct folio *folio, struct inode *inode,
+				     struct inode *live)
+{
+	return folio->mapping == live->i_mapping && folio_test_uptodate(folio) &&
+		!folio_test_dirty(folio) &&
+		nilfs_same_blocks(inode, live, folio->index);
+}
+
+/**
+ * nilfs_read_shared_page - read a snapshot page through the live page cache
+ * @iocb: kiocb of the read on a snapshot file
+ * @live: inode of the same file in the current checkpoint
+ * @to: destination of the read
+ * @count: number of bytes to read, which must be within a page
+ *
+ * The page is looked up in, or read into, the page cache of @live and
+ * copied from there if it has not been changed since the snapshot was
+ * taken, so that unchanged data read through the current checkpoint and
+ * any number of snapshots is cached only once.  The copy is made without
+ * the folio lock and validated again afterwards, since a write to the
+ * live file dirties the folio and a later log assigns it new virtual
+ * block numbers.
+ *
+ * Return Value: number of bytes copied, or 0 if the page must be read
+ * from the page cache of the snapshot.
+ */
+static size_t nilfs_read_shared_page(struct kiocb *iocb, struct inode *live,
+				     struct iov_iter *to, size_t count)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	pgoff_t index = iocb->ki_pos >> PAGE_SHIFT;
+	size_t offset = offset_in_page(iocb->ki_pos);
+	struct folio *folio;
+	size_t copied;
+	bool valid;
+
+	if ((loff_t)(index + 1) << PAGE_SHIFT > i_size_read(live) ||
+	    !nilfs_same_blocks(inode, live, index))
+		return 0;
+
+	folio = filemap_get_folio(live->i_mapping, index);
+	if (IS_ERR(folio)) {
+		page_cache_sync_readahead(live->i_mapping, &file->f_ra, NULL,
+					  index, (count + PAGE_SIZE - 1) >>
+					  PAGE_SHIFT);
+		folio = read_mapping_folio(live->i_mapping, index, NULL);
+		if (IS_ERR(folio))
+			return 0;
+	}
+
+	folio_lock(folio);
+	valid = nilfs_shared_folio_valid(folio, inode, live);
+	folio_unlock(folio);
+	if (!valid) {
+		folio_put(folio);
+		return 0;
+	}
+
+	copied = copy_folio_to_iter(folio, offset, count, to);
+
+	folio_lock(folio);
+	valid = nilfs_shared_folio_valid(folio, inode, live);
+	folio_unlock(folio);
+	if (valid)
+		folio_mark_accessed(folio);
+	folio_put(folio);
+
+	if (!valid) {
+		iov_iter_revert(to, copied);
+		return 0;
+	}
+	return copied;
+}
+
+/**
+ * nilfs_snapshot_live_inode - get the inode of a file in the current checkpoint
+ * @inode: inode of a snapshot
+ *
+ * Return Value: the inode of the same inode number in the current
+ * checkpoint with a reference held, or NULL if there is none.
+ */
+static struct inode *nilfs_snapshot_live_inode(struct inode *inode)
+{
+	struct the_nilfs *nilfs = inode->i_sb->s_fs_info;
+	struct nilfs_root *root;
+	struct inode *live;
+
+	root = nilfs_lookup_root(nilfs, NILFS_CPTREE_CURRENT_CNO);
+	if (!root)
+		return NULL;
+	live = nilfs_iget(inode->i_sb, root, inode->i_ino);
+	nilfs_put_root(root);
+
+	if (IS_ERR(live))
+		return NULL;
+	if (!S_ISREG(live->i_mode) ||
+	    live->i_generation != inode->i_generation ||
+	    live->i_blkbits != inode->i_blkbits) {
+		iput(live);
+		return NULL;
+	}
+	return live;
+}
+
+/**
+ * nilfs_file_read_iter - read data from a regular file
+ * @iocb: kiocb of the read
+ * @to: destination of the read
+ *
+ * Buffered reads on snapshots are served from the page cache of the
+ * current checkpoint for pages that have not been changed since the
+ * snapshot was taken, and from the page cache of the snapshot otherwise.
+ */
+static ssize_t nilfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	struct inode *live;
+	ssize_t ret, nread = 0;
+	size_t count, len;
+	loff_t isize;
+
+	if (NILFS_I(inode)->i_root->cno == NILFS_CPTREE_CURRENT_CNO ||
+	    (iocb->ki_flags & (IOCB_DIRECT | IOCB_NOWAIT)))
+		return generic_file_read_iter(iocb, to);
+
+	live = nilfs_snapshot_live_inode(inode);
+	if (!live)
+		return generic_file_read_iter(iocb, to);
+
+	isize = i_size_read(inode);
+	while (iov_iter_count(to) && iocb->ki_pos < isize) {
+		len = min_t(loff_t, iov_iter_count(to), isize - iocb->ki_pos);
+		len = min_t(size_t, len,
+			    PAGE_SIZE - offset_in_page(iocb->ki_pos));
+
+		count = nilfs_read_shared_page(iocb, live, to, len);
+		if (count) {
+			iocb->ki_pos += count;
+			nread += count;
+			if (count < len)
+				break;	/* fault on the destination */
+		} else {
+			/* read the page through the snapshot's page cache */
+			count = iov_iter_count(to);
+			iov_iter_truncate(to, len);
+			ret = filemap_read(iocb, to, 0);
+			iov_iter_reexpand(to, count - (ret > 0 ? ret : 0));
+			if (ret <= 0) {
+				if (!nread)
+					nread = ret;
+				break;
+			}
+			nread += ret;
+			if (ret < len)
+				break;
+		}
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+
+	iput(live);
+	file_accessed(iocb->ki_filp);
+	return nread;
+}
+
+/**
+ * struct nilfs_sync_write - synchronous write completed asynchronously
+ * @wrq: request queued to the log writer
+ * @work: work item completing @iocb
+ * @iocb: kiocb of the write
+ * @ret: number of bytes written
+ */
+struct nilfs_sync_write {
+	struct nilfs_segctor_wait_request wrq;
+	struct work_struct work;
+	struct kiocb *iocb;
+	ssize_t ret;
+};
+
+static void nilfs_sync_write_work(struct work_struct *work)
+{
+	struct nilfs_sync_write *sw =
+		container_of(work, struct nilfs_sync_write, work);
+	struct kiocb *iocb = sw->iocb;
+	struct the_nilfs *nilfs = file_inode(iocb->ki_filp)->i_sb->s_fs_info;
+	int err = sw->wrq.err;
+
+	if (!err)
+		err = nilfs_flush_device(nilfs);
+
+	iocb->ki_complete(iocb, err ?: sw->ret);
+	kfree(sw);
+}
+
+static void nilfs_sync_write_complete(struct nilfs_segctor_wait_request *wrq)
+{
+	struct nilfs_sync_write *sw =
+		container_of(wrq, struct nilfs_sync_write, wrq);
+
+	/* called in atomic context; the device flush may sleep */
+	queue_work(system_unbound_wq, &sw->work);
+}
+
+/**
+ * nilfs_file_write_iter - write data to a regular file
+ * @iocb: kiocb of the write
+ * @from: source of the data
+ *
+ * An asynchronous write with O_DSYNC or O_SYNC semantics, issued through
+ * AIO or io_uring, does not wait for the log writer.  Its data is
+ * written by a logical segment requested with
+ * nilfs_construct_segment_async(), and the kiocb is completed when the
+ * log writer reports the result.  Other writes are handled as in
+ * generic_file_write_iter().
+ *
+ * Return Value: number of bytes written, %-EIOCBQUEUED if the write is
+ * completed later, or a negative error code.
+ */
+static ssize_t nilfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	struct nilfs_sync_write *sw;
+	ssize_t ret;
+
+	inode_lock(inode);
+	ret = generic_write_checks(iocb, from);
+	if (ret > 0)
+		ret = __generic_file_write_iter(iocb, from);
+	inode_unlock(inode);
+
+	if (ret <= 0 || is_sync_kiocb(iocb) || !iocb_is_dsync(iocb) ||
+	    !nilfs_inode_dirty(inode))
+		goto sync;
+
+	sw = kmalloc(sizeof(*sw), GFP_KERNEL);
+	if (!sw)
+		goto sync;
+	INIT_WORK(&sw->work, nilfs_sync_write_work);
+	sw->iocb = iocb;
+	sw->ret = ret;
+
+	if (nilfs_construct_segment_async(inode->i_sb, &sw->wrq,
+					  nilfs_sync_write_complete) < 0) {
+		kfree(sw);
+		goto sync;
+	}
+	return -EIOCBQUEUED;
+
+sync:
+	if (ret > 0)
+		ret = generic_write_sync(iocb, ret);
+	return ret;
+}
+
+/* Maximum number of destination pages filled by a batch of reads */
+#define NILFS_COPY_BATCH_PAGES	16
+
+/**
+ * struct nilfs_copy_ctx - state of an in-kernel copy of data blocks
+ * @src: source inode
+ * @bio: last bio of the chain reading the current batch, or NULL
+ * @blkoff: next block offset to be read in @src
+ * @blocknr: disk block number of @blkoff, or 0 for a hole
+ * @nblocks: number of blocks left in the extent starting at @blkoff
+ */
+struct nilfs_copy_ctx {
+	struct inode *src;
+	struct bio *bio;
+	sector_t blkoff;
+	sector_t blocknr;
+	unsigned int nblocks;
+};
+
+/**
+ * nilfs_copy_read_block - read a source block into a destination page
+ * @cc: copy context
+ * @page: locked destination page
+ * @offset: offset of the destination block in @page
+ *
+ * The block at @cc->blkoff is read from the disk directly into @page
+ * without going through the page cache of the source file.  Reads of
+ * blocks contiguous on disk are merged into a bio, and bios are chained
+ * so that the batch can be waited for at once.  Holes are filled with
+ * zeros.
+ *
+ * Return Value: On success, 0 is returned.  On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EAGAIN - The block has been added to the source since it was written
+ * out, and has no disk block yet.
+ *
+ * Other errors of the block mapping lookup.
+ */
+static int nilfs_copy_read_block(struct nilfs_copy_ctx *cc, struct page *page,
+				 unsigned int offset)
+{
+	struct inode *src = cc->src;
+	struct the_nilfs *nilfs = src->i_sb->s_fs_info;
+	unsigned int blkbits = src->i_blkbits;
+	unsigned int blocksize = 1U << blkbits;
+	struct bio *bio = cc->bio;
+	sector_t sector;
+	__u64 blocknr;
+	int ret;
+
+	if (!cc->nblocks) {
+		down_read(&NILFS_MDT(nilfs->ns_dat)->mi_sem);
+		ret = nilfs_bmap_lookup_contig(NILFS_I(src)->i_bmap, cc->blkoff,
+					       &blocknr, BIO_MAX_VECS);
+		if (ret == -ENOENT) {
+			/* a block without disk address is not a hole */
+			ret = nilfs_bmap_lookup_ptr(NILFS_I(src)->i_bmap,
+						    cc->blkoff, &blocknr);
+			if (!ret)
+				ret = -EAGAIN;
+		}
+		up_read(&NILFS_MDT(nilfs->ns_dat)->mi_sem);
+		if (ret == -ENOENT) {
+			blocknr = 0;
+			ret = 1;
+		} else if (ret < 0) {
+			return ret;
+		}
+		cc->blocknr = blocknr;
+		cc->nblocks = ret;
+	}
+
+	if (!cc->blocknr) {
+		zero_user(page, offset, blocksize);
+	} else {
+		sector = cc->blocknr << (blkbits - 9);
+		if (!bio || bio_end_sector(bio) != sector ||
+		    !bio_add_page(bio, page, blocksize, offset)) {
+			bio = blk_next_bio(bio, nilfs->ns_bdev, BIO_MAX_VECS,
+					   REQ_OP_READ, GFP_NOFS);
+			bio->bi_iter.bi_sector = sector;
+			__bio_add_page(bio, page, blocksize, offset);
+			cc->bio = bio;
+		}
+		cc->blocknr++;
+	}
+	cc->blkoff++;
+	cc->nblocks--;
+	return 0;
+}
+
+/**
+ * nilfs_copy_blocks - copy block-aligned data between regular files
+ * @file_in: source file
+ * @pos_in: block-aligned offset in @file_in
+ * @file_out: destination file
+ * @pos_out: block-aligned offset in @file_out
+ * @len: number of bytes to copy, a multiple of the block size
+ *
+ * Data blocks of the source are read from the disk straight into pages
+ * of the destination prepared by the write_begin operation, which are
+ * then made dirty by the write_end operation as if they were written by
+ * write(2).  Dirty pages of the source are written out first so that
+ * the disk holds the data to be copied.  If the source gains a block in
+ * the range after that, the copy stops there with -EAGAIN rather than
+ * copying zeros.  The caller must hold the lock of the destination inode.
+ *
+ * Return Value: number of bytes copied, or a negative error code if
+ * nothing was copied.
+ */
+static ssize_t nilfs_copy_blocks(struct file *file_in, loff_t pos_in,
+				 struct file *file_out, loff_t pos_out,
+				 size_t len)
+{
+	struct inode *src = file_inode(file_in);
+	struct address_space *mapping = file_out->f_mapping;
+	const struct address_space_operations *aops = mapping->a_ops;
+	unsigned int blocksize = i_blocksize(src);
+	struct nilfs_copy_ctx cc = {
+		.src = src,
+		.blkoff = pos_in >> src->i_blkbits,
+	};
+	struct page *pages[NILFS_COPY_BATCH_PAGES];
+	void *fsdata[NILFS_COPY_BATCH_PAGES];
+	unsigned int lens[NILFS_COPY_BATCH_PAGES];
+	unsigned int offset, off;
+	size_t copied = 0, batch;
+	loff_t pos;
+	int nr, i, ret, err;
+
+	err = filemap_write_and_wait_range(src->i_mapping, pos_in,
+					   pos_in + len - 1);
+	if (err)
+		return err;
+
+	while (copied < len) {
+		pos = pos_out + copied;
+		batch = 0;
+		nr = 0;
+		cc.bio = NULL;
+		do {
+			offset = offset_in_page(pos + batch);
+			lens[nr] = min_t(size_t, PAGE_SIZE - offset,
+					 len - copied - batch);
+			err = aops->write_begin(file_out, mapping, pos + batch,
+						lens[nr], &pages[nr],
+						&fsdata[nr]);
+			if (unlikely(err))
+				break;
+			for (off = offset; off < offset + lens[nr];
+			     off += blocksize) {
+				err = nilfs_copy_read_block(&cc, pages[nr],
+							    off);
+				if (unlikely(err))
+					break;
+			}
+			batch += lens[nr++];
+		} while (!err && nr < NILFS_COPY_BATCH_PAGES &&
+			 copied + batch < len);
+
+		if (cc.bio) {
+			ret = submit_bio_wait(cc.bio);
+			bio_put(cc.bio);
+			if (unlikely(ret) && !err)
+				err = ret;
+		}
+
+		for (i = 0; i < nr; i++) {
+			ret = aops->write_end(file_out, mapping, pos, lens[i],
+					      err ? 0 : lens[i], pages[i],
+					      fsdata[i]);
+			if (unlikely(ret < 0) && !err)
+				err = ret;
+			else if (!err)
+				copied += ret;
+			pos += lens[i];
+		}
+		if (unlikely(err)) {
+			nilfs_write_failed(mapping, pos);
+			break;
+		}
+		balance_dirty_pages_ratelimited(mapping);
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+
+	return copied ? copied : err;
+}
+
+/**
+ * nilfs_copy_file_range - copy data between regular files in the kernel
+ * @file_in: source file
+ * @pos_in: offset in @file_in
+ * @file_out: destination file
+ * @pos_out: offset in @file_out
+ * @len: number of bytes to copy
+ * @flags: copy flags
+ *
+ * Block-aligned copies between different files of the same file system
+ * read the source blocks into the page cache of the destination only,
+ * with nilfs_copy_blocks().  Data blocks are not shared between the
+ * files; their DAT entries track the lifetime of a block in one file,
+ * which the garbage collector relies on.  The remainder of the range
+ * and other copies are done by generic_copy_file_range().
+ *
+ * Return Value: number of bytes copied, or a negative error code.
+ */
+static ssize_t nilfs_copy_file_range(struct file *file_in, loff_t pos_in,
+				     struct file *file_out, loff_t pos_out,
+				     size_t len, unsigned int flags)
+{
+	struct inode *src = file_inode(file_in);
+	struct inode *dst = file_inode(file_out);
+	size_t count = round_down(len, i_blocksize(dst));
+	struct kiocb kiocb;
+	ssize_t ret;
+
+	if (src->i_sb != dst->i_sb || src == dst || flags || !count ||
+	    !IS_ALIGNED(pos_in | pos_out, i_blocksize(dst)))
+		return generic_copy_file_range(file_in, pos_in, file_out,
+					       pos_out, len, flags);
+
+	inode_lock(dst);
+	ret = file_modified(file_out);
+	if (!ret)
+		ret = nilfs_copy_blocks(file_in, pos_in, file_out, pos_out,
+					count);
+	inode_unlock(dst);
+
+	if (ret > 0) {
+		init_sync_kiocb(&kiocb, file_out);
+		kiocb.ki_pos = pos_out + ret;
+		ret = generic_write_sync(&kiocb, ret);
+	}
+	return ret;
+}
+
+/* Maximum number of blocks deduplicated in a transaction */
+#define NILFS_DEDUPE_BATCH_BLOCKS	256
+
+/**
+ * nilfs_dedupe_blocks - make a file refer to data blocks of another file
+ * @src: source inode
+ * @src_blkoff: first block offset in @src
+ * @dst: destination inode
+ * @dst_blkoff: first block offset in @dst
+ * @nblocks: number of blocks
+ *
+ * Each block of @dst in the range is repointed at the virtual block number
+ * of the corresponding block of @src, whose DAT entry counts the new
+ * reference so that the block stays alive until no file refers to it.
+ * The virtual block numbers that @dst referred to are ended as if the
+ * blocks were overwritten.  Holes in either range and blocks that are no
+ * longer alive in @src, such as blocks of a snapshot that have since been
+ * overwritten, are skipped.  The contents of the ranges must have been
+ * written out and verified to be identical.
+ *
+ * Return Value: On success, 0 is returned.  On error, a negative error
+ * code is returned.
+ */
+static int nilfs_dedupe_blocks(struct inode *src, sector_t src_blkoff,
+			       struct inode *dst, sector_t dst_blkoff,
+			       sector_t nblocks)
+{
+	struct the_nilfs *nilfs = dst->i_sb->s_fs_info;
+	struct nilfs_transaction_info ti;
+	unsigned int nshared;
+	__u64 sptr, dptr;
+	sector_t i = 0;
+	int ret = 0, err;
+
+	while (!ret && i < nblocks) {
+		ret = nilfs_transaction_begin(dst->i_sb, &ti, 0);
+		if (ret)
+			break;
+
+		for (nshared = 0; i < nblocks; i++) {
+			if (nshared >= NILFS_DEDUPE_BATCH_BLOCKS)
+				break;
+			ret = nilfs_bmap_lookup_ptr(NILFS_I(src)->i_bmap,
+						    src_blkoff + i, &sptr);
+			if (!ret)
+				ret = nilfs_bmap_lookup_ptr(NILFS_I(dst)->i_bmap,
+							    dst_blkoff + i,
+							    &dptr);
+			if (ret == -ENOENT || (!ret && sptr == dptr))
+				continue;
+			if (ret < 0)
+				break;
+
+			ret = nilfs_dat_share(nilfs->ns_dat, sptr);
+			if (ret == -ESTALE)
+				continue;
+			if (ret < 0)
+				break;
+
+			ret = nilfs_bmap_replace(NILFS_I(dst)->i_bmap,
+						 dst_blkoff + i, sptr);
+			if (ret < 0) {
+				nilfs_dat_unshare(nilfs->ns_dat, sptr);
+				break;
+			}
+			nshared++;
+		}
+		/* the last lookup result of a skipped block is not an error */
+		if (ret == -ENOENT || ret == -ESTALE)
+			ret = 0;
+
+		if (nshared) {
+			nilfs_mark_inode_dirty(dst);
+			nilfs_set_file_dirty(dst, 0);
+		}
+		err = nilfs_transaction_commit(dst->i_sb);
+		if (!ret)
+			ret = err;
+		cond_resched();
+	}
+	return ret;
+}
+
+/**
+ * nilfs_remap_file_range - deduplicate data blocks of regular files
+ * @file_in: source file
+ * @pos_in: offset in @file_in
+ * @file_out: destination file
+ * @pos_out: offset in @file_out
+ * @len: number of bytes
+ * @remap_flags: REMAP_FILE_* flags
+ *
+ * Only deduplication (FIDEDUPERANGE) is supported.  Once the ranges have
+ * been found identical by generic_remap_file_range_prep(), the blocks of
+ * the destination are replaced with those of the source by
+ * nilfs_dedupe_blocks().  Sharing blocks between files requires the
+ * NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS feature, since older kernels
+ * would end the lifetime of a shared block when one of the files drops
+ * it.
+ *
+ * A checkpoint is created before the locks are released.  Otherwise the
+ * source could overwrite a shared block under the same checkpoint number,
+ * and the garbage collector would find two live blocks of the same file
+ * offset in one checkpoint, which it rejects as a conflict.
+ *
+ * Return Value: number of bytes deduplicated, or a negative error code.
+ */
+static loff_t nilfs_remap_file_range(struct file *file_in, loff_t pos_in,
+				     struct file *file_out, loff_t pos_out,
+				     loff_t len, unsigned int remap_flags)
+{
+	struct inode *src = file_inode(file_in);
+	struct inode *dst = file_inode(file_out);
+	unsigned int blkbits = dst->i_blkbits;
+	loff_t start, end;
+	int ret;
+
+	if (!(remap_flags & REMAP_FILE_DEDUP) ||
+	    (remap_flags & ~(REMAP_FILE_DEDUP | REMAP_FILE_ADVISORY)))
+		return -EOPNOTSUPP;
+	if (!nilfs_has_shared_blocks(dst->i_sb->s_fs_info))
+		return -EOPNOTSUPP;
+
+	lock_two_nondirectories(src, dst);
+	filemap_invalidate_lock_two(src->i_mapping, dst->i_mapping);
+
+	ret = generic_remap_file_range_prep(file_in, pos_in, file_out, pos_out,
+					    &len, remap_flags);
+	if (ret < 0 || len == 0)
+		goto out_unlock;
+
+	/* drop cached buffers of the destination mapped to replaced blocks */
+	start = round_down(pos_out, PAGE_SIZE);
+	end = round_up(pos_out + len, PAGE_SIZE) - 1;
+	ret = filemap_write_and_wait_range(dst->i_mapping, start, end);
+	if (ret)
+		goto out_unlock;
+	truncate_inode_pages_range(dst->i_mapping, start, end);
+
+	ret = nilfs_dedupe_blocks(src, pos_in >> blkbits, dst,
+				  pos_out >> blkbits,
+				  (len + (1 << blkbits) - 1) >> blkbits);
+	if (!ret)
+		ret = nilfs_construct_segment(dst->i_sb);
+
+out_unlock:
+	filemap_invalidate_unlock_two(src->i_mapping, dst->i_mapping);
+	unlock_two_nondirectories(src, dst);
+	return ret < 0 ? ret : len;
+}
+
 /*
  * We have mostly NULL's here: the current defaults are ok for
  * the nilfs filesystem.
  */
 const struct file_operations nilfs_file_operations = {
 	.llseek		= generic_file_llseek,
-	.read_iter	= generic_file_read_iter,
-	.write_iter	= generic_file_write_iter,
+	.read_iter	= nilfs_file_read_iter,
+	.write_iter	= nilfs_file_write_iter,
 	.unlocked_ioctl	= nilfs_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= nilfs_compat_ioctl,
@@ -142,6 +919,8 @@ const struct file_operations nilfs_file_operations = {
 	.fsync		= nilfs_sync_file,
 	.splice_read	= generic_file_splice_read,
 	.splice_write   = iter_file_splice_write,
+	.copy_file_range = nilfs_copy_file_range,
+	.remap_file_range = nilfs_remap_file_range,
 };
 
 const struct inode_operations nilfs_file_inode_operations = {
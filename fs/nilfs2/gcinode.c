@@ -180,12 +180,16 @@ void nilfs_remove_all_gcinodes(struct the_nilfs *nilfs)
 {
 	struct list_head *head = &nilfs->ns_gc_inodes;
 	struct nilfs_inode_info *ii;
+	unsigned long nrpages = 0;
 
 	while (!list_empty(head)) {
 		ii = list_first_entry(head, struct nilfs_inode_info, i_dirty);
 		list_del_init(&ii->i_dirty);
+		nrpages += ii->vfs_inode.i_data.nrpages +
+			ii->i_assoc_inode->i_mapping->nrpages;
 		truncate_inode_pages(&ii->vfs_inode.i_data, 0);
 		nilfs_btnode_cache_clear(ii->i_assoc_inode->i_mapping);
 		iput(&ii->vfs_inode);
 	}
+	WRITE_ONCE(nilfs->ns_gc_cache_pages, nrpages);
 }
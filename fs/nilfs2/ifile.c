@@ -11,6 +11,7 @@
 
 #include <linux/types.h>
 #include <linux/buffer_head.h>
+#include <linux/workqueue.h>
 #include "nilfs.h"
 #include "mdt.h"
 #include "alloc.h"
@@ -34,6 +35,7 @@ static inline struct nilfs_ifile_info *NILFS_IFILE_I(struct inode *ifile)
 /**
  * nilfs_ifile_create_inode - create a new disk inode
  * @ifile: ifile inode
+ * @goal: inode number from which a free disk inode is searched for
  * @out_ino: pointer to a variable to store inode number
  * @out_bh: buffer_head contains newly allocated disk inode
  *
@@ -49,16 +51,13 @@ static inline struct nilfs_ifile_info *NILFS_IFILE_I(struct inode *ifile)
  *
  * %-ENOSPC - No inode left.
  */
-int nilfs_ifile_create_inode(struct inode *ifile, ino_t *out_ino,
+int nilfs_ifile_create_inode(struct inode *ifile, ino_t goal, ino_t *out_ino,
 			     struct buffer_head **out_bh)
 {
 	struct nilfs_palloc_req req;
 	int ret;
 
-	req.pr_entry_nr = 0;  /*
-			       * 0 says find free inode from beginning
-			       * of a group. dull code!!
-			       */
+	req.pr_entry_nr = goal;
 	req.pr_entry_bh = NULL;
 
 	ret = nilfs_palloc_prepare_alloc_entry(ifile, &req);
@@ -80,6 +79,37 @@ int nilfs_ifile_create_inode(struct inode *ifile, ino_t *out_ino,
 	return 0;
 }
 
+/**
+ * nilfs_ifile_spread_goal - choose a goal to spread disk inodes over groups
+ * @ifile: ifile inode
+ * @ninodes: number of inodes in use
+ * @goal: place to store the chosen goal inode number
+ *
+ * nilfs_ifile_spread_goal() chooses a group of the ifile with relatively
+ * many free disk inodes among the groups that the inodes in use would
+ * fill, plus one, and stores its first inode number in @goal.
+ *
+ * Return Value: On success, 0 is returned.  On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ */
+int nilfs_ifile_spread_goal(struct inode *ifile, u64 ninodes, ino_t *goal)
+{
+	unsigned long maxgroup;
+	__u64 target;
+	int ret;
+
+	maxgroup = div64_ul(ninodes + NILFS_USER_INO,
+			    nilfs_palloc_entries_per_group(ifile)) + 1;
+	ret = nilfs_palloc_spread_target(ifile, maxgroup, &target);
+	if (!ret)
+		*goal = (ino_t)target;
+	return ret;
+}
+
 /**
  * nilfs_ifile_delete_inode - delete a disk inode
  * @ifile: ifile inode
@@ -147,6 +177,76 @@ int nilfs_ifile_get_inode_block(struct inode *ifile, ino_t ino,
 	return err;
 }
 
+/**
+ * nilfs_ifile_find_orphan - find an orphan inode
+ * @ifile: ifile inode
+ * @ino: inode number to start searching from [in, out]
+ * @nscan: maximum number of inode numbers to scan
+ *
+ * nilfs_ifile_find_orphan() looks for a disk inode that is in use, has no
+ * links, and is marked with NILFS_ORPHAN_FL, starting from the inode
+ * number pointed by @ino.  The search is given up after @nscan inode
+ * numbers so that callers can reschedule a long scan.
+ *
+ * Return Value: On success, 0 is returned and the number of the orphan
+ * inode is stored in the place pointed by @ino.  On error, one of the
+ * following negative error codes is returned.
+ *
+ * %-EAGAIN - No orphan was found in @nscan inode numbers.  The number to
+ * resume searching from is stored in the place pointed by @ino.
+ *
+ * %-ENOENT - No orphan was found up to the end of the ifile.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ */
+int nilfs_ifile_find_orphan(struct inode *ifile, ino_t *ino,
+			    unsigned long nscan)
+{
+	struct nilfs_inode *raw_inode;
+	struct buffer_head *ibh;
+	__u64 nr, last, end, max;
+	bool orphan;
+	int ret;
+
+	ret = nilfs_bmap_last_key(NILFS_I(ifile)->i_bmap, &last);
+	if (ret < 0)
+		return ret;
+
+	/* entry blocks are preceded by descriptor and bitmap blocks */
+	end = (last + 1) * NILFS_MDT(ifile)->mi_entries_per_block;
+	nr = max_t(__u64, *ino, NILFS_FIRST_INO(ifile->i_sb));
+	max = min(end, nr + nscan);
+
+	while (nr < max) {
+		ret = nilfs_palloc_find_used_entry(ifile, &nr, max);
+		if (ret == -ENOENT)
+			break;
+		else if (ret < 0)
+			return ret;
+
+		ret = nilfs_palloc_get_entry_block(ifile, nr, 0, &ibh);
+		if (ret < 0)
+			return ret;
+
+		raw_inode = nilfs_ifile_map_inode(ifile, nr, ibh);
+		orphan = !raw_inode->i_links_count &&
+			(le32_to_cpu(raw_inode->i_flags) & NILFS_ORPHAN_FL);
+		nilfs_ifile_unmap_inode(ifile, nr, ibh);
+		brelse(ibh);
+
+		if (orphan) {
+			*ino = nr;
+			return 0;
+		}
+		nr++;
+	}
+
+	*ino = max;
+	return max < end ? -EAGAIN : -ENOENT;
+}
+
 /**
  * nilfs_ifile_count_free_inodes - calculate free inodes count
  * @ifile: ifile inode
@@ -169,6 +269,19 @@ int nilfs_ifile_count_free_inodes(struct inode *ifile,
 	return err;
 }
 
+/**
+ * nilfs_ifile_init_free_count - start maintaining free inodes count
+ * @ifile: ifile inode
+ *
+ * The count is kept up to date by the allocator from then on, so that
+ * nilfs_ifile_count_free_inodes() does not look at the ifile.
+ */
+int nilfs_ifile_init_free_count(struct inode *ifile)
+{
+	return nilfs_palloc_init_free_count(
+		ifile, atomic64_read(&NILFS_I(ifile)->i_root->inodes_count));
+}
+
 /**
  * nilfs_ifile_read - read or get ifile inode
  * @sb: super block instance
@@ -213,3 +326,126 @@ int nilfs_ifile_read(struct super_block *sb, struct nilfs_root *root,
 	iget_failed(ifile);
 	return err;
 }
+
+/**
+ * nilfs_ifile_readahead_inodes - read ahead blocks of disk inodes
+ * @ifile: ifile inode
+ * @inos: array of inode numbers
+ * @nitems: number of inode numbers in @inos
+ *
+ * nilfs_ifile_readahead_inodes() issues readahead of the ifile blocks
+ * holding the disk inodes of @inos, so that the inodes can be read
+ * without waiting for one block after another.  Blocks of invalid inode
+ * numbers are holes and just skipped; they are reported when the inodes
+ * are actually read.
+ */
+void nilfs_ifile_readahead_inodes(struct inode *ifile, const __u64 *inos,
+				  size_t nitems)
+{
+	struct the_nilfs *nilfs = ifile->i_sb->s_fs_info;
+
+	down_read(&NILFS_MDT(nilfs->ns_dat)->mi_sem);
+	nilfs_palloc_readahead_entries(ifile, inos, nitems);
+	up_read(&NILFS_MDT(nilfs->ns_dat)->mi_sem);
+}
+
+/* Blocks read ahead at a time by the ifile prefetcher */
+#define NILFS_IFILE_PREFETCH_BATCH	256
+
+/**
+ * nilfs_ifile_prefetch_work - read ahead ifiles of queued checkpoints
+ * @work: work struct embedded in the_nilfs
+ *
+ * The root being prefetched is kept at the head of ns_prefetch_list until
+ * its ifile has been read ahead, so that nilfs_cancel_ifile_prefetch() can
+ * stop the prefetch between batches by emptying the list.
+ */
+void nilfs_ifile_prefetch_work(struct work_struct *work)
+{
+	struct the_nilfs *nilfs = container_of(work, struct the_nilfs,
+					       ns_prefetch_work);
+	struct nilfs_root *root;
+	__u64 blkoff = 0;
+	int ret;
+
+	for (;;) {
+		spin_lock(&nilfs->ns_prefetch_lock);
+		root = list_first_entry_or_null(&nilfs->ns_prefetch_list,
+						struct nilfs_root,
+						prefetch_list);
+		spin_unlock(&nilfs->ns_prefetch_lock);
+		if (!root)
+			break;
+
+		/* block address translation needs a stable DAT */
+		down_read(&NILFS_MDT(nilfs->ns_dat)->mi_sem);
+		ret = nilfs_mdt_prefetch(root->ifile, &blkoff,
+					 NILFS_IFILE_PREFETCH_BATCH);
+		up_read(&NILFS_MDT(nilfs->ns_dat)->mi_sem);
+		if (ret == -EAGAIN) {
+			cond_resched();
+			continue;
+		}
+		if (ret < 0)
+			nilfs_warn(nilfs->ns_sb,
+				   "error %d prefetching ifile (checkpoint number=%llu)",
+				   ret, (unsigned long long)root->cno);
+
+		spin_lock(&nilfs->ns_prefetch_lock);
+		if (list_first_entry_or_null(&nilfs->ns_prefetch_list,
+					     struct nilfs_root,
+					     prefetch_list) != root) {
+			/* canceled; the canceler drops the reference */
+			spin_unlock(&nilfs->ns_prefetch_lock);
+			break;
+		}
+		list_del_init(&root->prefetch_list);
+		spin_unlock(&nilfs->ns_prefetch_lock);
+
+		nilfs_put_root(root);
+		blkoff = 0;
+	}
+}
+
+/**
+ * nilfs_queue_ifile_prefetch - read ahead the ifile of a checkpoint
+ * @root: root object of the checkpoint
+ *
+ * nilfs_queue_ifile_prefetch() queues @root so that all existing blocks of
+ * its ifile are read ahead in the background, which speeds up the first
+ * walks through a snapshot mounted on cold caches.  The prefetch holds a
+ * reference to @root until it completes or is canceled.
+ */
+void nilfs_queue_ifile_prefetch(struct nilfs_root *root)
+{
+	struct the_nilfs *nilfs = root->nilfs;
+
+	spin_lock(&nilfs->ns_prefetch_lock);
+	if (list_empty(&root->prefetch_list)) {
+		nilfs_get_root(root);
+		list_add_tail(&root->prefetch_list, &nilfs->ns_prefetch_list);
+		queue_work(system_unbound_wq, &nilfs->ns_prefetch_work);
+	}
+	spin_unlock(&nilfs->ns_prefetch_lock);
+}
+
+/**
+ * nilfs_cancel_ifile_prefetch - cancel all queued ifile prefetches
+ * @nilfs: nilfs object
+ */
+void nilfs_cancel_ifile_prefetch(struct the_nilfs *nilfs)
+{
+	struct nilfs_root *root, *n;
+	LIST_HEAD(list);
+
+	spin_lock(&nilfs->ns_prefetch_lock);
+	list_splice_init(&nilfs->ns_prefetch_list, &list);
+	spin_unlock(&nilfs->ns_prefetch_lock);
+
+	cancel_work_sync(&nilfs->ns_prefetch_work);
+
+	list_for_each_entry_safe(root, n, &list, prefetch_list) {
+		list_del_init(&root->prefetch_list);
+		nilfs_put_root(root);
+	}
+}
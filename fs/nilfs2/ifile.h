@@ -32,14 +32,25 @@ static inline void nilfs_ifile_unmap_inode(struct inode *ifile, ino_t ino,
 	kunmap(ibh->b_page);
 }
 
-int nilfs_ifile_create_inode(struct inode *, ino_t *, struct buffer_head **);
+int nilfs_ifile_create_inode(struct inode *, ino_t, ino_t *,
+			     struct buffer_head **);
+int nilfs_ifile_spread_goal(struct inode *ifile, u64 ninodes, ino_t *goal);
 int nilfs_ifile_delete_inode(struct inode *, ino_t);
 int nilfs_ifile_get_inode_block(struct inode *, ino_t, struct buffer_head **);
+void nilfs_ifile_readahead_inodes(struct inode *ifile, const __u64 *inos,
+				  size_t nitems);
+int nilfs_ifile_find_orphan(struct inode *ifile, ino_t *ino,
+			    unsigned long nscan);
 
 int nilfs_ifile_count_free_inodes(struct inode *, u64 *, u64 *);
+int nilfs_ifile_init_free_count(struct inode *ifile);
 
 int nilfs_ifile_read(struct super_block *sb, struct nilfs_root *root,
 		     size_t inode_size, struct nilfs_inode *raw_inode,
 		     struct inode **inodep);
 
+void nilfs_ifile_prefetch_work(struct work_struct *work);
+void nilfs_queue_ifile_prefetch(struct nilfs_root *root);
+void nilfs_cancel_ifile_prefetch(struct the_nilfs *nilfs);
+
 #endif	/* _NILFS_IFILE_H */
@@ -321,6 +321,26 @@ static int nilfs_insert_inode_locked(struct inode *inode,
 	return insert_inode_locked4(inode, ino, nilfs_iget_test, &args);
 }
 
+/*
+ * Disk inodes of files are allocated next to their parent directory so that
+ * operations on a directory touch few ifile blocks.  New top-level
+ * directories are spread over ifile groups instead, in the Orlov manner,
+ * so that each subtree has room to grow close to its top.
+ */
+static ino_t nilfs_inode_goal(struct inode *dir, umode_t mode)
+{
+	struct nilfs_root *root = NILFS_I(dir)->i_root;
+	ino_t goal;
+
+	if (S_ISDIR(mode) && dir->i_ino == NILFS_ROOT_INO &&
+	    !nilfs_ifile_spread_goal(root->ifile,
+				     atomic64_read(&root->inodes_count),
+				     &goal))
+		return goal;
+
+	return dir->i_ino;
+}
+
 struct inode *nilfs_new_inode(struct inode *dir, umode_t mode)
 {
 	struct super_block *sb = dir->i_sb;
@@ -330,7 +350,7 @@ struct inode *nilfs_new_inode(struct inode *dir, umode_t mode)
 	struct nilfs_root *root;
 	struct buffer_head *bh;
 	int err = -ENOMEM;
-	ino_t ino;
+	ino_t ino, goal;
 
 	inode = new_inode(sb);
 	if (unlikely(!inode))
@@ -344,7 +364,8 @@ struct inode *nilfs_new_inode(struct inode *dir, umode_t mode)
 	ii->i_state = BIT(NILFS_I_NEW);
 	ii->i_root = root;
 
-	err = nilfs_ifile_create_inode(root->ifile, &ino, &bh);
+	goal = nilfs_inode_goal(dir, mode);
+	err = nilfs_ifile_create_inode(root->ifile, goal, &ino, &bh);
 	if (unlikely(err))
 		goto failed_ifile_create_inode;
 	/* reference count of i_bh inherits from nilfs_mdt_read_block() */
@@ -354,7 +375,8 @@ struct inode *nilfs_new_inode(struct inode *dir, umode_t mode)
 			   "inode bitmap is inconsistent for reserved inodes");
 		do {
 			brelse(bh);
-			err = nilfs_ifile_create_inode(root->ifile, &ino, &bh);
+			err = nilfs_ifile_create_inode(root->ifile, goal, &ino,
+						       &bh);
 			if (unlikely(err))
 				goto failed_ifile_create_inode;
 		} while (ino < NILFS_USER_INO);
@@ -457,7 +479,7 @@ int nilfs_read_inode_common(struct inode *inode,
 	inode->i_mtime.tv_nsec = le32_to_cpu(raw_inode->i_mtime_nsec);
 	if (nilfs_is_metadata_file_inode(inode) && !S_ISREG(inode->i_mode))
 		return -EIO; /* this inode is for metadata and corrupted */
-	if (inode->i_nlink == 0)
+	if (inode->i_nlink == 0 && !test_bit(NILFS_I_ORPHAN, &ii->i_state))
 		return -ESTALE; /* this inode is deleted */
 
 	inode->i_blocks = le64_to_cpu(raw_inode->i_blocks);
@@ -525,6 +547,8 @@ static int __nilfs_read_inode(struct super_block *sb,
 	nilfs_set_inode_flags(inode);
 	mapping_set_gfp_mask(inode->i_mapping,
 			   mapping_gfp_constraint(inode->i_mapping, ~__GFP_FS));
+	/* a clean disk inode has been written with a checkpoint */
+	set_bit(NILFS_I_DSYNC_ISIZE, &NILFS_I(inode)->i_state);
 	return 0;
 
  failed_unmap:
@@ -626,6 +650,43 @@ struct inode *nilfs_iget(struct super_block *sb, struct nilfs_root *root,
 	return inode;
 }
 
+/**
+ * nilfs_iget_orphan - get an orphan inode to release its blocks
+ * @sb: super block instance
+ * @root: root object of the current checkpoint
+ * @ino: inode number
+ *
+ * Return Value: On success, the inode of the orphan is returned.  On
+ * error, an ERR_PTR() value is returned: %-EBUSY if the inode is in use,
+ * %-ESTALE if it is not an orphan, or another negative error code.
+ */
+struct inode *nilfs_iget_orphan(struct super_block *sb, struct nilfs_root *root,
+				unsigned long ino)
+{
+	struct inode *inode;
+	int err;
+
+	inode = nilfs_iget_locked(sb, root, ino);
+	if (unlikely(!inode))
+		return ERR_PTR(-ENOMEM);
+	if (!(inode->i_state & I_NEW)) {
+		iput(inode);
+		return ERR_PTR(-EBUSY);
+	}
+
+	set_bit(NILFS_I_ORPHAN, &NILFS_I(inode)->i_state);
+	err = __nilfs_read_inode(sb, root, ino, inode);
+	if (!err && (inode->i_nlink || !S_ISREG(inode->i_mode) ||
+		     !(NILFS_I(inode)->i_flags & NILFS_ORPHAN_FL)))
+		err = -ESTALE;
+	if (unlikely(err)) {
+		iget_failed(inode);
+		return ERR_PTR(err);
+	}
+	unlock_new_inode(inode);
+	return inode;
+}
+
 struct inode *nilfs_iget_for_gc(struct super_block *sb, unsigned long ino,
 				__u64 cno)
 {
@@ -651,13 +712,34 @@ struct inode *nilfs_iget_for_gc(struct super_block *sb, unsigned long ino,
 	return inode;
 }
 
+/**
+ * nilfs_btnc_shared - check if an inode shares the snapshot node cache
+ * @inode: inode object
+ *
+ * Ifiles of mounted snapshots are never modified, and their B-tree node
+ * blocks are addressed with virtual block numbers which are unique across
+ * checkpoints until they are freed by GC.  So, they share a single B-tree
+ * node cache so that nodes of unchanged subtrees are cached only once no
+ * matter how many snapshots are mounted.
+ */
+static bool nilfs_btnc_shared(struct inode *inode)
+{
+	struct nilfs_inode_info *ii = NILFS_I(inode);
+
+	return inode->i_ino == NILFS_IFILE_INO && ii->i_root &&
+		ii->i_root->cno != NILFS_CPTREE_CURRENT_CNO &&
+		!test_bit(NILFS_I_GCINODE, &ii->i_state) &&
+		!test_bit(NILFS_I_SHADOW, &ii->i_state);
+}
+
 /**
  * nilfs_attach_btree_node_cache - attach a B-tree node cache to the inode
  * @inode: inode object
  *
  * nilfs_attach_btree_node_cache() attaches a B-tree node cache to @inode,
  * or does nothing if the inode already has it.  This function allocates
- * an additional inode to maintain page cache of B-tree nodes one-on-one.
+ * an additional inode to maintain page cache of B-tree nodes one-on-one,
+ * except for ifiles of snapshots, which share one cache inode.
  *
  * Return Value: On success, 0 is returned. On errors, one of the following
  * negative error code is returned.
@@ -669,13 +751,14 @@ int nilfs_attach_btree_node_cache(struct inode *inode)
 	struct nilfs_inode_info *ii = NILFS_I(inode);
 	struct inode *btnc_inode;
 	struct nilfs_iget_args args;
+	bool shared = nilfs_btnc_shared(inode);
 
 	if (ii->i_assoc_inode)
 		return 0;
 
 	args.ino = inode->i_ino;
-	args.root = ii->i_root;
-	args.cno = ii->i_cno;
+	args.root = shared ? NULL : ii->i_root;
+	args.cno = shared ? 0 : ii->i_cno;
 	args.for_gc = test_bit(NILFS_I_GCINODE, &ii->i_state) != 0;
 	args.for_btnc = true;
 	args.for_shadow = test_bit(NILFS_I_SHADOW, &ii->i_state) != 0;
@@ -688,13 +771,45 @@ int nilfs_attach_btree_node_cache(struct inode *inode)
 		nilfs_init_btnc_inode(btnc_inode);
 		unlock_new_inode(btnc_inode);
 	}
-	NILFS_I(btnc_inode)->i_assoc_inode = inode;
-	NILFS_I(btnc_inode)->i_bmap = ii->i_bmap;
+	if (!shared) {
+		NILFS_I(btnc_inode)->i_assoc_inode = inode;
+		NILFS_I(btnc_inode)->i_bmap = ii->i_bmap;
+	}
 	ii->i_assoc_inode = btnc_inode;
 
 	return 0;
 }
 
+/**
+ * nilfs_forget_snapshot_nodes - drop shared node cache of freed blocks
+ * @nilfs: nilfs object
+ * @vblocknrs: array of virtual block numbers freed by GC
+ * @nitems: number of elements in @vblocknrs
+ *
+ * Virtual block numbers freed by GC may be reused for new blocks, and
+ * then be referenced by a snapshot taken later.  This invalidates blocks
+ * left in the B-tree node cache shared by snapshot ifiles for them.  The
+ * blocks are never in use by mounted snapshots since checkpoints of
+ * mounted snapshots cannot be deleted.
+ */
+void nilfs_forget_snapshot_nodes(struct the_nilfs *nilfs, __u64 *vblocknrs,
+				 size_t nitems)
+{
+	struct nilfs_iget_args args = {
+		.ino = NILFS_IFILE_INO, .root = NULL, .cno = 0,
+		.for_gc = false, .for_btnc = true, .for_shadow = false
+	};
+	struct inode *btnc_inode;
+
+	btnc_inode = ilookup5(nilfs->ns_sb, NILFS_IFILE_INO, nilfs_iget_test,
+			      &args);
+	if (!btnc_inode)
+		return;
+
+	nilfs_btnode_forget_blocks(btnc_inode->i_mapping, vblocknrs, nitems);
+	iput(btnc_inode);
+}
+
 /**
  * nilfs_detach_btree_node_cache - detach the B-tree node cache from the inode
  * @inode: inode object
@@ -708,7 +823,8 @@ void nilfs_detach_btree_node_cache(struct inode *inode)
 	struct inode *btnc_inode = ii->i_assoc_inode;
 
 	if (btnc_inode) {
-		NILFS_I(btnc_inode)->i_assoc_inode = NULL;
+		if (NILFS_I(btnc_inode)->i_assoc_inode == inode)
+			NILFS_I(btnc_inode)->i_assoc_inode = NULL;
 		ii->i_assoc_inode = NULL;
 		iput(btnc_inode);
 	}
@@ -824,23 +940,37 @@ void nilfs_update_inode(struct inode *inode, struct buffer_head *ibh, int flags)
 
 #define NILFS_MAX_TRUNCATE_BLOCKS	16384  /* 64MB for 4KB block */
 
-static void nilfs_truncate_bmap(struct nilfs_inode_info *ii,
-				unsigned long from)
+/**
+ * __nilfs_truncate_bmap - remove blocks of an inode from its block mapping
+ * @ii: nilfs inode
+ * @from: offset of the first block to be removed
+ * @nchunks: maximum number of chunks of NILFS_MAX_TRUNCATE_BLOCKS blocks
+ *           to be removed, or zero to remove all blocks after @from
+ *
+ * Return Value: 0 if all blocks after @from have been removed, 1 if
+ * some remain because the @nchunks limit was reached, or a negative error
+ * code on failure.
+ */
+static int __nilfs_truncate_bmap(struct nilfs_inode_info *ii,
+				 unsigned long from, unsigned int nchunks)
 {
+	unsigned int n = 0;
 	__u64 b;
 	int ret;
 
 	if (!test_bit(NILFS_I_BMAP, &ii->i_state))
-		return;
+		return 0;
 repeat:
 	ret = nilfs_bmap_last_key(ii->i_bmap, &b);
 	if (ret == -ENOENT)
-		return;
+		return 0;
 	else if (ret < 0)
-		goto failed;
+		return ret;
 
 	if (b < from)
-		return;
+		return 0;
+	if (nchunks && n++ == nchunks)
+		return 1;
 
 	b -= min_t(__u64, NILFS_MAX_TRUNCATE_BLOCKS, b - from);
 	ret = nilfs_bmap_truncate(ii->i_bmap, b);
@@ -848,10 +978,18 @@ static void nilfs_truncate_bmap(struct nilfs_inode_info *ii,
 	if (!ret || (ret == -ENOMEM &&
 		     nilfs_bmap_truncate(ii->i_bmap, b) == 0))
 		goto repeat;
+	return ret;
+}
+
+static void nilfs_truncate_bmap(struct nilfs_inode_info *ii,
+				unsigned long from)
+{
+	int ret = __nilfs_truncate_bmap(ii, from, 0);
 
-failed:
-	nilfs_warn(ii->vfs_inode.i_sb, "error %d truncating bmap (ino=%lu)",
-		   ret, ii->vfs_inode.i_ino);
+	if (ret < 0)
+		nilfs_warn(ii->vfs_inode.i_sb,
+			   "error %d truncating bmap (ino=%lu)",
+			   ret, ii->vfs_inode.i_ino);
 }
 
 void nilfs_truncate(struct inode *inode)
@@ -871,6 +1009,9 @@ void nilfs_truncate(struct inode *inode)
 	blkoff = (inode->i_size + blocksize - 1) >> sb->s_blocksize_bits;
 	nilfs_transaction_begin(sb, &ti, 0); /* never fails */
 
+	/* removed blocks are not recorded in data-sync logs */
+	clear_bit(NILFS_I_DSYNC_ISIZE, &ii->i_state);
+
 	block_truncate_page(inode->i_mapping, inode->i_size, nilfs_get_block);
 
 	nilfs_truncate_bmap(ii, blkoff);
@@ -888,6 +1029,35 @@ void nilfs_truncate(struct inode *inode)
 	 */
 }
 
+/**
+ * nilfs_truncate_orphan - release blocks of an orphan inode
+ * @inode: orphan inode obtained with nilfs_iget_orphan()
+ * @nchunks: maximum number of chunks of NILFS_MAX_TRUNCATE_BLOCKS blocks
+ *           to be released
+ *
+ * nilfs_truncate_orphan() releases at most @nchunks chunks of blocks of
+ * @inode from its tail in a transaction, so that the blocks of a huge
+ * file are released across multiple logs instead of in one go.
+ *
+ * Return Value: 0 if all blocks have been released, 1 if some remain, or a
+ * negative error code on failure.
+ */
+int nilfs_truncate_orphan(struct inode *inode, unsigned int nchunks)
+{
+	struct nilfs_transaction_info ti;
+	struct super_block *sb = inode->i_sb;
+	int ret, err;
+
+	nilfs_transaction_begin(sb, &ti, 0); /* never fails */
+
+	ret = __nilfs_truncate_bmap(NILFS_I(inode), 0, nchunks);
+
+	nilfs_mark_inode_dirty(inode);
+	nilfs_set_file_dirty(inode, 0);
+	err = nilfs_transaction_commit(sb);
+	return ret < 0 ? ret : (err ? err : ret);
+}
+
 static void nilfs_clear_inode(struct inode *inode)
 {
 	struct nilfs_inode_info *ii = NILFS_I(inode);
@@ -929,6 +1099,15 @@ void nilfs_evict_inode(struct inode *inode)
 
 	truncate_inode_pages_final(&inode->i_data);
 
+	if (nilfs_defer_orphan(inode)) {
+		/* Blocks are released later by the orphan purger */
+		nilfs_mark_inode_dirty(inode);
+		clear_inode(inode);
+		nilfs_clear_inode(inode);
+		nilfs_transaction_commit(sb);
+		return;
+	}
+
 	/* TODO: some of the following operations may fail.  */
 	nilfs_truncate_bmap(ii, 0);
 	nilfs_mark_inode_dirty(inode);
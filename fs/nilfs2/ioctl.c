@@ -17,12 +17,14 @@
 #include <linux/mount.h>	/* mnt_want_write_file(), mnt_drop_write_file() */
 #include <linux/buffer_head.h>
 #include <linux/fileattr.h>
+#include <linux/file.h>		/* get_unused_fd_flags(), fd_install() */
 #include "nilfs.h"
 #include "segment.h"
 #include "bmap.h"
 #include "cpfile.h"
 #include "sufile.h"
 #include "dat.h"
+#include "ifile.h"
 
 /**
  * nilfs_ioctl_wrap_copy - wrapping function of get/set metadata info
@@ -205,6 +207,10 @@ static int nilfs_ioctl_change_cpmode(struct inode *inode, struct file *filp,
 
 	mutex_lock(&nilfs->ns_snapshot_mount_mutex);
 
+	/* do not let cached file handles keep the snapshot alive */
+	if (cpmode.cm_mode == NILFS_CHECKPOINT)
+		nilfs_fh_cache_forget(nilfs, cpmode.cm_cno);
+
 	nilfs_transaction_begin(inode->i_sb, &ti, 0);
 	ret = nilfs_cpfile_change_cpmode(
 		nilfs->ns_cpfile, cpmode.cm_cno, cpmode.cm_mode);
@@ -593,8 +599,8 @@ static int nilfs_ioctl_move_inode_block(struct inode *inode,
  * Return Value: Number of processed nilfs_vdesc structures or
  * error code, otherwise.
  */
-static int nilfs_ioctl_move_blocks(struct super_block *sb,
-				   struct nilfs_argv *argv, void *buf)
+int nilfs_ioctl_move_blocks(struct super_block *sb, struct nilfs_argv *argv,
+			    void *buf)
 {
 	size_t nmembs = argv->v_nmembs;
 	struct the_nilfs *nilfs = sb->s_fs_info;
@@ -826,6 +832,43 @@ int nilfs_ioctl_prepare_clean_segments(struct the_nilfs *nilfs,
 	return ret;
 }
 
+/**
+ * nilfs_ioctl_account_gc_blocks - count blocks relocated by GC per inode
+ * @sb: super block instance
+ * @root: root object of the file system that was cleaned
+ * @argv: vector of arguments from userspace (for virtual block descriptors)
+ * @buf: array of nilfs_vdesc structures of the moved blocks
+ *
+ * Description: nilfs_ioctl_account_gc_blocks() adds the number of blocks
+ * that a garbage collection pass has relocated to the statistics of each
+ * owner inode that is in memory.  The descriptors are grouped by inode
+ * number as nilfs_ioctl_move_blocks() expects.
+ */
+static void nilfs_ioctl_account_gc_blocks(struct super_block *sb,
+					  struct nilfs_root *root,
+					  struct nilfs_argv *argv, void *buf)
+{
+	struct nilfs_vdesc *vdesc = buf;
+	struct inode *inode;
+	size_t i = 0, n;
+	ino_t ino;
+
+	if (!IS_ENABLED(CONFIG_NILFS2_FS_INODE_STATS))
+		return;
+
+	while (i < argv->v_nmembs) {
+		ino = vdesc[i].vd_ino;
+		for (n = 0; i < argv->v_nmembs && vdesc[i].vd_ino == ino; i++)
+			n++;
+
+		inode = nilfs_ilookup(sb, root, ino);
+		if (inode) {
+			nilfs_inode_stat_add(inode, NILFS_ISTAT_GC_BLOCKS, n);
+			iput(inode);
+		}
+	}
+}
+
 /**
  * nilfs_ioctl_clean_segments - clean segments
  * @inode: inode object
@@ -938,6 +981,10 @@ static int nilfs_ioctl_clean_segments(struct inode *inode, struct file *filp,
 		if (nilfs_sb_need_update(nilfs))
 			set_nilfs_discontinued(nilfs);
 		ret = nilfs_clean_segments(inode->i_sb, argv, kbufs);
+		if (!ret)
+			nilfs_ioctl_account_gc_blocks(inode->i_sb,
+						      NILFS_I(inode)->i_root,
+						      &argv[0], kbufs[0]);
 	}
 
 	nilfs_remove_all_gcinodes(nilfs);
@@ -1130,6 +1177,42 @@ static int nilfs_ioctl_set_alloc_range(struct inode *inode, void __user *argp)
 	return ret;
 }
 
+/**
+ * nilfs_ioctl_get_inode_stats - get log statistics of an inode
+ * @inode: inode object
+ * @argp: pointer on argument from userspace
+ *
+ * Description: nilfs_ioctl_get_inode_stats() copies the log statistics
+ * of @inode, counted since it was read into memory, to userspace.
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EOPNOTSUPP - Per-inode statistics are not compiled in.
+ *
+ * %-EFAULT - Failure during copying the statistics to userspace.
+ */
+static int nilfs_ioctl_get_inode_stats(struct inode *inode, void __user *argp)
+{
+	struct nilfs_inode_stats stats;
+
+	if (!IS_ENABLED(CONFIG_NILFS2_FS_INODE_STATS))
+		return -EOPNOTSUPP;
+
+	stats.is_log_blocks = nilfs_inode_stat_read(inode,
+						    NILFS_ISTAT_LOG_BLOCKS);
+	stats.is_gc_blocks = nilfs_inode_stat_read(inode,
+						   NILFS_ISTAT_GC_BLOCKS);
+	stats.is_dat_allocs = nilfs_inode_stat_read(inode,
+						    NILFS_ISTAT_DAT_ALLOCS);
+	stats.is_dsync_logs = nilfs_inode_stat_read(inode,
+						    NILFS_ISTAT_DSYNC_LOGS);
+
+	if (copy_to_user(argp, &stats, sizeof(stats)))
+		return -EFAULT;
+	return 0;
+}
+
 /**
  * nilfs_ioctl_get_info - wrapping function of get metadata info
  * @inode: inode object
@@ -1268,6 +1351,110 @@ static int nilfs_ioctl_set_suinfo(struct inode *inode, struct file *filp,
 	return ret;
 }
 
+/**
+ * nilfs_ioctl_prefetch_ifile - read ahead the ifile in the background
+ * @inode: inode object
+ *
+ * Description: nilfs_ioctl_prefetch_ifile() queues a background readahead
+ * of all existing blocks of the ifile of the checkpoint @inode belongs to,
+ * which is the current checkpoint or a mounted snapshot.  It returns
+ * without waiting for the reads.
+ *
+ * Return Value: 0 is always returned.
+ */
+static int nilfs_ioctl_prefetch_ifile(struct inode *inode)
+{
+	nilfs_queue_ifile_prefetch(NILFS_I(inode)->i_root);
+	return 0;
+}
+
+/**
+ * nilfs_ioctl_open_mdt_view - open a read-only view of a metadata file
+ * @inode: inode object
+ * @filp: file object
+ * @argp: pointer on argument from userspace
+ *
+ * Description: nilfs_ioctl_open_mdt_view() returns a new file descriptor
+ * that can be mapped with mmap() to read the DAT, CPFILE or SUFILE in
+ * place, and fills in the &struct nilfs_mdt_view at @argp.  The view keeps
+ * the mount busy until it is closed, and NILFS_IOCTL_GET_MDT_VIEW on it
+ * returns a fresh copy of the descriptor.
+ *
+ * Return Value: On success, the new file descriptor is returned. On error,
+ * one of the following negative error codes is returned.
+ *
+ * %-EPERM - Not permitted.
+ *
+ * %-EFAULT - Failure during execution of requested operation.
+ *
+ * %-EINVAL - Invalid inode number or flags.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient memory available.
+ *
+ * %-EMFILE - Too many open files.
+ */
+static int nilfs_ioctl_open_mdt_view(struct inode *inode, struct file *filp,
+				     void __user *argp)
+{
+	struct the_nilfs *nilfs = inode->i_sb->s_fs_info;
+	struct nilfs_mdt_view mv;
+	struct inode *mdt;
+	struct file *file;
+	int fd, ret;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&mv, argp, sizeof(mv)))
+		return -EFAULT;
+
+	if (mv.mv_flags)
+		return -EINVAL;
+
+	switch (mv.mv_ino) {
+	case NILFS_DAT_INO:
+		mdt = nilfs->ns_dat;
+		break;
+	case NILFS_CPFILE_INO:
+		mdt = nilfs->ns_cpfile;
+		break;
+	case NILFS_SUFILE_INO:
+		mdt = nilfs->ns_sufile;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = nilfs_mdt_view_info(mdt, &mv);
+	if (ret < 0)
+		return ret;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	file = nilfs_mdt_open_view(mdt, filp->f_path.mnt);
+	if (IS_ERR(file)) {
+		ret = PTR_ERR(file);
+		goto out_put_fd;
+	}
+
+	if (copy_to_user(argp, &mv, sizeof(mv))) {
+		fput(file);
+		ret = -EFAULT;
+		goto out_put_fd;
+	}
+
+	fd_install(fd, file);
+	return fd;
+
+out_put_fd:
+	put_unused_fd(fd);
+	return ret;
+}
+
 long nilfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	struct inode *inode = file_inode(filp);
@@ -1308,6 +1495,12 @@ long nilfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return nilfs_ioctl_resize(inode, filp, argp);
 	case NILFS_IOCTL_SET_ALLOC_RANGE:
 		return nilfs_ioctl_set_alloc_range(inode, argp);
+	case NILFS_IOCTL_GET_INODE_STATS:
+		return nilfs_ioctl_get_inode_stats(inode, argp);
+	case NILFS_IOCTL_PREFETCH_IFILE:
+		return nilfs_ioctl_prefetch_ifile(inode);
+	case NILFS_IOCTL_OPEN_MDT_VIEW:
+		return nilfs_ioctl_open_mdt_view(inode, filp, argp);
 	case FITRIM:
 		return nilfs_ioctl_trim_fs(inode, argp);
 	default:
@@ -1335,6 +1528,9 @@ long nilfs_compat_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	case NILFS_IOCTL_SYNC:
 	case NILFS_IOCTL_RESIZE:
 	case NILFS_IOCTL_SET_ALLOC_RANGE:
+	case NILFS_IOCTL_GET_INODE_STATS:
+	case NILFS_IOCTL_PREFETCH_IFILE:
+	case NILFS_IOCTL_OPEN_MDT_VIEW:
 	case FITRIM:
 		break;
 	default:
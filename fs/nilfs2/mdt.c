@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/swap.h>
 #include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/anon_inodes.h>
+#include <linux/uaccess.h>
 #include "nilfs.h"
 #include "btnode.h"
 #include "segment.h"
@@ -314,6 +317,85 @@ int nilfs_mdt_find_block(struct inode *inode, unsigned long start,
 	return ret;
 }
 
+/**
+ * nilfs_mdt_prefetch - read ahead existing blocks of meta data file
+ * @inode: inode of the meta data file
+ * @blkoff: block offset to start from, updated to the offset to resume at
+ * @nblocks: maximum number of existing blocks to read ahead
+ *
+ * nilfs_mdt_prefetch() issues readahead requests for up to @nblocks
+ * existing blocks at or after *@blkoff in offset order, skipping holes
+ * and blocks already cached.  The requests are issued under a block plug
+ * so that blocks contiguous on disk are merged into large reads, and
+ * this function does not wait for their completion.
+ *
+ * Return Value: On success, 0 is returned if no more blocks exist, or
+ * %-EAGAIN is returned if @nblocks blocks have been read ahead and more
+ * blocks may follow.  On error, one of the following negative error codes
+ * is returned.
+ *
+ * %-ENOMEM - Insufficient memory available.
+ *
+ * %-EIO - I/O error
+ */
+int nilfs_mdt_prefetch(struct inode *inode, __u64 *blkoff,
+		       unsigned long nblocks)
+{
+	struct nilfs_bmap *bmap = NILFS_I(inode)->i_bmap;
+	struct buffer_head *bh;
+	struct blk_plug plug;
+	__u64 key = *blkoff;
+	int ret = 0;
+
+	blk_start_plug(&plug);
+	while (nblocks-- > 0) {
+		ret = nilfs_bmap_seek_key(bmap, key, &key);
+		if (ret)
+			break;
+
+		ret = nilfs_mdt_submit_block(inode, key,
+					     REQ_OP_READ | REQ_RAHEAD, &bh);
+		if (likely(!ret || ret == -EEXIST))
+			brelse(bh);
+		else if (ret != -EBUSY)
+			break;
+		ret = -EAGAIN;
+		key++;
+	}
+	blk_finish_plug(&plug);
+
+	*blkoff = key;
+	return ret == -ENOENT ? 0 : ret;
+}
+
+/**
+ * nilfs_mdt_readahead - read ahead blocks of meta data file
+ * @inode: inode of the meta data file
+ * @blkoffs: array of block offsets
+ * @nitems: number of block offsets in @blkoffs
+ *
+ * nilfs_mdt_readahead() issues readahead requests for the blocks at
+ * @blkoffs that are not cached yet, and returns without waiting for them.
+ * Holes and errors are ignored since the readahead is only a hint.
+ */
+void nilfs_mdt_readahead(struct inode *inode, const unsigned long *blkoffs,
+			 size_t nitems)
+{
+	struct buffer_head *bh;
+	struct blk_plug plug;
+	size_t i;
+	int ret;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nitems; i++) {
+		ret = nilfs_mdt_submit_block(inode, blkoffs[i],
+					     REQ_OP_READ | REQ_RAHEAD, &bh);
+		if (likely(!ret || ret == -EEXIST))
+			brelse(bh);
+	}
+	blk_finish_plug(&plug);
+}
+
 /**
  * nilfs_mdt_delete_block - make a hole on the meta data file.
  * @inode: inode of the meta data file
@@ -643,6 +725,7 @@ void nilfs_mdt_restore_from_shadow_map(struct inode *inode)
 			      NILFS_I(shadow->inode)->i_assoc_inode->i_mapping);
 
 	nilfs_bmap_restore(ii->i_bmap, &shadow->bmap_store);
+	nilfs_mdt_bump_generation(inode);
 
 	up_write(&mi->mi_sem);
 }
@@ -663,3 +746,444 @@ void nilfs_mdt_clear_shadow_map(struct inode *inode)
 	truncate_inode_pages(shadow_btnc_inode->i_mapping, 0);
 	up_write(&mi->mi_sem);
 }
+
+/*
+ * Page cache control of metadata files
+ */
+
+/* Maximum number of page indexes invalidated at a time */
+#define NILFS_MDT_SHRINK_BATCH	64
+
+/**
+ * nilfs_mdt_shrink_cache - reclaim clean pages of a metadata file
+ * @inode: inode of the metadata file
+ * @nr_to_scan: number of page indexes to scan
+ *
+ * nilfs_mdt_shrink_cache() invalidates clean and unused pages of the
+ * metadata file in ascending order of index until @nr_to_scan indexes have
+ * been scanned.  Pages holding group descriptor blocks of the persistent
+ * object allocator, or the header block of other metadata files, are kept
+ * because they are needed by nearly every operation on the file.
+ *
+ * Return Value: number of pages invalidated.
+ */
+static unsigned long nilfs_mdt_shrink_cache(struct inode *inode,
+					    unsigned long nr_to_scan)
+{
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long desc_blocks = NILFS_MDT(inode)->mi_blocks_per_desc_block;
+	unsigned int shift = PAGE_SHIFT - inode->i_blkbits;
+	unsigned long freed = 0, scanned = 0;
+	pgoff_t index = 0, first, last;
+	u64 group;
+	void *entry;
+
+	while (scanned < nr_to_scan) {
+		rcu_read_lock();
+		entry = xa_find(&mapping->i_pages, &index, ULONG_MAX,
+				XA_PRESENT);
+		rcu_read_unlock();
+		if (!entry)
+			break;
+
+		if (desc_blocks) {
+			/* skip the group descriptor block of the range */
+			group = div64_ul((u64)index << shift, desc_blocks);
+			first = ((group * desc_blocks) >> shift) + 1;
+			last = (((group + 1) * desc_blocks) >> shift) - 1;
+		} else {
+			/* skip the header block */
+			first = 1;
+			last = ULONG_MAX;
+		}
+		first = max(first, index);
+		if (first > last) {
+			index = last + 1;
+			continue;
+		}
+		last = min(last, first + NILFS_MDT_SHRINK_BATCH - 1);
+
+		freed += invalidate_mapping_pages(mapping, first, last);
+		scanned += last - first + 1;
+		if (last == ULONG_MAX)
+			break;
+		index = last + 1;
+		cond_resched();
+	}
+	return freed;
+}
+
+/**
+ * nilfs_mdt_shrink_ifiles - reclaim clean pages of ifiles
+ * @nilfs: nilfs object
+ * @nr_to_scan: number of page indexes to scan in each ifile
+ * @limit: pages each ifile may keep, or 0 to scan unconditionally
+ *
+ * nilfs_mdt_shrink_ifiles() applies nilfs_mdt_shrink_cache() to the
+ * ifiles of all checkpoints in use, that is, the current one and mounted
+ * snapshots.
+ *
+ * Return Value: number of pages invalidated.
+ */
+static unsigned long nilfs_mdt_shrink_ifiles(struct the_nilfs *nilfs,
+					     unsigned long nr_to_scan,
+					     unsigned long limit)
+{
+	struct nilfs_root *root, *prev = NULL;
+	unsigned long freed = 0, nrpages;
+	struct rb_node *n;
+
+	spin_lock(&nilfs->ns_cptree_lock);
+	for (n = rb_first(&nilfs->ns_cptree); n; n = rb_next(n)) {
+		root = rb_entry(n, struct nilfs_root, rb_node);
+		if (!root->ifile)
+			continue;
+		nrpages = root->ifile->i_mapping->nrpages;
+		if (limit && nrpages <= limit)
+			continue;
+
+		/* pin the root so that its rb_node stays valid while unlocked */
+		refcount_inc(&root->count);
+		spin_unlock(&nilfs->ns_cptree_lock);
+
+		if (prev)
+			nilfs_put_root(prev);
+		prev = root;
+		freed += nilfs_mdt_shrink_cache(root->ifile,
+						limit ? nrpages - limit :
+						nr_to_scan);
+
+		spin_lock(&nilfs->ns_cptree_lock);
+	}
+	spin_unlock(&nilfs->ns_cptree_lock);
+
+	if (prev)
+		nilfs_put_root(prev);
+	return freed;
+}
+
+static struct inode *nilfs_mdt_cache_inode(struct the_nilfs *nilfs, int type)
+{
+	switch (type) {
+	case NILFS_MDT_CACHE_DAT:
+		return nilfs->ns_dat;
+	case NILFS_MDT_CACHE_CPFILE:
+		return nilfs->ns_cpfile;
+	case NILFS_MDT_CACHE_SUFILE:
+		return nilfs->ns_sufile;
+	}
+	return NULL;
+}
+
+/**
+ * nilfs_mdt_cache_nrpages - get the page cache size of metadata files
+ * @nilfs: nilfs object
+ * @type: type of metadata file page cache (NILFS_MDT_CACHE_*)
+ * @btnode: count pages of the B-tree node caches instead of the data
+ *
+ * Return Value: number of pages cached for the metadata file, summed over
+ * all checkpoints in use for ifiles.
+ */
+unsigned long nilfs_mdt_cache_nrpages(struct the_nilfs *nilfs, int type,
+				      bool btnode)
+{
+	struct nilfs_root *root;
+	struct inode *inode;
+	unsigned long nrpages = 0;
+	struct rb_node *n;
+	bool shared_counted = false;
+
+	if (type != NILFS_MDT_CACHE_IFILE) {
+		inode = nilfs_mdt_cache_inode(nilfs, type);
+		if (inode && btnode)
+			inode = NILFS_I(inode)->i_assoc_inode;
+		return inode ? inode->i_mapping->nrpages : 0;
+	}
+
+	spin_lock(&nilfs->ns_cptree_lock);
+	for (n = rb_first(&nilfs->ns_cptree); n; n = rb_next(n)) {
+		root = rb_entry(n, struct nilfs_root, rb_node);
+		inode = root->ifile;
+		if (inode && btnode) {
+			inode = NILFS_I(inode)->i_assoc_inode;
+			/* snapshots share one node cache */
+			if (inode && root->cno != NILFS_CPTREE_CURRENT_CNO) {
+				if (shared_counted)
+					continue;
+				shared_counted = true;
+			}
+		}
+		if (inode)
+			nrpages += inode->i_mapping->nrpages;
+	}
+	spin_unlock(&nilfs->ns_cptree_lock);
+	return nrpages;
+}
+
+static unsigned long nilfs_mdt_shrinker_count(struct shrinker *shrink,
+					      struct shrink_control *sc)
+{
+	struct the_nilfs *nilfs = container_of(shrink, struct the_nilfs,
+					       ns_mdt_shrinker);
+	unsigned long count = 0;
+	int type;
+
+	for (type = 0; type < NILFS_MDT_CACHE_NR; type++)
+		count += nilfs_mdt_cache_nrpages(nilfs, type, false);
+
+	return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long nilfs_mdt_shrink_type(struct the_nilfs *nilfs, int type,
+					   unsigned long nr_to_scan,
+					   unsigned long limit)
+{
+	struct inode *inode;
+	unsigned long nrpages;
+
+	if (type == NILFS_MDT_CACHE_IFILE)
+		return nilfs_mdt_shrink_ifiles(nilfs, nr_to_scan, limit);
+
+	inode = nilfs_mdt_cache_inode(nilfs, type);
+	if (limit) {
+		nrpages = inode->i_mapping->nrpages;
+		if (nrpages <= limit)
+			return 0;
+		nr_to_scan = nrpages - limit;
+	}
+	return nilfs_mdt_shrink_cache(inode, nr_to_scan);
+}
+
+/*
+ * Caches grown beyond their soft limit are trimmed down to the limit
+ * first.  Then, if more pages are requested, caches are scanned in the
+ * order of NILFS_MDT_CACHE_*, so that the DAT, whose entries are looked
+ * up at random, goes first and the small and hot SUFILE goes last.
+ */
+static unsigned long nilfs_mdt_shrinker_scan(struct shrinker *shrink,
+					     struct shrink_control *sc)
+{
+	struct the_nilfs *nilfs = container_of(shrink, struct the_nilfs,
+					       ns_mdt_shrinker);
+	unsigned long freed = 0, limit;
+	int type;
+
+	if (!(sc->gfp_mask & __GFP_FS))
+		return SHRINK_STOP;
+
+	for (type = 0; type < NILFS_MDT_CACHE_NR; type++) {
+		limit = READ_ONCE(nilfs->ns_mdt_soft_limit[type]);
+		if (limit)
+			freed += nilfs_mdt_shrink_type(nilfs, type, 0, limit);
+	}
+
+	for (type = 0; type < NILFS_MDT_CACHE_NR; type++) {
+		if (freed >= sc->nr_to_scan)
+			break;
+		freed += nilfs_mdt_shrink_type(nilfs, type,
+					       sc->nr_to_scan - freed, 0);
+	}
+
+	atomic_long_add(freed, &nilfs->ns_mdt_reclaimed);
+	return freed;
+}
+
+/**
+ * nilfs_mdt_register_shrinker - register shrinker of metadata file caches
+ * @nilfs: nilfs object whose metadata files have been loaded
+ *
+ * Return Value: On success, 0 is returned. On error, a negative error code
+ * is returned.
+ */
+int nilfs_mdt_register_shrinker(struct the_nilfs *nilfs)
+{
+	struct shrinker *shrink = &nilfs->ns_mdt_shrinker;
+
+	shrink->count_objects = nilfs_mdt_shrinker_count;
+	shrink->scan_objects = nilfs_mdt_shrinker_scan;
+	shrink->seeks = DEFAULT_SEEKS;
+	shrink->batch = NILFS_MDT_SHRINK_BATCH;
+
+	return register_shrinker(shrink, "nilfs-mdt:%s", nilfs->ns_sb->s_id);
+}
+
+/**
+ * nilfs_mdt_unregister_shrinker - unregister shrinker of metadata file caches
+ * @nilfs: nilfs object
+ */
+void nilfs_mdt_unregister_shrinker(struct the_nilfs *nilfs)
+{
+	unregister_shrinker(&nilfs->ns_mdt_shrinker);
+}
+
+/*
+ * Read-only views of metadata files
+ */
+
+/**
+ * nilfs_mdt_view_info - get the layout and generation of a metadata file
+ * @inode: inode of the metadata file
+ * @mv: view descriptor to fill in
+ *
+ * nilfs_mdt_view_info() stores the geometry of the metadata file, the size
+ * up to its last existing block, and its current generation in @mv.  The
+ * generation is maintained from the first call on.  It is sampled under
+ * the metadata file semaphore, so it never lands in the middle of an
+ * update of the SUFILE or CPFILE, which are only modified under the
+ * semaphore held for writing.
+ *
+ * Return Value: On success, 0 is returned. On error, a negative error code
+ * is returned.
+ */
+int nilfs_mdt_view_info(struct inode *inode, struct nilfs_mdt_view *mv)
+{
+	struct nilfs_mdt_info *mi = NILFS_MDT(inode);
+	__u64 last;
+	int ret;
+
+	if (!READ_ONCE(mi->mi_viewed))
+		WRITE_ONCE(mi->mi_viewed, true);
+
+	down_read(&mi->mi_sem);
+	mv->mv_generation = atomic64_read(&mi->mi_generation);
+	ret = nilfs_bmap_last_key(NILFS_I(inode)->i_bmap, &last);
+	up_read(&mi->mi_sem);
+
+	if (ret < 0 && ret != -ENOENT)
+		return ret;
+
+	mv->mv_size = ret ? 0 : (last + 1) << inode->i_blkbits;
+	mv->mv_ino = inode->i_ino;
+	mv->mv_flags = 0;
+	mv->mv_blocksize = i_blocksize(inode);
+	mv->mv_entry_size = mi->mi_entry_size;
+	mv->mv_first_entry_offset = mi->mi_first_entry_offset;
+	return 0;
+}
+
+/*
+ * Faults read the blocks of the page through the metadata file so that
+ * the page, its buffers and the readahead are exactly those the kernel
+ * itself would use.  Holes are cleared but left non-uptodate, as
+ * nilfs_mdt_insert_new_block() initializes them again when they are
+ * allocated.
+ */
+static vm_fault_t nilfs_mdt_view_fault(struct vm_fault *vmf)
+{
+	struct address_space *mapping = vmf->vma->vm_file->f_mapping;
+	struct inode *inode = mapping->host;
+	unsigned int shift = PAGE_SHIFT - inode->i_blkbits;
+	unsigned long blkoff = (unsigned long)vmf->pgoff << shift;
+	unsigned long i, nblocks = 1UL << shift;
+	struct buffer_head *bh, *head;
+	struct page *page;
+	__u64 last;
+	int err;
+
+	err = nilfs_bmap_last_key(NILFS_I(inode)->i_bmap, &last);
+	if (err == -ENOENT || (!err && blkoff > last))
+		return VM_FAULT_SIGBUS;
+	if (err)
+		return vmf_error(err);
+
+	for (i = 0; i < nblocks; i++) {
+		err = nilfs_mdt_get_block(inode, blkoff + i, 0, NULL, &bh);
+		if (!err)
+			brelse(bh);
+		else if (err != -ENOENT)
+			return vmf_error(err);
+	}
+
+	page = find_lock_page(mapping, vmf->pgoff);
+	if (!page)
+		return VM_FAULT_NOPAGE;	/* reclaimed meanwhile, refault */
+	if (!page_has_buffers(page)) {
+		unlock_page(page);
+		put_page(page);
+		return VM_FAULT_NOPAGE;
+	}
+
+	bh = head = page_buffers(page);
+	do {
+		lock_buffer(bh);
+		if (!buffer_uptodate(bh))
+			zero_user(page, bh_offset(bh), bh->b_size);
+		unlock_buffer(bh);
+		bh = bh->b_this_page;
+	} while (bh != head);
+
+	vmf->page = page;
+	return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct nilfs_mdt_view_vm_ops = {
+	.fault		= nilfs_mdt_view_fault,
+};
+
+static int nilfs_mdt_view_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+	vma->vm_ops = &nilfs_mdt_view_vm_ops;
+	return 0;
+}
+
+static long nilfs_mdt_view_ioctl(struct file *file, unsigned int cmd,
+				 unsigned long arg)
+{
+	struct nilfs_mdt_view mv;
+	int ret;
+
+	if (cmd != NILFS_IOCTL_GET_MDT_VIEW)
+		return -ENOTTY;
+
+	ret = nilfs_mdt_view_info(file->f_mapping->host, &mv);
+	if (ret < 0)
+		return ret;
+	if (copy_to_user((void __user *)arg, &mv, sizeof(mv)))
+		return -EFAULT;
+	return 0;
+}
+
+static int nilfs_mdt_view_release(struct inode *inode, struct file *file)
+{
+	mntput(file->private_data);
+	return 0;
+}
+
+static const struct file_operations nilfs_mdt_view_fops = {
+	.mmap		= nilfs_mdt_view_mmap,
+	.unlocked_ioctl	= nilfs_mdt_view_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.release	= nilfs_mdt_view_release,
+	.llseek		= noop_llseek,
+};
+
+/**
+ * nilfs_mdt_open_view - open a read-only view of a metadata file
+ * @inode: inode of the metadata file
+ * @mnt: mount of the file system, pinned while the view is open
+ *
+ * nilfs_mdt_open_view() creates an anonymous file whose mapping is the page
+ * cache of the metadata file, so that mmap() of the file maps the very pages
+ * the file system reads and updates, without copying.  The mappings are
+ * read-only; writable mappings are refused.
+ *
+ * Return Value: On success, the new file is returned. On error, an error
+ * pointer is returned.
+ */
+struct file *nilfs_mdt_open_view(struct inode *inode, struct vfsmount *mnt)
+{
+	struct file *file;
+
+	file = anon_inode_getfile("[nilfs-mdt]", &nilfs_mdt_view_fops,
+				  mntget(mnt), O_RDONLY);
+	if (IS_ERR(file)) {
+		mntput(mnt);
+		return file;
+	}
+	file->f_mapping = inode->i_mapping;
+	return file;
+}
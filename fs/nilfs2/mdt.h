@@ -38,6 +38,8 @@ struct nilfs_shadow_map {
  * @mi_shadow: shadow of bmap and page caches
  * @mi_blocks_per_group: number of blocks in a group
  * @mi_blocks_per_desc_block: number of blocks per descriptor block
+ * @mi_viewed: flag set once the file is exported to read-only views
+ * @mi_generation: modification counter exported to read-only views
  */
 struct nilfs_mdt_info {
 	struct rw_semaphore	mi_sem;
@@ -49,6 +51,8 @@ struct nilfs_mdt_info {
 	struct nilfs_shadow_map *mi_shadow;
 	unsigned long		mi_blocks_per_group;
 	unsigned long		mi_blocks_per_desc_block;
+	bool			mi_viewed;
+	atomic64_t		mi_generation;
 };
 
 static inline struct nilfs_mdt_info *NILFS_MDT(const struct inode *inode)
@@ -71,6 +75,10 @@ int nilfs_mdt_get_block(struct inode *, unsigned long, int,
 int nilfs_mdt_find_block(struct inode *inode, unsigned long start,
 			 unsigned long end, unsigned long *blkoff,
 			 struct buffer_head **out_bh);
+int nilfs_mdt_prefetch(struct inode *inode, __u64 *blkoff,
+		       unsigned long nblocks);
+void nilfs_mdt_readahead(struct inode *inode, const unsigned long *blkoffs,
+			 size_t nitems);
 int nilfs_mdt_delete_block(struct inode *, unsigned long);
 int nilfs_mdt_forget_block(struct inode *, unsigned long);
 int nilfs_mdt_fetch_dirty(struct inode *);
@@ -90,10 +98,32 @@ int nilfs_mdt_freeze_buffer(struct inode *inode, struct buffer_head *bh);
 struct buffer_head *nilfs_mdt_get_frozen_buffer(struct inode *inode,
 						struct buffer_head *bh);
 
+unsigned long nilfs_mdt_cache_nrpages(struct the_nilfs *nilfs, int type,
+				      bool btnode);
+int nilfs_mdt_register_shrinker(struct the_nilfs *nilfs);
+void nilfs_mdt_unregister_shrinker(struct the_nilfs *nilfs);
+
+int nilfs_mdt_view_info(struct inode *inode, struct nilfs_mdt_view *mv);
+struct file *nilfs_mdt_open_view(struct inode *inode, struct vfsmount *mnt);
+
+/*
+ * The generation is only maintained for metadata files that have been
+ * exported to read-only views, so that the counter is not bounced between
+ * CPUs for the ifiles and for files nobody looks at.
+ */
+static inline void nilfs_mdt_bump_generation(struct inode *inode)
+{
+	struct nilfs_mdt_info *mi = NILFS_MDT(inode);
+
+	if (unlikely(READ_ONCE(mi->mi_viewed)))
+		atomic64_inc(&mi->mi_generation);
+}
+
 static inline void nilfs_mdt_mark_dirty(struct inode *inode)
 {
 	if (!test_bit(NILFS_I_DIRTY, &NILFS_I(inode)->i_state))
 		set_bit(NILFS_I_DIRTY, &NILFS_I(inode)->i_state);
+	nilfs_mdt_bump_generation(inode);
 }
 
 static inline void nilfs_mdt_clear_dirty(struct inode *inode)
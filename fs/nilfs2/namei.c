@@ -25,8 +25,10 @@
  */
 
 #include <linux/pagemap.h>
+#include <linux/hash.h>
 #include "nilfs.h"
 #include "export.h"
+#include "cpfile.h"
 
 #define NILFS_FID_SIZE_NON_CONNECTABLE \
 	(offsetof(struct nilfs_fid, parent_gen) / 4)
@@ -455,16 +457,123 @@ static struct dentry *nilfs_get_parent(struct dentry *child)
 	return d_obtain_alias(inode);
 }
 
+/*
+ * NFS servers decode a file handle for every request, and handles of files
+ * in snapshots are decoded through the root object of the snapshot.  A
+ * small direct-mapped cache of snapshot inodes recently decoded keeps them
+ * from being looked up or read again.  Each entry pins the inode and its
+ * root object.  Entries are added only while the checkpoint is a snapshot,
+ * which is checked under ns_snapshot_mount_mutex, and dropped before the
+ * snapshot is changed back to a plain checkpoint.  Inodes of the current
+ * checkpoint are not cached since pinning them would delay the deletion of
+ * unlinked files.
+ */
+static struct nilfs_fh_cache_entry *
+nilfs_fh_cache_slot(struct the_nilfs *nilfs, __u64 cno, ino_t ino)
+{
+	return &nilfs->ns_fh_cache[hash_64(cno * 31 + ino,
+					   NILFS_FH_CACHE_BITS)];
+}
+
+static struct inode *nilfs_fh_cache_get(struct the_nilfs *nilfs, __u64 cno,
+					ino_t ino)
+{
+	struct nilfs_fh_cache_entry *ent = nilfs_fh_cache_slot(nilfs, cno, ino);
+	struct inode *inode = NULL;
+
+	spin_lock(&nilfs->ns_fh_cache_lock);
+	if (ent->inode && ent->cno == cno && ent->ino == ino)
+		inode = igrab(ent->inode);
+	spin_unlock(&nilfs->ns_fh_cache_lock);
+
+	return inode;
+}
+
+static void nilfs_fh_cache_put_entry(struct inode *inode)
+{
+	struct nilfs_root *root;
+
+	if (inode) {
+		root = NILFS_I(inode)->i_root;
+		iput(inode);
+		nilfs_put_root(root);
+	}
+}
+
+static void nilfs_fh_cache_add(struct the_nilfs *nilfs, __u64 cno,
+			       struct inode *inode)
+{
+	struct nilfs_fh_cache_entry *ent;
+	struct inode *old;
+	int ret;
+
+	mutex_lock(&nilfs->ns_snapshot_mount_mutex);
+	down_read(&nilfs->ns_segctor_sem);
+	ret = nilfs_cpfile_is_snapshot(nilfs->ns_cpfile, cno);
+	up_read(&nilfs->ns_segctor_sem);
+	if (ret <= 0) {
+		mutex_unlock(&nilfs->ns_snapshot_mount_mutex);
+		return;
+	}
+
+	ent = nilfs_fh_cache_slot(nilfs, cno, inode->i_ino);
+	ihold(inode);
+	nilfs_get_root(NILFS_I(inode)->i_root);
+
+	spin_lock(&nilfs->ns_fh_cache_lock);
+	old = ent->inode;
+	ent->cno = cno;
+	ent->ino = inode->i_ino;
+	ent->inode = inode;
+	spin_unlock(&nilfs->ns_fh_cache_lock);
+	mutex_unlock(&nilfs->ns_snapshot_mount_mutex);
+
+	nilfs_fh_cache_put_entry(old);
+}
+
+/**
+ * nilfs_fh_cache_forget - drop inodes cached for file handle decoding
+ * @nilfs: nilfs object
+ * @cno: checkpoint number of the snapshot, or 0 to drop all entries
+ */
+void nilfs_fh_cache_forget(struct the_nilfs *nilfs, __u64 cno)
+{
+	struct nilfs_fh_cache_entry *ent;
+	struct inode *inode;
+	int i;
+
+	for (i = 0; i < NILFS_FH_CACHE_SIZE; i++) {
+		ent = &nilfs->ns_fh_cache[i];
+
+		spin_lock(&nilfs->ns_fh_cache_lock);
+		inode = ent->inode;
+		if (inode && (!cno || ent->cno == cno))
+			ent->inode = NULL;
+		else
+			inode = NULL;
+		spin_unlock(&nilfs->ns_fh_cache_lock);
+
+		nilfs_fh_cache_put_entry(inode);
+	}
+}
+
 static struct dentry *nilfs_get_dentry(struct super_block *sb, u64 cno,
 				       u64 ino, u32 gen)
 {
+	struct the_nilfs *nilfs = sb->s_fs_info;
 	struct nilfs_root *root;
 	struct inode *inode;
 
 	if (ino < NILFS_FIRST_INO(sb) && ino != NILFS_ROOT_INO)
 		return ERR_PTR(-ESTALE);
 
-	root = nilfs_lookup_root(sb->s_fs_info, cno);
+	if (cno != NILFS_CPTREE_CURRENT_CNO) {
+		inode = nilfs_fh_cache_get(nilfs, cno, ino);
+		if (inode)
+			goto found;
+	}
+
+	root = nilfs_lookup_root(nilfs, cno);
 	if (!root)
 		return ERR_PTR(-ESTALE);
 
@@ -473,6 +582,9 @@ static struct dentry *nilfs_get_dentry(struct super_block *sb, u64 cno,
 
 	if (IS_ERR(inode))
 		return ERR_CAST(inode);
+	if (cno != NILFS_CPTREE_CURRENT_CNO)
+		nilfs_fh_cache_add(nilfs, cno, inode);
+ found:
 	if (gen && inode->i_generation != gen) {
 		iput(inode);
 		return ERR_PTR(-ESTALE);
@@ -19,6 +19,17 @@
 #include "the_nilfs.h"
 #include "bmap.h"
 
+/*
+ * Per-inode log statistics, counted while the inode is in memory
+ */
+enum {
+	NILFS_ISTAT_LOG_BLOCKS = 0,	/* blocks written to logs */
+	NILFS_ISTAT_GC_BLOCKS,		/* blocks relocated by GC */
+	NILFS_ISTAT_DAT_ALLOCS,		/* DAT entries allocated */
+	NILFS_ISTAT_DSYNC_LOGS,		/* data-sync logs written */
+	NILFS_ISTAT_NR,
+};
+
 /**
  * struct nilfs_inode_info - nilfs inode data in memory
  * @i_flags: inode flags
@@ -33,6 +44,7 @@
  * @xattr_sem: semaphore for extended attributes processing
  * @i_bh: buffer contains disk inode
  * @i_root: root object of the current filesystem tree
+ * @i_stats: log statistics of the inode (NILFS_ISTAT_*)
  * @vfs_inode: VFS inode object
  */
 struct nilfs_inode_info {
@@ -61,6 +73,9 @@ struct nilfs_inode_info {
 					 * disk inode.
 					 */
 	struct nilfs_root *i_root;
+#ifdef CONFIG_NILFS2_FS_INODE_STATS
+	atomic64_t i_stats[NILFS_ISTAT_NR];
+#endif
 	struct inode vfs_inode;
 };
 
@@ -75,6 +90,35 @@ NILFS_BMAP_I(const struct nilfs_bmap *bmap)
 	return container_of(bmap, struct nilfs_inode_info, i_bmap_data);
 }
 
+#ifdef CONFIG_NILFS2_FS_INODE_STATS
+static inline void nilfs_inode_stat_init(struct inode *inode)
+{
+	int i;
+
+	for (i = 0; i < NILFS_ISTAT_NR; i++)
+		atomic64_set(&NILFS_I(inode)->i_stats[i], 0);
+}
+
+static inline void nilfs_inode_stat_add(struct inode *inode, int item,
+					u64 n)
+{
+	atomic64_add(n, &NILFS_I(inode)->i_stats[item]);
+}
+
+static inline u64 nilfs_inode_stat_read(const struct inode *inode, int item)
+{
+	return atomic64_read(&NILFS_I(inode)->i_stats[item]);
+}
+#else
+static inline void nilfs_inode_stat_init(struct inode *inode) {}
+static inline void nilfs_inode_stat_add(struct inode *inode, int item,
+					u64 n) {}
+static inline u64 nilfs_inode_stat_read(const struct inode *inode, int item)
+{
+	return 0;
+}
+#endif
+
 /*
  * Dynamic state flags of NILFS on-memory inode (i_state)
  */
@@ -93,6 +137,11 @@ enum {
 	NILFS_I_GCINODE,		/* inode for GC, on memory only */
 	NILFS_I_BTNC,			/* inode for btree node cache */
 	NILFS_I_SHADOW,			/* inode for shadowed page cache */
+	NILFS_I_ORPHAN,			/* unlinked inode being purged */
+	NILFS_I_DSYNC_ISIZE,		/*
+					 * Inode is in the latest checkpoint
+					 * and has not been truncated since
+					 */
 };
 
 /*
@@ -214,6 +263,13 @@ static inline int nilfs_init_acl(struct inode *inode, struct inode *dir)
 	 FS_IMMUTABLE_FL | FS_APPEND_FL | FS_NODUMP_FL | FS_NOATIME_FL |\
 	 FS_COMPRBLK_FL | FS_NOCOMP_FL | FS_NOTAIL_FL | FS_DIRSYNC_FL)
 
+/*
+ * On-disk only flag of an unlinked inode whose blocks have not been
+ * released yet.  It is never exposed through the attribute interfaces,
+ * and is only recorded while NILFS_FEATURE_COMPAT_RO_ORPHANS is set.
+ */
+#define NILFS_ORPHAN_FL		0x80000000
+
 /* Mask out flags that are inappropriate for the given type of inode. */
 static inline __u32 nilfs_mask_flags(umode_t mode, __u32 flags)
 {
@@ -248,6 +304,8 @@ long nilfs_ioctl(struct file *, unsigned int, unsigned long);
 long nilfs_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 int nilfs_ioctl_prepare_clean_segments(struct the_nilfs *, struct nilfs_argv *,
 				       void **);
+int nilfs_ioctl_move_blocks(struct super_block *sb, struct nilfs_argv *argv,
+			    void *buf);
 
 /* inode.c */
 void nilfs_inode_add_blocks(struct inode *inode, int n);
@@ -265,11 +323,16 @@ struct inode *nilfs_iget(struct super_block *sb, struct nilfs_root *root,
 			 unsigned long ino);
 extern struct inode *nilfs_iget_for_gc(struct super_block *sb,
 				       unsigned long ino, __u64 cno);
+struct inode *nilfs_iget_orphan(struct super_block *sb, struct nilfs_root *root,
+				unsigned long ino);
 int nilfs_attach_btree_node_cache(struct inode *inode);
 void nilfs_detach_btree_node_cache(struct inode *inode);
+void nilfs_forget_snapshot_nodes(struct the_nilfs *nilfs, __u64 *vblocknrs,
+				 size_t nitems);
 struct inode *nilfs_iget_for_shadow(struct inode *inode);
 extern void nilfs_update_inode(struct inode *, struct buffer_head *, int);
 extern void nilfs_truncate(struct inode *);
+int nilfs_truncate_orphan(struct inode *inode, unsigned int nchunks);
 extern void nilfs_evict_inode(struct inode *);
 extern int nilfs_setattr(struct mnt_idmap *, struct dentry *,
 			 struct iattr *);
@@ -292,8 +355,31 @@ static inline int nilfs_mark_inode_dirty_sync(struct inode *inode)
 	return __nilfs_mark_inode_dirty(inode, I_DIRTY_SYNC);
 }
 
+/* evacuate.c */
+int nilfs_evacuate_segments(struct super_block *sb, __u64 newnsegs);
+
+/* scrub.c */
+#define NILFS_SCRUB_MAX_REPORTED	64	/* bad segments reported */
+#define NILFS_SCRUB_DEFAULT_RATE	10240	/* I/O budget in KiB/s */
+
+int nilfs_start_scrub(struct the_nilfs *nilfs);
+void nilfs_stop_scrub(struct the_nilfs *nilfs);
+void nilfs_destroy_scrub(struct the_nilfs *nilfs);
+bool nilfs_scrub_status(struct the_nilfs *nilfs, __u64 *segnump,
+			__u64 *bad, unsigned int *nbadp);
+
+/* orphan.c */
+void nilfs_orphan_purge_work(struct work_struct *work);
+bool nilfs_defer_orphan(struct inode *inode);
+void nilfs_start_orphan_purge(struct the_nilfs *nilfs);
+void nilfs_stop_orphan_purge(struct the_nilfs *nilfs);
+
+/* namei.c */
+void nilfs_fh_cache_forget(struct the_nilfs *nilfs, __u64 cno);
+
 /* super.c */
 extern struct inode *nilfs_alloc_inode(struct super_block *);
+void nilfs_free_inode(struct inode *inode);
 
 __printf(2, 3)
 void __nilfs_msg(struct super_block *sb, const char *fmt, ...);
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * NILFS orphan inode purger
+ *
+ * Releasing blocks of a huge file takes long since every removed block
+ * ends its DAT entry.  To avoid blocking the unlinking process in the
+ * inode eviction for that long, eviction of a large regular file with no
+ * links only marks the disk inode with NILFS_ORPHAN_FL, and the purger
+ * releases its blocks in the background a bounded number of chunks per
+ * transaction, so that the work is spread across logs.
+ *
+ * The read-only compatible feature NILFS_FEATURE_COMPAT_RO_ORPHANS is
+ * written to the super blocks before the first orphan is recorded, so
+ * that older kernels and tools do not take orphans for live files.  It
+ * also tells that orphans may have been left when the file system was
+ * unmounted or crashed; only then is the ifile scanned for them after a
+ * read/write mount, and the feature is dropped once a scan has purged
+ * all of them.
+ */
+
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "nilfs.h"
+#include "ifile.h"
+#include "segment.h"
+
+/* Files with at least this many blocks are purged in the background */
+#define NILFS_ORPHAN_MIN_BLOCKS		65536	/* 256MB for 4KB block */
+
+/* Chunks of NILFS_MAX_TRUNCATE_BLOCKS blocks released per transaction */
+#define NILFS_ORPHAN_PURGE_CHUNKS	4
+
+/* Inode numbers looked up at a time while scanning the ifile */
+#define NILFS_ORPHAN_SCAN_BATCH		4096
+
+/**
+ * struct nilfs_orphan - orphan inode queued for purging
+ * @list: entry of the_nilfs->ns_orphan_list
+ * @ino: inode number of the orphan
+ */
+struct nilfs_orphan {
+	struct list_head list;
+	ino_t ino;
+};
+
+/**
+ * nilfs_orphan_set_feature - set or clear the orphan feature in super blocks
+ * @nilfs: nilfs object
+ * @on: whether orphans may exist on disk
+ *
+ * nilfs->ns_sem must be locked for writing by the caller.
+ *
+ * Return Value: On success, 0 is returned. On error, a negative error code
+ * is returned.
+ */
+static int nilfs_orphan_set_feature(struct the_nilfs *nilfs, bool on)
+{
+	struct nilfs_super_block **sbp;
+	__u64 features;
+	int ret;
+
+	if (nilfs_has_orphans(nilfs) == on)
+		return 0;
+
+	sbp = nilfs_prepare_super(nilfs->ns_sb, 0);
+	if (unlikely(!sbp))
+		return -EIO;
+
+	features = le64_to_cpu(sbp[0]->s_feature_compat_ro);
+	if (on)
+		features |= NILFS_FEATURE_COMPAT_RO_ORPHANS;
+	else
+		features &= ~NILFS_FEATURE_COMPAT_RO_ORPHANS;
+	sbp[0]->s_feature_compat_ro = cpu_to_le64(features);
+	if (sbp[1])
+		sbp[1]->s_feature_compat_ro = sbp[0]->s_feature_compat_ro;
+
+	ret = nilfs_commit_super(nilfs->ns_sb, NILFS_SB_COMMIT_ALL);
+	if (!ret)
+		nilfs->ns_feature_compat_ro = features;
+	return ret;
+}
+
+/**
+ * nilfs_orphan_clear_feature - drop the orphan feature after a full scan
+ * @nilfs: nilfs object
+ *
+ * The deletion of purged orphans is written out first, so that no orphan
+ * is left on disk without the feature.  The feature is kept if an orphan
+ * has been queued meanwhile; queuing is serialized with this function by
+ * nilfs->ns_sem.
+ */
+static void nilfs_orphan_clear_feature(struct the_nilfs *nilfs)
+{
+	bool empty;
+	int ret;
+
+	ret = nilfs_construct_segment(nilfs->ns_sb);
+	if (ret < 0)
+		goto out;
+
+	down_write(&nilfs->ns_sem);
+	spin_lock(&nilfs->ns_orphan_lock);
+	empty = list_empty(&nilfs->ns_orphan_list);
+	spin_unlock(&nilfs->ns_orphan_lock);
+
+	ret = empty ? nilfs_orphan_set_feature(nilfs, false) : 0;
+	up_write(&nilfs->ns_sem);
+out:
+	if (ret < 0)
+		nilfs_warn(nilfs->ns_sb,
+			   "error %d clearing orphan feature", ret);
+}
+
+/**
+ * nilfs_purge_orphan - release blocks of an orphan inode and delete it
+ * @nilfs: nilfs object
+ * @root: root object of the current checkpoint
+ * @ino: inode number of the orphan
+ *
+ * The disk inode is deleted when the last reference to the orphan is
+ * dropped after all of its blocks have been released.  If the purger is
+ * stopped in the middle, the orphan is kept on disk and its purge is
+ * resumed after the next read/write mount.
+ *
+ * Return Value: false if the orphan may be left on disk, or true
+ * otherwise.
+ */
+static bool nilfs_purge_orphan(struct the_nilfs *nilfs,
+			       struct nilfs_root *root, ino_t ino)
+{
+	struct inode *inode;
+	int ret;
+
+	inode = nilfs_iget_orphan(nilfs->ns_sb, root, ino);
+	if (IS_ERR(inode)) {
+		ret = PTR_ERR(inode);
+		if (ret == -ESTALE)
+			return true;
+		if (ret != -EBUSY)
+			nilfs_warn(nilfs->ns_sb,
+				   "error %d getting orphan inode (ino=%lu)",
+				   ret, (unsigned long)ino);
+		return false;
+	}
+
+	do {
+		ret = nilfs_truncate_orphan(inode, NILFS_ORPHAN_PURGE_CHUNKS);
+		cond_resched();
+	} while (ret > 0 && nilfs_purging(nilfs));
+
+	if (ret < 0)
+		nilfs_warn(nilfs->ns_sb,
+			   "error %d purging orphan inode (ino=%lu)",
+			   ret, (unsigned long)ino);
+	iput(inode);
+	return ret == 0;
+}
+
+/**
+ * nilfs_orphan_purge_work - purge queued orphans and scan for others
+ * @work: work struct embedded in the_nilfs
+ */
+void nilfs_orphan_purge_work(struct work_struct *work)
+{
+	struct the_nilfs *nilfs = container_of(work, struct the_nilfs,
+					       ns_orphan_work);
+	struct nilfs_orphan *orphan;
+	struct nilfs_root *root;
+	bool scanning = nilfs->ns_orphan_scan_ino != 0, purged = true;
+	ino_t ino;
+	int ret;
+
+	root = nilfs_lookup_root(nilfs, NILFS_CPTREE_CURRENT_CNO);
+	if (!root)
+		return;
+
+	while (nilfs_purging(nilfs)) {
+		spin_lock(&nilfs->ns_orphan_lock);
+		orphan = list_first_entry_or_null(&nilfs->ns_orphan_list,
+						  struct nilfs_orphan, list);
+		if (orphan)
+			list_del(&orphan->list);
+		spin_unlock(&nilfs->ns_orphan_lock);
+
+		if (orphan) {
+			ino = orphan->ino;
+			kfree(orphan);
+		} else if (nilfs->ns_orphan_scan_ino) {
+			ino = nilfs->ns_orphan_scan_ino;
+			ret = nilfs_ifile_find_orphan(root->ifile, &ino,
+						      NILFS_ORPHAN_SCAN_BATCH);
+			if (ret == -EAGAIN) {
+				nilfs->ns_orphan_scan_ino = ino;
+				cond_resched();
+				continue;
+			}
+			if (ret < 0) {
+				if (ret != -ENOENT) {
+					nilfs_warn(nilfs->ns_sb,
+						   "error %d scanning orphan inodes",
+						   ret);
+					purged = false;
+				}
+				nilfs->ns_orphan_scan_ino = 0;
+				continue;
+			}
+			nilfs->ns_orphan_scan_ino = ino + 1;
+		} else {
+			break;
+		}
+
+		if (!nilfs_purge_orphan(nilfs, root, ino))
+			purged = false;
+	}
+
+	nilfs_put_root(root);
+
+	/* a finished scan that purged everything drops the feature */
+	if (scanning && purged && !nilfs->ns_orphan_scan_ino &&
+	    nilfs_purging(nilfs))
+		nilfs_orphan_clear_feature(nilfs);
+}
+
+/**
+ * nilfs_defer_orphan - hand over an unlinked inode to the orphan purger
+ * @inode: inode being evicted with no links
+ *
+ * nilfs_defer_orphan() is called in a transaction of the inode eviction.
+ * If it returns true, the caller must keep the disk inode and write it
+ * back so that NILFS_ORPHAN_FL set here is recorded.
+ *
+ * Return Value: true if blocks of @inode are released later by the orphan
+ * purger, or false if they must be released by the caller.
+ */
+bool nilfs_defer_orphan(struct inode *inode)
+{
+	struct the_nilfs *nilfs = inode->i_sb->s_fs_info;
+	struct nilfs_inode_info *ii = NILFS_I(inode);
+	struct nilfs_orphan *orphan;
+	__u64 last;
+
+	if (!S_ISREG(inode->i_mode) || IS_SYNC(inode) ||
+	    ii->i_root->cno != NILFS_CPTREE_CURRENT_CNO ||
+	    !test_bit(NILFS_I_BMAP, &ii->i_state) ||
+	    nilfs_bmap_last_key(ii->i_bmap, &last) < 0)
+		return false;
+
+	/* an interrupted purge is resumed after the next read/write mount */
+	if (test_bit(NILFS_I_ORPHAN, &ii->i_state))
+		return true;
+
+	if (last < NILFS_ORPHAN_MIN_BLOCKS)
+		return false;
+
+	orphan = kmalloc(sizeof(*orphan), GFP_NOFS);
+	if (!orphan)
+		return false;
+	orphan->ino = inode->i_ino;
+
+	/* the feature must be on disk before the orphan is */
+	down_write(&nilfs->ns_sem);
+	if (nilfs_orphan_set_feature(nilfs, true) < 0)
+		goto failed;
+
+	spin_lock(&nilfs->ns_orphan_lock);
+	if (!nilfs_purging(nilfs)) {
+		spin_unlock(&nilfs->ns_orphan_lock);
+		goto failed;
+	}
+	ii->i_flags |= NILFS_ORPHAN_FL;
+	list_add_tail(&orphan->list, &nilfs->ns_orphan_list);
+	queue_work(system_unbound_wq, &nilfs->ns_orphan_work);
+	spin_unlock(&nilfs->ns_orphan_lock);
+	up_write(&nilfs->ns_sem);
+
+	return true;
+
+failed:
+	up_write(&nilfs->ns_sem);
+	kfree(orphan);
+	return false;
+}
+
+/**
+ * nilfs_start_orphan_purge - start the orphan purger
+ * @nilfs: nilfs object mounted read/write
+ *
+ * The ifile is scanned for orphans left on disk only if the orphan
+ * feature is set.
+ */
+void nilfs_start_orphan_purge(struct the_nilfs *nilfs)
+{
+	bool scan = nilfs_has_orphans(nilfs);
+
+	nilfs->ns_orphan_scan_ino = scan ? NILFS_FIRST_INO(nilfs->ns_sb) : 0;
+
+	spin_lock(&nilfs->ns_orphan_lock);
+	set_nilfs_purging(nilfs);
+	if (scan)
+		queue_work(system_unbound_wq, &nilfs->ns_orphan_work);
+	spin_unlock(&nilfs->ns_orphan_lock);
+}
+
+/**
+ * nilfs_stop_orphan_purge - stop the orphan purger
+ * @nilfs: nilfs object
+ *
+ * Orphans whose blocks have not been released yet are left on disk and
+ * purged after the next read/write mount.
+ */
+void nilfs_stop_orphan_purge(struct the_nilfs *nilfs)
+{
+	struct nilfs_orphan *orphan, *n;
+	LIST_HEAD(list);
+
+	spin_lock(&nilfs->ns_orphan_lock);
+	clear_nilfs_purging(nilfs);
+	list_splice_init(&nilfs->ns_orphan_list, &list);
+	spin_unlock(&nilfs->ns_orphan_lock);
+
+	cancel_work_sync(&nilfs->ns_orphan_work);
+
+	list_for_each_entry_safe(orphan, n, &list, list)
+		kfree(orphan);
+}
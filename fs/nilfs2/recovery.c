@@ -177,7 +177,7 @@ int nilfs_read_super_root_block(struct the_nilfs *nilfs, sector_t sr_block,
  * @start_blocknr: start block number of the log
  * @sum: pointer to return segment summary structure
  */
-static struct buffer_head *
+struct buffer_head *
 nilfs_read_log_header(struct the_nilfs *nilfs, sector_t start_blocknr,
 		      struct nilfs_segment_summary **sum)
 {
@@ -196,9 +196,9 @@ nilfs_read_log_header(struct the_nilfs *nilfs, sector_t start_blocknr,
  * @bh_sum: buffer head of summary block
  * @sum: segment summary struct
  */
-static int nilfs_validate_log(struct the_nilfs *nilfs, u64 seg_seq,
-			      struct buffer_head *bh_sum,
-			      struct nilfs_segment_summary *sum)
+int nilfs_validate_log(struct the_nilfs *nilfs, u64 seg_seq,
+		       struct buffer_head *bh_sum,
+		       struct nilfs_segment_summary *sum)
 {
 	unsigned long nblock;
 	u32 crc;
@@ -239,9 +239,9 @@ static int nilfs_validate_log(struct the_nilfs *nilfs, u64 seg_seq,
  * @offset: the current byte offset on summary blocks [in, out]
  * @bytes: byte size of the item to be read
  */
-static void *nilfs_read_summary_info(struct the_nilfs *nilfs,
-				     struct buffer_head **pbh,
-				     unsigned int *offset, unsigned int bytes)
+void *nilfs_read_summary_info(struct the_nilfs *nilfs,
+			      struct buffer_head **pbh,
+			      unsigned int *offset, unsigned int bytes)
 {
 	void *ptr;
 	sector_t blocknr;
@@ -261,6 +261,54 @@ static void *nilfs_read_summary_info(struct the_nilfs *nilfs,
 	return ptr;
 }
 
+/**
+ * nilfs_read_data_binfo - read information on data blocks of a file
+ * @nilfs: nilfs object
+ * @pbh: the current buffer head on summary blocks [in, out]
+ * @offset: the current byte offset on summary blocks [in, out]
+ * @flags: flags of the segment summary
+ * @ndatablk: number of data blocks of the file not read yet
+ * @vblocknr: place to store the virtual block number of the first block
+ * @blkoff: place to store the block offset of the first block
+ *
+ * nilfs_read_data_binfo() reads a nilfs_binfo_run structure if @flags has
+ * NILFS_SS_BINFO_RUN, or a nilfs_binfo_v structure otherwise.  This must
+ * not be used for the DAT.
+ *
+ * Return Value: number of consecutive data blocks described by the item,
+ * or 0 if the item could not be read or is broken.
+ */
+unsigned long nilfs_read_data_binfo(struct the_nilfs *nilfs,
+				    struct buffer_head **pbh,
+				    unsigned int *offset, unsigned int flags,
+				    unsigned long ndatablk, __u64 *vblocknr,
+				    __u64 *blkoff)
+{
+	struct nilfs_binfo_run *run;
+	struct nilfs_binfo_v *binfo;
+	unsigned long count;
+
+	if (!(flags & NILFS_SS_BINFO_RUN)) {
+		binfo = nilfs_read_summary_info(nilfs, pbh, offset,
+						sizeof(*binfo));
+		if (unlikely(!binfo))
+			return 0;
+		*vblocknr = le64_to_cpu(binfo->bi_vblocknr);
+		*blkoff = le64_to_cpu(binfo->bi_blkoff);
+		return 1;
+	}
+
+	run = nilfs_read_summary_info(nilfs, pbh, offset, sizeof(*run));
+	if (unlikely(!run))
+		return 0;
+	count = le32_to_cpu(run->bi_count);
+	if (unlikely(count > ndatablk))
+		return 0;
+	*vblocknr = le64_to_cpu(run->bi_vblocknr);
+	*blkoff = le64_to_cpu(run->bi_blkoff);
+	return count;
+}
+
 /**
  * nilfs_skip_summary_info - skip items on summary blocks of a log
  * @nilfs: nilfs object
@@ -306,12 +354,13 @@ static int nilfs_scan_dsync_log(struct the_nilfs *nilfs, sector_t start_blocknr,
 				struct list_head *head)
 {
 	struct buffer_head *bh;
-	unsigned int offset;
+	unsigned int offset, flags;
 	u32 nfinfo, sumbytes;
 	sector_t blocknr;
 	ino_t ino;
 	int err = -EIO;
 
+	flags = le16_to_cpu(sum->ss_flags);
 	nfinfo = le32_to_cpu(sum->ss_nfinfo);
 	if (!nfinfo)
 		return 0;
@@ -337,26 +386,31 @@ static int nilfs_scan_dsync_log(struct the_nilfs *nilfs, sector_t start_blocknr,
 		ndatablk = le32_to_cpu(finfo->fi_ndatablk);
 		nnodeblk = nblocks - ndatablk;
 
-		while (ndatablk-- > 0) {
+		while (ndatablk > 0) {
 			struct nilfs_recovery_block *rb;
-			struct nilfs_binfo_v *binfo;
-
-			binfo = nilfs_read_summary_info(nilfs, &bh, &offset,
-							sizeof(*binfo));
-			if (unlikely(!binfo))
-				goto out;
+			unsigned long count;
+			__u64 vblocknr, blkoff;
 
-			rb = kmalloc(sizeof(*rb), GFP_NOFS);
-			if (unlikely(!rb)) {
-				err = -ENOMEM;
+			count = nilfs_read_data_binfo(nilfs, &bh, &offset,
+						      flags, ndatablk,
+						      &vblocknr, &blkoff);
+			if (unlikely(!count))
 				goto out;
+			ndatablk -= count;
+
+			while (count-- > 0) {
+				rb = kmalloc(sizeof(*rb), GFP_NOFS);
+				if (unlikely(!rb)) {
+					err = -ENOMEM;
+					goto out;
+				}
+				rb->ino = ino;
+				rb->blocknr = blocknr++;
+				rb->vblocknr = vblocknr++;
+				rb->blkoff = blkoff++;
+				/* INIT_LIST_HEAD(&rb->list); */
+				list_add_tail(&rb->list, head);
 			}
-			rb->ino = ino;
-			rb->blocknr = blocknr++;
-			rb->vblocknr = le64_to_cpu(binfo->bi_vblocknr);
-			rb->blkoff = le64_to_cpu(binfo->bi_blkoff);
-			/* INIT_LIST_HEAD(&rb->list); */
-			list_add_tail(&rb->list, head);
 		}
 		if (--nfinfo == 0)
 			break;
@@ -506,6 +560,13 @@ static int nilfs_recover_dsync_blocks(struct the_nilfs *nilfs,
 		if (IS_ERR(inode)) {
 			err = PTR_ERR(inode);
 			inode = NULL;
+			if (err == -ENOENT || err == -ESTALE) {
+				/* not in the checkpoint, nothing to recover */
+				nilfs_warn(sb,
+					   "skipped data block of missing inode (ino=%lu)",
+					   (unsigned long)rb->ino);
+				goto next;
+			}
 			goto failed_inode;
 		}
 
@@ -557,6 +618,42 @@ static int nilfs_recover_dsync_blocks(struct the_nilfs *nilfs,
 	return err2;
 }
 
+/**
+ * nilfs_recover_dsync_isize - restore the file size recorded in dsync logs
+ * @sb: super block instance
+ * @root: NILFS root instance
+ * @ino: inode number of the file
+ * @isize: file size recorded in the last log of the logical segment
+ */
+static int nilfs_recover_dsync_isize(struct super_block *sb,
+				     struct nilfs_root *root, ino_t ino,
+				     loff_t isize)
+{
+	struct nilfs_transaction_info ti;
+	struct inode *inode;
+
+	inode = nilfs_iget(sb, root, ino);
+	if (IS_ERR(inode)) {
+		nilfs_warn(sb, "error %ld recovering file size (ino=%lu)",
+			   PTR_ERR(inode), (unsigned long)ino);
+		if (PTR_ERR(inode) == -ENOENT || PTR_ERR(inode) == -ESTALE)
+			return 0;	/* not in the checkpoint, skip it */
+		return PTR_ERR(inode);
+	}
+
+	if (isize < inode->i_size) {
+		truncate_setsize(inode, isize);
+		nilfs_truncate(inode);
+	} else if (isize > inode->i_size) {
+		nilfs_transaction_begin(sb, &ti, 0);
+		i_size_write(inode, isize);
+		nilfs_mark_inode_dirty(inode);
+		nilfs_transaction_commit(sb);
+	}
+	iput(inode);
+	return 0;
+}
+
 /**
  * nilfs_do_roll_forward - salvage logical segments newer than the latest
  * checkpoint
@@ -580,6 +677,10 @@ static int nilfs_do_roll_forward(struct the_nilfs *nilfs,
 	int empty_seg = 0;
 	int err = 0, ret;
 	LIST_HEAD(dsync_blocks);  /* list of data blocks to be recovered */
+	struct nilfs_segsum_isize *isize_rec;
+	ino_t isize_ino = 0;	/* file whose size was recorded, if any */
+	loff_t isize = 0;
+	bool isize_recovered = false;
 	enum {
 		RF_INIT_ST,
 		RF_DSYNC_ST,   /* scanning data-sync segments */
@@ -613,6 +714,7 @@ static int nilfs_do_roll_forward(struct the_nilfs *nilfs,
 			goto confused;
 
 		/* Found a valid partial segment; do recovery actions */
+		ri->ri_nscanned_logs++;
 		nextnum = nilfs_get_segnum_of_block(nilfs,
 						    le64_to_cpu(sum->ss_next));
 		empty_seg = 0;
@@ -635,12 +737,27 @@ static int nilfs_do_roll_forward(struct the_nilfs *nilfs,
 						   &dsync_blocks);
 			if (unlikely(err))
 				goto failed;
+			if ((flags & NILFS_SS_ISIZE) &&
+			    le16_to_cpu(sum->ss_bytes) >=
+			    sizeof(*sum) + sizeof(*isize_rec)) {
+				isize_rec = (struct nilfs_segsum_isize *)(sum + 1);
+				isize_ino = le64_to_cpu(isize_rec->si_ino);
+				isize = le64_to_cpu(isize_rec->si_size);
+			}
 			if (flags & NILFS_SS_LOGEND) {
 				err = nilfs_recover_dsync_blocks(
 					nilfs, sb, root, &dsync_blocks,
 					&nsalvaged_blocks);
 				if (unlikely(err))
 					goto failed;
+				if (isize_ino) {
+					err = nilfs_recover_dsync_isize(
+						sb, root, isize_ino, isize);
+					if (unlikely(err))
+						goto failed;
+					isize_ino = 0;
+					isize_recovered = true;
+				}
 				state = RF_INIT_ST;
 			}
 			break; /* Fall through to try_next_pseg */
@@ -670,8 +787,10 @@ static int nilfs_do_roll_forward(struct the_nilfs *nilfs,
 
 	if (nsalvaged_blocks) {
 		nilfs_info(sb, "salvaged %lu blocks", nsalvaged_blocks);
-		ri->ri_need_recovery = NILFS_RECOVERY_ROLLFORWARD_DONE;
+		ri->ri_nsalvaged_blocks = nsalvaged_blocks;
 	}
+	if (nsalvaged_blocks || isize_recovered)
+		ri->ri_need_recovery = NILFS_RECOVERY_ROLLFORWARD_DONE;
  out:
 	brelse(bh_sum);
 	dispose_recovery_list(&dsync_blocks);
@@ -846,6 +965,7 @@ int nilfs_search_super_root(struct the_nilfs *nilfs,
 		}
 
 		/* A valid partial segment */
+		ri->ri_nscanned_logs++;
 		ri->ri_pseg_start = pseg_start;
 		ri->ri_seq = seg_seq;
 		ri->ri_segnum = segnum;
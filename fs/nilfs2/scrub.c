@@ -0,0 +1,483 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * NILFS background scrubber
+ *
+ * Checksums of logs are verified only by the recovery, so corruption of
+ * data at rest is found only when the data is read.  The scrubber walks
+ * the in-use segments in device order, reads the written part of each
+ * segment with large sequential reads, and verifies the summary and data
+ * checksums of every log in it.  A segment with a broken or unreadable log
+ * is marked erroneous in the sufile and reported through sysfs.
+ *
+ * The scrubber is started and stopped through sysfs, and its reads are
+ * paced to an I/O budget by delaying the work between segments.
+ */
+
+#include <linux/bio.h>
+#include <linux/crc32.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "nilfs.h"
+#include "segment.h"
+#include "sufile.h"
+
+/* Pages read at a time */
+#define NILFS_SCRUB_WINDOW_PAGES	BIO_MAX_VECS
+
+/**
+ * struct nilfs_scrub - state of the background scrubber
+ * @nilfs: nilfs object
+ * @work: delayed work scrubbing a segment per run
+ * @running: flag set while a pass is in progress
+ * @segnum: next segment number to be scrubbed
+ * @nbad: number of bad segments found
+ * @bad: segment numbers of the first bad segments found
+ * @pages: read buffer, allocated while a segment is verified
+ */
+struct nilfs_scrub {
+	struct the_nilfs *nilfs;
+	struct delayed_work work;
+	bool running;
+	__u64 segnum;
+	unsigned int nbad;
+	__u64 bad[NILFS_SCRUB_MAX_REPORTED];
+	struct page *pages[NILFS_SCRUB_WINDOW_PAGES];
+};
+
+/**
+ * struct nilfs_scrub_log - checksum state of the log being verified
+ * @seq: sequence number of the segment
+ * @nlogs: number of logs verified in the segment
+ * @nblocks: number of blocks left in the log
+ * @sumbytes: number of summary bytes left in the log
+ * @datasum: recorded checksum of the log
+ * @sumsum: recorded checksum of the summary
+ * @crc_data: checksum of the log computed so far
+ * @crc_sum: checksum of the summary computed so far
+ */
+struct nilfs_scrub_log {
+	u64 seq;
+	unsigned int nlogs;
+	unsigned long nblocks;
+	unsigned long sumbytes;
+	u32 datasum;
+	u32 sumsum;
+	u32 crc_data;
+	u32 crc_sum;
+};
+
+/**
+ * nilfs_scrub_block - feed a block to the checksum verification
+ * @nilfs: nilfs object
+ * @log: checksum state
+ * @data: contents of the block
+ * @nleft: number of blocks left in the segment including this one
+ *
+ * Return Value: 0 if the block has been accepted, 1 if no log begins at
+ * the block where one would, or %-EBADMSG if the block ends a log whose
+ * checksums do not match.
+ */
+static int nilfs_scrub_block(struct the_nilfs *nilfs,
+			     struct nilfs_scrub_log *log, const void *data,
+			     unsigned long nleft)
+{
+	const struct nilfs_segment_summary *sum = data;
+	unsigned int blocksize = nilfs->ns_blocksize;
+	unsigned long n;
+
+	if (!log->nblocks) {
+		n = le32_to_cpu(sum->ss_sumbytes);
+		log->nblocks = le32_to_cpu(sum->ss_nblocks);
+		if (le32_to_cpu(sum->ss_magic) != NILFS_SEGSUM_MAGIC ||
+		    (log->nlogs && le64_to_cpu(sum->ss_seq) != log->seq) ||
+		    !log->nblocks || log->nblocks > nleft ||
+		    n < le16_to_cpu(sum->ss_bytes) ||
+		    n > ((u64)log->nblocks << nilfs->ns_blocksize_bits)) {
+			log->nblocks = 0;
+			return 1;
+		}
+
+		log->seq = le64_to_cpu(sum->ss_seq);
+		log->nlogs++;
+		log->datasum = le32_to_cpu(sum->ss_datasum);
+		log->sumsum = le32_to_cpu(sum->ss_sumsum);
+		log->crc_data = crc32_le(nilfs->ns_crc_seed,
+					 data + sizeof(sum->ss_datasum),
+					 blocksize - sizeof(sum->ss_datasum));
+		log->sumbytes = n;
+		n = min_t(unsigned long, log->sumbytes, blocksize);
+		log->crc_sum = crc32_le(nilfs->ns_crc_seed,
+					data + sizeof(sum->ss_datasum) +
+					sizeof(sum->ss_sumsum),
+					n - (sizeof(sum->ss_datasum) +
+					     sizeof(sum->ss_sumsum)));
+		log->sumbytes -= n;
+	} else {
+		log->crc_data = crc32_le(log->crc_data, data, blocksize);
+		if (log->sumbytes) {
+			n = min_t(unsigned long, log->sumbytes, blocksize);
+			log->crc_sum = crc32_le(log->crc_sum, data, n);
+			log->sumbytes -= n;
+		}
+	}
+
+	if (--log->nblocks)
+		return 0;
+	if (log->crc_data != log->datasum || log->crc_sum != log->sumsum)
+		return -EBADMSG;
+	return 0;
+}
+
+/**
+ * nilfs_scrub_read - read consecutive blocks into pages
+ * @nilfs: nilfs object
+ * @pages: array of pages
+ * @npages: number of pages to be read
+ * @blocknr: disk block number of the first block
+ */
+static int nilfs_scrub_read(struct the_nilfs *nilfs, struct page **pages,
+			    unsigned int npages, sector_t blocknr)
+{
+	sector_t sector = blocknr << (nilfs->ns_blocksize_bits - 9);
+	struct bio *bio = NULL;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < npages; i++) {
+		if (bio && bio_add_page(bio, pages[i], PAGE_SIZE, 0))
+			continue;
+		bio = blk_next_bio(bio, nilfs->ns_bdev,
+				   min_t(unsigned int, npages - i, BIO_MAX_VECS),
+				   REQ_OP_READ, GFP_KERNEL);
+		bio->bi_iter.bi_sector = sector + (i << (PAGE_SHIFT - 9));
+		__bio_add_page(bio, pages[i], PAGE_SIZE, 0);
+	}
+	ret = submit_bio_wait(bio);
+	bio_put(bio);
+	return ret;
+}
+
+/**
+ * nilfs_scrub_verify - verify checksums of the logs in a segment
+ * @nilfs: nilfs object
+ * @pages: array of NILFS_SCRUB_WINDOW_PAGES pages used as read buffer
+ * @segnum: segment number
+ * @min_blocks: number of blocks known to be written in the segment
+ * @nread: place to store the number of blocks read
+ *
+ * Logs are followed from the head of the segment while they are valid and
+ * share the sequence number of the first one, as the recovery does.  The
+ * number of written blocks recorded in the sufile is only a lower bound of
+ * the end of the logs, since the cleaner may have lowered it to the number
+ * of live blocks.  So only logs beginning within @min_blocks must be
+ * intact; the logs are considered to end at the first broken or unreadable
+ * log past it.
+ *
+ * Return Value: 0 if all the logs are intact, %-EBADMSG if a log is
+ * broken, or %-EIO if the segment could not be read.
+ */
+static int nilfs_scrub_verify(struct the_nilfs *nilfs, struct page **pages,
+			      __u64 segnum, unsigned long min_blocks,
+			      unsigned long *nread)
+{
+	unsigned int bits = PAGE_SHIFT - nilfs->ns_blocksize_bits;
+	struct nilfs_scrub_log log = {};
+	unsigned long i, j, n, nblocks, log_start = 0;
+	sector_t start, end;
+	void *kaddr;
+	int ret;
+
+	nilfs_get_segment_range(nilfs, segnum, &start, &end);
+	nblocks = end - start + 1;
+	*nread = 0;
+
+	for (i = 0; i < nblocks; i += n) {
+		/* reads never straddle the end of the known written blocks */
+		n = i < min_blocks ? min_blocks - i : nblocks - i;
+		n = min_t(unsigned long, n, NILFS_SCRUB_WINDOW_PAGES << bits);
+		ret = nilfs_scrub_read(nilfs, pages,
+				       DIV_ROUND_UP(n, 1UL << bits),
+				       start + i);
+		if (ret)
+			return i < min_blocks ? -EIO : 0;
+		*nread += n;
+
+		for (j = 0; j < n; j++) {
+			if (!log.nblocks)
+				log_start = i + j;
+			kaddr = kmap_local_page(pages[j >> bits]);
+			ret = nilfs_scrub_block(nilfs, &log, kaddr +
+						((j << nilfs->ns_blocksize_bits) &
+						 ~PAGE_MASK),
+						nblocks - i - j);
+			kunmap_local(kaddr);
+			if (ret == 1 && log_start >= min_blocks)
+				return 0;	/* end of logs */
+			if (ret)
+				return log_start < min_blocks ? -EBADMSG : 0;
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+/**
+ * nilfs_scrub_get_suinfo - get usage of a segment to be scrubbed
+ * @nilfs: nilfs object
+ * @segnum: segment number
+ * @si: place to store the segment usage
+ *
+ * Return Value: true if the segment is in use and not being written.
+ */
+static bool nilfs_scrub_get_suinfo(struct the_nilfs *nilfs, __u64 segnum,
+				   struct nilfs_suinfo *si)
+{
+	ssize_t n;
+
+	down_read(&nilfs->ns_segctor_sem);
+	n = nilfs_sufile_get_suinfo(nilfs->ns_sufile, segnum, si, sizeof(*si),
+				    1);
+	up_read(&nilfs->ns_segctor_sem);
+
+	return n == 1 && nilfs_suinfo_dirty(si) && !nilfs_suinfo_active(si) &&
+		!nilfs_suinfo_error(si) && si->sui_nblocks;
+}
+
+/**
+ * nilfs_scrub_mark_bad - mark a segment erroneous and report it
+ * @scrub: scrubber
+ * @segnum: segment number
+ * @err: error found in the segment
+ */
+static void nilfs_scrub_mark_bad(struct nilfs_scrub *scrub, __u64 segnum,
+				 int err)
+{
+	struct the_nilfs *nilfs = scrub->nilfs;
+	struct super_block *sb = nilfs->ns_sb;
+	struct nilfs_transaction_info ti;
+	int ret;
+
+	nilfs_warn(sb, "scrub: %s in segment %llu",
+		   err == -EIO ? "read error" : "checksum error",
+		   (unsigned long long)segnum);
+
+	ret = nilfs_transaction_begin(sb, &ti, 0);
+	if (!ret) {
+		ret = nilfs_sufile_set_error(nilfs->ns_sufile, segnum);
+		if (!ret)
+			ret = nilfs_transaction_commit(sb);
+		else
+			nilfs_transaction_abort(sb);
+	}
+	if (ret)
+		nilfs_warn(sb, "error %d marking segment %llu erroneous",
+			   ret, (unsigned long long)segnum);
+
+	if (scrub->nbad < NILFS_SCRUB_MAX_REPORTED)
+		scrub->bad[scrub->nbad] = segnum;
+	scrub->nbad++;
+}
+
+/**
+ * nilfs_scrub_segment - scrub a segment
+ * @scrub: scrubber
+ * @segnum: segment number
+ *
+ * Segments that are clean, being written, or already marked erroneous are
+ * skipped.  A broken log found in a segment is reported only if the
+ * segment has not been reclaimed and rewritten during the verification.
+ *
+ * Return Value: number of bytes read, or %-ENOMEM if the read buffer could
+ * not be allocated.
+ */
+static ssize_t nilfs_scrub_segment(struct nilfs_scrub *scrub, __u64 segnum)
+{
+	struct the_nilfs *nilfs = scrub->nilfs;
+	struct page **pages = scrub->pages;
+	struct nilfs_suinfo si, si2;
+	unsigned long nblocks, nread = 0;
+	unsigned int i;
+	int ret = 0;
+
+	if (!nilfs_scrub_get_suinfo(nilfs, segnum, &si))
+		return 0;
+	nblocks = min_t(unsigned long, si.sui_nblocks,
+			nilfs->ns_blocks_per_segment);
+	if (segnum == 0)
+		nblocks = min_t(unsigned long, nblocks,
+				nilfs->ns_blocks_per_segment -
+				nilfs->ns_first_data_block);
+
+	for (i = 0; i < NILFS_SCRUB_WINDOW_PAGES; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			break;
+		}
+	}
+	if (!ret)
+		ret = nilfs_scrub_verify(nilfs, pages, segnum, nblocks,
+					 &nread);
+	while (i--)
+		__free_page(pages[i]);
+
+	if (ret == -ENOMEM)
+		return ret;
+	if (ret && nilfs_scrub_get_suinfo(nilfs, segnum, &si2) &&
+	    si2.sui_lastmod == si.sui_lastmod &&
+	    si2.sui_nblocks == si.sui_nblocks)
+		nilfs_scrub_mark_bad(scrub, segnum, ret);
+
+	return (ssize_t)nread << nilfs->ns_blocksize_bits;
+}
+
+static void nilfs_scrub_work(struct work_struct *work)
+{
+	struct nilfs_scrub *scrub = container_of(to_delayed_work(work),
+						 struct nilfs_scrub, work);
+	struct the_nilfs *nilfs = scrub->nilfs;
+	unsigned long rate, delay = 0;
+	ssize_t nbytes;
+
+	if (!READ_ONCE(scrub->running))
+		return;
+
+	if (sb_rdonly(nilfs->ns_sb)) {
+		WRITE_ONCE(scrub->running, false);
+		return;
+	}
+	if (scrub->segnum >= nilfs->ns_nsegments) {
+		nilfs_info(nilfs->ns_sb,
+			   "scrub finished: %u bad segment(s) found",
+			   scrub->nbad);
+		WRITE_ONCE(scrub->running, false);
+		return;
+	}
+
+	nbytes = nilfs_scrub_segment(scrub, scrub->segnum);
+	if (nbytes < 0) {
+		/* retry the segment later */
+		delay = HZ;
+	} else {
+		WRITE_ONCE(scrub->segnum, scrub->segnum + 1);
+		rate = READ_ONCE(nilfs->ns_scrub_rate);
+		if (rate && nbytes)
+			delay = DIV_ROUND_UP_ULL((u64)nbytes * HZ,
+						 (u64)rate << 10);
+	}
+	queue_delayed_work(system_unbound_wq, &scrub->work, delay);
+}
+
+/**
+ * nilfs_start_scrub - start a pass of the scrubber
+ * @nilfs: nilfs object
+ *
+ * A pass in progress is continued; otherwise a new pass is started from
+ * the first segment.
+ *
+ * Return Value: On success, 0 is returned.  On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EROFS - The file system is read-only or being unmounted.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ */
+int nilfs_start_scrub(struct the_nilfs *nilfs)
+{
+	struct super_block *sb = nilfs->ns_sb;
+	struct nilfs_scrub *scrub;
+
+	mutex_lock(&nilfs->ns_scrub_mutex);
+	/* nilfs_put_super() is called after SB_ACTIVE is cleared */
+	if (sb_rdonly(sb) || !(sb->s_flags & SB_ACTIVE)) {
+		mutex_unlock(&nilfs->ns_scrub_mutex);
+		return -EROFS;
+	}
+	scrub = nilfs->ns_scrub;
+	if (!scrub) {
+		scrub = kzalloc(sizeof(*scrub), GFP_KERNEL);
+		if (!scrub) {
+			mutex_unlock(&nilfs->ns_scrub_mutex);
+			return -ENOMEM;
+		}
+		scrub->nilfs = nilfs;
+		INIT_DELAYED_WORK(&scrub->work, nilfs_scrub_work);
+		nilfs->ns_scrub = scrub;
+	}
+	if (!READ_ONCE(scrub->running)) {
+		/* wait for the last run of a finished pass */
+		cancel_delayed_work_sync(&scrub->work);
+		scrub->segnum = 0;
+		scrub->nbad = 0;
+		WRITE_ONCE(scrub->running, true);
+		queue_delayed_work(system_unbound_wq, &scrub->work, 0);
+	}
+	mutex_unlock(&nilfs->ns_scrub_mutex);
+	return 0;
+}
+
+/**
+ * nilfs_stop_scrub - stop the scrubber
+ * @nilfs: nilfs object
+ *
+ * The results of the interrupted pass are kept for reporting.
+ */
+void nilfs_stop_scrub(struct the_nilfs *nilfs)
+{
+	struct nilfs_scrub *scrub;
+
+	mutex_lock(&nilfs->ns_scrub_mutex);
+	scrub = nilfs->ns_scrub;
+	if (scrub) {
+		WRITE_ONCE(scrub->running, false);
+		cancel_delayed_work_sync(&scrub->work);
+	}
+	mutex_unlock(&nilfs->ns_scrub_mutex);
+}
+
+/**
+ * nilfs_destroy_scrub - stop the scrubber and free its state
+ * @nilfs: nilfs object
+ */
+void nilfs_destroy_scrub(struct the_nilfs *nilfs)
+{
+	nilfs_stop_scrub(nilfs);
+	kfree(nilfs->ns_scrub);
+	nilfs->ns_scrub = NULL;
+}
+
+/**
+ * nilfs_scrub_status - get the state of the scrubber
+ * @nilfs: nilfs object
+ * @segnump: place to store the next segment number to be scrubbed
+ * @bad: array to store the numbers of bad segments found, or NULL
+ * @nbadp: place to store the number of bad segments found
+ *
+ * @bad must have room for NILFS_SCRUB_MAX_REPORTED entries; the numbers of
+ * bad segments found after that are not reported.
+ *
+ * Return Value: true if a pass is in progress.
+ */
+bool nilfs_scrub_status(struct the_nilfs *nilfs, __u64 *segnump,
+			__u64 *bad, unsigned int *nbadp)
+{
+	struct nilfs_scrub *scrub;
+	bool running = false;
+
+	*segnump = 0;
+	*nbadp = 0;
+	mutex_lock(&nilfs->ns_scrub_mutex);
+	scrub = nilfs->ns_scrub;
+	if (scrub) {
+		running = READ_ONCE(scrub->running);
+		*segnump = READ_ONCE(scrub->segnum);
+		*nbadp = READ_ONCE(scrub->nbad);
+		if (bad)
+			memcpy(bad, scrub->bad,
+			       min_t(unsigned int, *nbadp,
+				     NILFS_SCRUB_MAX_REPORTED) * sizeof(*bad));
+	}
+	mutex_unlock(&nilfs->ns_scrub_mutex);
+	return running;
+}
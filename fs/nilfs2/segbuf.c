@@ -25,11 +25,13 @@ struct nilfs_write_info {
 	int			max_pages;
 	int			nr_vecs;
 	sector_t		blocknr;
+	unsigned short		ioprio;
 };
 
 static int nilfs_segbuf_write(struct nilfs_segment_buffer *segbuf,
-			      struct the_nilfs *nilfs);
+			      struct the_nilfs *nilfs, unsigned short ioprio);
 static int nilfs_segbuf_wait(struct nilfs_segment_buffer *segbuf);
+static void nilfs_segbuf_crc_work(struct work_struct *work);
 
 struct nilfs_segment_buffer *nilfs_segbuf_new(struct super_block *sb)
 {
@@ -48,6 +50,7 @@ struct nilfs_segment_buffer *nilfs_segbuf_new(struct super_block *sb)
 	init_completion(&segbuf->sb_bio_event);
 	atomic_set(&segbuf->sb_err, 0);
 	segbuf->sb_nbio = 0;
+	INIT_WORK(&segbuf->sb_crc_work, nilfs_segbuf_crc_work);
 
 	return segbuf;
 }
@@ -135,24 +138,52 @@ int nilfs_segbuf_reset(struct nilfs_segment_buffer *segbuf, unsigned int flags,
 	segbuf->sb_sum.nfinfo = segbuf->sb_sum.nfileblk = 0;
 	segbuf->sb_sum.ctime = ctime;
 	segbuf->sb_sum.cno = cno;
+	segbuf->sb_sum.isize_ino = 0;
 	return 0;
 }
 
+/**
+ * nilfs_segbuf_record_isize - record the size of a file in a data-sync log
+ * @segbuf: segment buffer just reset
+ * @ino: inode number of the file
+ * @isize: size of the file
+ *
+ * The size is stored in a nilfs_segsum_isize structure following the
+ * summary header, so that roll-forward recovery can restore it without a
+ * checkpoint.  This must be called before any finfo is added.
+ */
+void nilfs_segbuf_record_isize(struct nilfs_segment_buffer *segbuf, ino_t ino,
+			       loff_t isize)
+{
+	segbuf->sb_sum.isize_ino = ino;
+	segbuf->sb_sum.isize = isize;
+	segbuf->sb_sum.sumbytes = nilfs_segbuf_sumhdr_bytes(segbuf);
+}
+
 /*
  * Setup segment summary
  */
 void nilfs_segbuf_fill_in_segsum(struct nilfs_segment_buffer *segbuf)
 {
 	struct nilfs_segment_summary *raw_sum;
+	struct nilfs_segsum_isize *raw_isize;
 	struct buffer_head *bh_sum;
+	unsigned int flags = segbuf->sb_sum.flags;
 
 	bh_sum = list_entry(segbuf->sb_segsum_buffers.next,
 			    struct buffer_head, b_assoc_buffers);
 	raw_sum = (struct nilfs_segment_summary *)bh_sum->b_data;
 
+	if (segbuf->sb_sum.isize_ino) {
+		flags |= NILFS_SS_ISIZE;
+		raw_isize = (struct nilfs_segsum_isize *)(raw_sum + 1);
+		raw_isize->si_ino = cpu_to_le64(segbuf->sb_sum.isize_ino);
+		raw_isize->si_size = cpu_to_le64(segbuf->sb_sum.isize);
+	}
+
 	raw_sum->ss_magic    = cpu_to_le32(NILFS_SEGSUM_MAGIC);
-	raw_sum->ss_bytes    = cpu_to_le16(sizeof(*raw_sum));
-	raw_sum->ss_flags    = cpu_to_le16(segbuf->sb_sum.flags);
+	raw_sum->ss_bytes    = cpu_to_le16(nilfs_segbuf_sumhdr_bytes(segbuf));
+	raw_sum->ss_flags    = cpu_to_le16(flags);
 	raw_sum->ss_seq      = cpu_to_le64(segbuf->sb_sum.seg_seq);
 	raw_sum->ss_create   = cpu_to_le64(segbuf->sb_sum.ctime);
 	raw_sum->ss_next     = cpu_to_le64(segbuf->sb_sum.next);
@@ -226,12 +257,11 @@ nilfs_segbuf_fill_in_super_root_crc(struct nilfs_segment_buffer *segbuf,
 				    u32 seed)
 {
 	struct nilfs_super_root *raw_sr;
-	struct the_nilfs *nilfs = segbuf->sb_super->s_fs_info;
 	unsigned int srsize;
 	u32 crc;
 
 	raw_sr = (struct nilfs_super_root *)segbuf->sb_super_root->b_data;
-	srsize = NILFS_SR_BYTES(nilfs->ns_inode_size);
+	srsize = le16_to_cpu(raw_sr->sr_bytes);
 	crc = crc32_le(seed,
 		       (unsigned char *)raw_sr + sizeof(raw_sr->sr_sum),
 		       srsize - sizeof(raw_sr->sr_sum));
@@ -279,13 +309,23 @@ void nilfs_truncate_logs(struct list_head *logs,
 	}
 }
 
-int nilfs_write_logs(struct list_head *logs, struct the_nilfs *nilfs)
+/**
+ * nilfs_write_logs - submit write requests of logs
+ * @logs: list of segment buffers storing target logs
+ * @nilfs: nilfs object
+ * @ioprio: I/O priority of tasks waiting for the logs, or 0 if none
+ *
+ * If @ioprio is given, all write requests are tagged with it and issued
+ * as synchronous requests.
+ */
+int nilfs_write_logs(struct list_head *logs, struct the_nilfs *nilfs,
+		     unsigned short ioprio)
 {
 	struct nilfs_segment_buffer *segbuf;
 	int ret = 0;
 
 	list_for_each_entry(segbuf, logs, sb_list) {
-		ret = nilfs_segbuf_write(segbuf, nilfs);
+		ret = nilfs_segbuf_write(segbuf, nilfs, ioprio);
 		if (ret)
 			break;
 	}
@@ -305,21 +345,56 @@ int nilfs_wait_on_logs(struct list_head *logs)
 	return ret;
 }
 
+static void nilfs_segbuf_fill_in_crcs(struct nilfs_segment_buffer *segbuf,
+				      u32 seed)
+{
+	if (segbuf->sb_super_root)
+		nilfs_segbuf_fill_in_super_root_crc(segbuf, seed);
+	nilfs_segbuf_fill_in_segsum_crc(segbuf, seed);
+	nilfs_segbuf_fill_in_data_crc(segbuf, seed);
+}
+
+static void nilfs_segbuf_crc_work(struct work_struct *work)
+{
+	struct nilfs_segment_buffer *segbuf =
+		container_of(work, struct nilfs_segment_buffer, sb_crc_work);
+	struct the_nilfs *nilfs = segbuf->sb_super->s_fs_info;
+
+	nilfs_segbuf_fill_in_crcs(segbuf, nilfs->ns_crc_seed);
+}
+
 /**
  * nilfs_add_checksums_on_logs - add checksums on the logs
  * @logs: list of segment buffers storing target logs
- * @seed: checksum seed value
+ * @nilfs: nilfs object
+ * @wq: workqueue to calculate checksums in parallel, or NULL
+ *
+ * If @wq is given and there are two or more logs, checksums of the logs
+ * other than the first one are calculated by workers of @wq while the
+ * caller calculates those of the first log.
  */
-void nilfs_add_checksums_on_logs(struct list_head *logs, u32 seed)
+void nilfs_add_checksums_on_logs(struct list_head *logs,
+				 struct the_nilfs *nilfs,
+				 struct workqueue_struct *wq)
 {
-	struct nilfs_segment_buffer *segbuf;
+	struct nilfs_segment_buffer *first, *segbuf;
 
-	list_for_each_entry(segbuf, logs, sb_list) {
-		if (segbuf->sb_super_root)
-			nilfs_segbuf_fill_in_super_root_crc(segbuf, seed);
-		nilfs_segbuf_fill_in_segsum_crc(segbuf, seed);
-		nilfs_segbuf_fill_in_data_crc(segbuf, seed);
+	if (!wq || list_empty(logs) || list_is_singular(logs)) {
+		list_for_each_entry(segbuf, logs, sb_list)
+			nilfs_segbuf_fill_in_crcs(segbuf, nilfs->ns_crc_seed);
+		return;
 	}
+
+	first = list_first_entry(logs, struct nilfs_segment_buffer, sb_list);
+	segbuf = first;
+	list_for_each_entry_continue(segbuf, logs, sb_list)
+		queue_work(wq, &segbuf->sb_crc_work);
+
+	nilfs_segbuf_fill_in_crcs(first, nilfs->ns_crc_seed);
+
+	segbuf = first;
+	list_for_each_entry_continue(segbuf, logs, sb_list)
+		flush_work(&segbuf->sb_crc_work);
 }
 
 /*
@@ -374,9 +449,11 @@ static int nilfs_segbuf_submit_bh(struct nilfs_segment_buffer *segbuf,
  repeat:
 	if (!wi->bio) {
 		wi->bio = bio_alloc(wi->nilfs->ns_bdev, wi->nr_vecs,
-				    REQ_OP_WRITE, GFP_NOIO);
+				    REQ_OP_WRITE | (wi->ioprio ? REQ_SYNC : 0),
+				    GFP_NOIO);
 		wi->bio->bi_iter.bi_sector = (wi->blocknr + wi->end) <<
 			(wi->nilfs->ns_blocksize_bits - 9);
+		wi->bio->bi_ioprio = wi->ioprio;
 	}
 
 	len = bio_add_page(wi->bio, bh->b_page, bh->b_size, bh_offset(bh));
@@ -396,6 +473,7 @@ static int nilfs_segbuf_submit_bh(struct nilfs_segment_buffer *segbuf,
  * nilfs_segbuf_write - submit write requests of a log
  * @segbuf: buffer storing a log to be written
  * @nilfs: nilfs object
+ * @ioprio: I/O priority of the write requests, or 0 for the default
  *
  * Return Value: On Success, 0 is returned. On Error, one of the following
  * negative error code is returned.
@@ -405,13 +483,14 @@ static int nilfs_segbuf_submit_bh(struct nilfs_segment_buffer *segbuf,
  * %-ENOMEM - Insufficient memory available.
  */
 static int nilfs_segbuf_write(struct nilfs_segment_buffer *segbuf,
-			      struct the_nilfs *nilfs)
+			      struct the_nilfs *nilfs, unsigned short ioprio)
 {
 	struct nilfs_write_info wi;
 	struct buffer_head *bh;
 	int res = 0;
 
 	wi.nilfs = nilfs;
+	wi.ioprio = ioprio;
 	nilfs_segbuf_prepare_write(segbuf, &wi);
 
 	list_for_each_entry(bh, &segbuf->sb_segsum_buffers, b_assoc_buffers) {
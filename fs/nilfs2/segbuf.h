@@ -14,6 +14,7 @@
 #include <linux/buffer_head.h>
 #include <linux/bio.h>
 #include <linux/completion.h>
+#include <linux/workqueue.h>
 
 /**
  * struct nilfs_segsum_info - On-memory segment summary
@@ -27,6 +28,8 @@
  * @cno: Checkpoint number
  * @ctime: Creation time
  * @next: Block number of the next full segment
+ * @isize_ino: Inode number of the file whose size is recorded, or zero
+ * @isize: File size recorded in the log
  */
 struct nilfs_segsum_info {
 	unsigned int		flags;
@@ -39,6 +42,8 @@ struct nilfs_segsum_info {
 	__u64			cno;
 	time64_t		ctime;
 	sector_t		next;
+	ino_t			isize_ino;
+	loff_t			isize;
 };
 
 /**
@@ -58,6 +63,7 @@ struct nilfs_segsum_info {
  * @sb_nbio: Number of flying bio requests
  * @sb_err: I/O error status
  * @sb_bio_event: Completion event of log writing
+ * @sb_crc_work: Work to calculate checksums of the log in parallel
  */
 struct nilfs_segment_buffer {
 	struct super_block     *sb_super;
@@ -80,6 +86,7 @@ struct nilfs_segment_buffer {
 	int			sb_nbio;
 	atomic_t		sb_err;
 	struct completion	sb_bio_event;
+	struct work_struct	sb_crc_work;
 };
 
 #define NILFS_LIST_SEGBUF(head)  \
@@ -116,6 +123,8 @@ int nilfs_segbuf_reset(struct nilfs_segment_buffer *, unsigned int, time64_t,
 int nilfs_segbuf_extend_segsum(struct nilfs_segment_buffer *);
 int nilfs_segbuf_extend_payload(struct nilfs_segment_buffer *,
 				struct buffer_head **);
+void nilfs_segbuf_record_isize(struct nilfs_segment_buffer *segbuf, ino_t ino,
+			       loff_t isize);
 void nilfs_segbuf_fill_in_segsum(struct nilfs_segment_buffer *);
 
 static inline int nilfs_segbuf_simplex(struct nilfs_segment_buffer *segbuf)
@@ -131,6 +140,16 @@ static inline int nilfs_segbuf_empty(struct nilfs_segment_buffer *segbuf)
 	return segbuf->sb_sum.nblocks == segbuf->sb_sum.nsumblk;
 }
 
+static inline unsigned int
+nilfs_segbuf_sumhdr_bytes(struct nilfs_segment_buffer *segbuf)
+{
+	unsigned int bytes = sizeof(struct nilfs_segment_summary);
+
+	if (segbuf->sb_sum.isize_ino)
+		bytes += sizeof(struct nilfs_segsum_isize);
+	return bytes;
+}
+
 static inline void
 nilfs_segbuf_add_segsum_buffer(struct nilfs_segment_buffer *segbuf,
 			       struct buffer_head *bh)
@@ -160,9 +179,12 @@ nilfs_segbuf_add_file_buffer(struct nilfs_segment_buffer *segbuf,
 void nilfs_clear_logs(struct list_head *logs);
 void nilfs_truncate_logs(struct list_head *logs,
 			 struct nilfs_segment_buffer *last);
-int nilfs_write_logs(struct list_head *logs, struct the_nilfs *nilfs);
+int nilfs_write_logs(struct list_head *logs, struct the_nilfs *nilfs,
+		     unsigned short ioprio);
 int nilfs_wait_on_logs(struct list_head *logs);
-void nilfs_add_checksums_on_logs(struct list_head *logs, u32 seed);
+void nilfs_add_checksums_on_logs(struct list_head *logs,
+				 struct the_nilfs *nilfs,
+				 struct workqueue_struct *wq);
 
 static inline void nilfs_destroy_logs(struct list_head *logs)
 {
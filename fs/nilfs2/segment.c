@@ -16,12 +16,12 @@
 #include <linux/completion.h>
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
-#include <linux/freezer.h>
-#include <linux/kthread.h>
 #include <linux/crc32.h>
 #include <linux/pagevec.h>
 #include <linux/slab.h>
 #include <linux/sched/signal.h>
+#include <linux/workqueue.h>
+#include <linux/ioprio.h>
 
 #include "nilfs.h"
 #include "btnode.h"
@@ -31,6 +31,7 @@
 #include "cpfile.h"
 #include "ifile.h"
 #include "segbuf.h"
+#include "dat.h"
 
 
 /*
@@ -43,6 +44,12 @@
 			      * appended in collection retry loop
 			      */
 
+/* Workqueue shared by log writers of all nilfs instances */
+static struct workqueue_struct *nilfs_segctor_wq;
+
+/* Workqueue to calculate checksums of logs in parallel */
+static struct workqueue_struct *nilfs_crc_wq;
+
 /* Construction mode */
 enum {
 	SC_LSEG_SR = 1,	/* Make a logical segment having a super root */
@@ -108,6 +115,7 @@ static inline int nilfs_sc_cstage_get(struct nilfs_sc_info *sci)
 #define NILFS_CF_NODE		0x0001	/* Collecting node blocks */
 #define NILFS_CF_IFILE_STARTED	0x0002	/* IFILE stage has started */
 #define NILFS_CF_SUFREED	0x0004	/* segment usages has been freed */
+#define NILFS_CF_DAT_DELTA	0x0008	/* DAT blocks can be deferred */
 #define NILFS_CF_HISTORY_MASK	(NILFS_CF_IFILE_STARTED | NILFS_CF_SUFREED)
 
 /* Operations depending on the construction mode and file type */
@@ -410,6 +418,7 @@ static void *nilfs_segctor_map_segsum_entry(struct nilfs_sc_info *sci,
  */
 static int nilfs_segctor_reset_segment_buffer(struct nilfs_sc_info *sci)
 {
+	struct the_nilfs *nilfs = sci->sc_super->s_fs_info;
 	struct nilfs_segment_buffer *segbuf = sci->sc_curseg;
 	struct buffer_head *sumbh;
 	unsigned int sumbytes;
@@ -418,9 +427,15 @@ static int nilfs_segctor_reset_segment_buffer(struct nilfs_sc_info *sci)
 
 	if (nilfs_doing_gc())
 		flags = NILFS_SS_GC;
+	if (nilfs->ns_feature_incompat & NILFS_FEATURE_INCOMPAT_BINFO_RUN)
+		flags |= NILFS_SS_BINFO_RUN;
 	err = nilfs_segbuf_reset(segbuf, flags, sci->sc_seg_ctime, sci->sc_cno);
 	if (unlikely(err))
 		return err;
+	if (sci->sc_dsync_isize >= 0)
+		nilfs_segbuf_record_isize(segbuf,
+					  sci->sc_dsync_inode->vfs_inode.i_ino,
+					  sci->sc_dsync_isize);
 
 	sumbh = NILFS_SEGBUF_FIRST_BH(&segbuf->sb_segsum_buffers);
 	sumbytes = segbuf->sb_sum.sumbytes;
@@ -576,6 +591,51 @@ static int nilfs_segctor_add_file_block(struct nilfs_sc_info *sci,
 	return err;
 }
 
+/**
+ * nilfs_segctor_add_data_run_block - add a data block described by runs
+ * @sci: nilfs_sc_info
+ * @bh: buffer head of the data block
+ * @inode: inode of the file other than DAT
+ *
+ * A new nilfs_binfo_run entry is reserved in the segment summary only if
+ * the data block does not extend the run of the previous data block of
+ * the file in the current log.  This must be called after the block is
+ * propagated so that its virtual block number is fixed.
+ */
+static int nilfs_segctor_add_data_run_block(struct nilfs_sc_info *sci,
+					    struct buffer_head *bh,
+					    struct inode *inode)
+{
+	struct nilfs_inode_info *ii = NILFS_I(inode);
+	struct nilfs_segment_buffer *segbuf = sci->sc_curseg;
+	__u64 blkoff, vblocknr;
+	int err;
+
+	blkoff = nilfs_bmap_data_get_key(ii->i_bmap, bh);
+	if (test_bit(NILFS_I_GCINODE, &ii->i_state)) {
+		vblocknr = bh->b_blocknr;
+	} else {
+		err = nilfs_bmap_lookup_ptr(ii->i_bmap, blkoff, &vblocknr);
+		if (unlikely(err))
+			return err == -ENOENT ? -EIO : err;
+	}
+
+	if (sci->sc_datablk_cnt > 0 && blkoff == sci->sc_run_blkoff &&
+	    vblocknr == sci->sc_run_vblocknr &&
+	    segbuf->sb_sum.nblocks < segbuf->sb_rest_blocks) {
+		nilfs_segbuf_add_file_buffer(segbuf, bh);
+		sci->sc_blk_cnt++;
+	} else {
+		err = nilfs_segctor_add_file_block(
+			sci, bh, inode, sizeof(struct nilfs_binfo_run));
+		if (unlikely(err))
+			return err;
+	}
+	sci->sc_run_blkoff = blkoff + 1;
+	sci->sc_run_vblocknr = vblocknr + 1;
+	return 0;
+}
+
 /*
  * Callback functions that enumerate, mark, and collect dirty blocks
  */
@@ -588,8 +648,11 @@ static int nilfs_collect_file_data(struct nilfs_sc_info *sci,
 	if (err < 0)
 		return err;
 
-	err = nilfs_segctor_add_file_block(sci, bh, inode,
-					   sizeof(struct nilfs_binfo_v));
+	if (sci->sc_curseg->sb_sum.flags & NILFS_SS_BINFO_RUN)
+		err = nilfs_segctor_add_data_run_block(sci, bh, inode);
+	else
+		err = nilfs_segctor_add_file_block(
+			sci, bh, inode, sizeof(struct nilfs_binfo_v));
 	if (!err)
 		sci->sc_datablk_cnt++;
 	return err;
@@ -641,6 +704,10 @@ static int nilfs_collect_dat_data(struct nilfs_sc_info *sci,
 {
 	int err;
 
+	if ((sci->sc_stage.flags & NILFS_CF_DAT_DELTA) &&
+	    nilfs_dat_defer_block(inode, bh))
+		return 0; /* carried by the super root */
+
 	err = nilfs_bmap_propagate(NILFS_I(inode)->i_bmap, bh);
 	if (err < 0)
 		return err;
@@ -685,6 +752,44 @@ static const struct nilfs_sc_operations nilfs_sc_dat_ops = {
 	.write_node_binfo = nilfs_write_dat_node_binfo,
 };
 
+/**
+ * nilfs_write_file_data_run - write a data block into runs of the summary
+ * @sci: nilfs_sc_info
+ * @ssp: pointer to the summary entry to be written next
+ * @run: run entry written last for the file, or NULL
+ * @binfo: block information of the data block
+ *
+ * The runs are split in the same way as nilfs_segctor_add_data_run_block()
+ * reserved them, because the virtual block numbers do not change between
+ * the collection and the assignment of blocks.
+ *
+ * Return Value: run entry extended or newly written.
+ */
+static struct nilfs_binfo_run *
+nilfs_write_file_data_run(struct nilfs_sc_info *sci,
+			  struct nilfs_segsum_pointer *ssp,
+			  struct nilfs_binfo_run *run, union nilfs_binfo *binfo)
+{
+	__u64 vblocknr = le64_to_cpu(binfo->bi_v.bi_vblocknr);
+	__u64 blkoff = le64_to_cpu(binfo->bi_v.bi_blkoff);
+	u32 count;
+
+	if (run) {
+		count = le32_to_cpu(run->bi_count);
+		if (le64_to_cpu(run->bi_blkoff) + count == blkoff &&
+		    le64_to_cpu(run->bi_vblocknr) + count == vblocknr) {
+			run->bi_count = cpu_to_le32(count + 1);
+			return run;
+		}
+	}
+	run = nilfs_segctor_map_segsum_entry(sci, ssp, sizeof(*run));
+	run->bi_vblocknr = binfo->bi_v.bi_vblocknr;
+	run->bi_blkoff = binfo->bi_v.bi_blkoff;
+	run->bi_count = cpu_to_le32(1);
+	run->bi_pad = 0;
+	return run;
+}
+
 static const struct nilfs_sc_operations nilfs_sc_dsync_ops = {
 	.collect_data = nilfs_collect_file_data,
 	.collect_node = NULL,
@@ -693,10 +798,16 @@ static const struct nilfs_sc_operations nilfs_sc_dsync_ops = {
 	.write_node_binfo = NULL,
 };
 
+/*
+ * If @defer_dat is true, @inode is the DAT and the blocks that
+ * nilfs_dat_defer_block() leaves to the super root are neither returned
+ * nor counted against @nlimit.
+ */
 static size_t nilfs_lookup_dirty_data_buffers(struct inode *inode,
 					      struct list_head *listp,
 					      size_t nlimit,
-					      loff_t start, loff_t end)
+					      loff_t start, loff_t end,
+					      bool defer_dat)
 {
 	struct address_space *mapping = inode->i_mapping;
 	struct folio_batch fbatch;
@@ -736,6 +847,8 @@ static size_t nilfs_lookup_dirty_data_buffers(struct inode *inode,
 		do {
 			if (!buffer_dirty(bh) || buffer_async_write(bh))
 				continue;
+			if (defer_dat && nilfs_dat_defer_block(inode, bh))
+				continue;
 			get_bh(bh);
 			list_add_tail(&bh->b_assoc_buffers, listp);
 			ndirties++;
@@ -907,43 +1020,11 @@ static int nilfs_segctor_create_checkpoint(struct nilfs_sc_info *sci)
 static int nilfs_segctor_fill_in_checkpoint(struct nilfs_sc_info *sci)
 {
 	struct the_nilfs *nilfs = sci->sc_super->s_fs_info;
-	struct buffer_head *bh_cp;
-	struct nilfs_checkpoint *raw_cp;
-	int err;
-
-	err = nilfs_cpfile_get_checkpoint(nilfs->ns_cpfile, nilfs->ns_cno, 0,
-					  &raw_cp, &bh_cp);
-	if (unlikely(err)) {
-		if (err == -EINVAL || err == -ENOENT) {
-			nilfs_error(sci->sc_super,
-				    "checkpoint finalization failed due to metadata corruption.");
-			err = -EIO;
-		}
-		goto failed_ibh;
-	}
-	raw_cp->cp_snapshot_list.ssl_next = 0;
-	raw_cp->cp_snapshot_list.ssl_prev = 0;
-	raw_cp->cp_inodes_count =
-		cpu_to_le64(atomic64_read(&sci->sc_root->inodes_count));
-	raw_cp->cp_blocks_count =
-		cpu_to_le64(atomic64_read(&sci->sc_root->blocks_count));
-	raw_cp->cp_nblk_inc =
-		cpu_to_le64(sci->sc_nblk_inc + sci->sc_nblk_this_inc);
-	raw_cp->cp_create = cpu_to_le64(sci->sc_seg_ctime);
-	raw_cp->cp_cno = cpu_to_le64(nilfs->ns_cno);
-
-	if (test_bit(NILFS_SC_HAVE_DELTA, &sci->sc_flags))
-		nilfs_checkpoint_clear_minor(raw_cp);
-	else
-		nilfs_checkpoint_set_minor(raw_cp);
-
-	nilfs_write_inode_common(sci->sc_root->ifile,
-				 &raw_cp->cp_ifile_inode, 1);
-	nilfs_cpfile_put_checkpoint(nilfs->ns_cpfile, nilfs->ns_cno, bh_cp);
-	return 0;
 
- failed_ibh:
-	return err;
+	return nilfs_cpfile_finalize_checkpoint(
+		nilfs->ns_cpfile, nilfs->ns_cno, sci->sc_root,
+		sci->sc_nblk_inc + sci->sc_nblk_this_inc, sci->sc_seg_ctime,
+		!test_bit(NILFS_SC_HAVE_DELTA, &sci->sc_flags));
 }
 
 static void nilfs_fill_in_file_bmap(struct inode *ifile,
@@ -973,18 +1054,27 @@ static void nilfs_segctor_fill_in_file_bmap(struct nilfs_sc_info *sci)
 	}
 }
 
-static void nilfs_segctor_fill_in_super_root(struct nilfs_sc_info *sci,
-					     struct the_nilfs *nilfs)
+static int nilfs_segctor_fill_in_super_root(struct nilfs_sc_info *sci,
+					    struct the_nilfs *nilfs)
 {
 	struct buffer_head *bh_sr;
 	struct nilfs_super_root *raw_sr;
 	unsigned int isz, srsz;
+	ssize_t nbytes;
 
 	bh_sr = NILFS_LAST_SEGBUF(&sci->sc_segbufs)->sb_super_root;
 	raw_sr = (struct nilfs_super_root *)bh_sr->b_data;
 	isz = nilfs->ns_inode_size;
 	srsz = NILFS_SR_BYTES(isz);
 
+	/* entries of the DAT blocks left unwritten follow the inodes */
+	nbytes = nilfs_dat_write_deltas(nilfs->ns_dat, (void *)raw_sr + srsz,
+					min_t(unsigned int, nilfs->ns_blocksize,
+					      U16_MAX) - srsz);
+	if (unlikely(nbytes < 0))
+		return nbytes;
+	srsz += nbytes;
+
 	raw_sr->sr_bytes = cpu_to_le16(srsz);
 	raw_sr->sr_nongc_ctime
 		= cpu_to_le64(nilfs_doing_gc() ?
@@ -998,6 +1088,7 @@ static void nilfs_segctor_fill_in_super_root(struct nilfs_sc_info *sci,
 	nilfs_write_inode_common(nilfs->ns_sufile, (void *)raw_sr +
 				 NILFS_SR_SUFILE_OFFSET(isz), 1);
 	memset((void *)raw_sr + srsz, 0, nilfs->ns_blocksize - srsz);
+	return 0;
 }
 
 static void nilfs_redirty_inodes(struct list_head *head)
@@ -1010,7 +1101,8 @@ static void nilfs_redirty_inodes(struct list_head *head)
 	}
 }
 
-static void nilfs_drop_collected_inodes(struct list_head *head)
+static void nilfs_drop_collected_inodes(struct list_head *head,
+					bool update_sr)
 {
 	struct nilfs_inode_info *ii;
 
@@ -1020,6 +1112,8 @@ static void nilfs_drop_collected_inodes(struct list_head *head)
 
 		clear_bit(NILFS_I_INODE_SYNC, &ii->i_state);
 		set_bit(NILFS_I_UPDATED, &ii->i_state);
+		if (update_sr)
+			set_bit(NILFS_I_DSYNC_ISIZE, &ii->i_state);
 	}
 }
 
@@ -1073,7 +1167,8 @@ static int nilfs_segctor_scan_file(struct nilfs_sc_info *sci,
 		size_t n, rest = nilfs_segctor_buffer_rest(sci);
 
 		n = nilfs_lookup_dirty_data_buffers(
-			inode, &data_buffers, rest + 1, 0, LLONG_MAX);
+			inode, &data_buffers, rest + 1, 0, LLONG_MAX,
+			sci->sc_stage.flags & NILFS_CF_DAT_DELTA);
 		if (n > rest) {
 			err = nilfs_segctor_apply_buffers(
 				sci, inode, &data_buffers,
@@ -1123,7 +1218,7 @@ static int nilfs_segctor_scan_file_dsync(struct nilfs_sc_info *sci,
 
 	n = nilfs_lookup_dirty_data_buffers(inode, &data_buffers, rest + 1,
 					    sci->sc_dsync_start,
-					    sci->sc_dsync_end);
+					    sci->sc_dsync_end, false);
 
 	err = nilfs_segctor_apply_buffers(sci, inode, &data_buffers,
 					  nilfs_collect_file_data);
@@ -1147,10 +1242,11 @@ static int nilfs_segctor_collect_blocks(struct nilfs_sc_info *sci, int mode)
 	case NILFS_ST_INIT:
 		/* Pre-processes */
 		sci->sc_stage.flags = 0;
+		nilfs_dat_reset_deltas(nilfs->ns_dat);
 
 		if (!test_bit(NILFS_SC_UNCLOSED, &sci->sc_flags)) {
 			sci->sc_nblk_inc = 0;
-			sci->sc_curseg->sb_sum.flags = NILFS_SS_LOGBGN;
+			sci->sc_curseg->sb_sum.flags |= NILFS_SS_LOGBGN;
 			if (mode == SC_LSEG_DSYNC) {
 				nilfs_sc_cstage_set(sci, NILFS_ST_DSYNC);
 				goto dsync_mode;
@@ -1251,6 +1347,9 @@ static int nilfs_segctor_collect_blocks(struct nilfs_sc_info *sci, int mode)
 		fallthrough;
 	case NILFS_ST_DAT:
  dat_stage:
+		if (mode == SC_LSEG_SR && !nilfs_doing_gc() &&
+		    nilfs_has_dat_deltas(nilfs))
+			sci->sc_stage.flags |= NILFS_CF_DAT_DELTA;
 		err = nilfs_segctor_scan_file(sci, nilfs->ns_dat,
 					      &nilfs_sc_dat_ops);
 		if (unlikely(err))
@@ -1581,8 +1680,10 @@ nilfs_segctor_update_payload_blocknr(struct nilfs_sc_info *sci,
 	const struct nilfs_sc_operations *sc_op = NULL;
 	struct nilfs_segsum_pointer ssp;
 	struct nilfs_finfo *finfo = NULL;
+	struct nilfs_binfo_run *run = NULL;
 	union nilfs_binfo binfo;
 	struct buffer_head *bh, *bh_org;
+	bool use_run = segbuf->sb_sum.flags & NILFS_SS_BINFO_RUN;
 	ino_t ino = 0;
 	int err = 0;
 
@@ -1591,7 +1692,7 @@ nilfs_segctor_update_payload_blocknr(struct nilfs_sc_info *sci,
 
 	blocknr = segbuf->sb_pseg_start + segbuf->sb_sum.nsumblk;
 	ssp.bh = NILFS_SEGBUF_FIRST_BH(&segbuf->sb_segsum_buffers);
-	ssp.offset = sizeof(struct nilfs_segment_summary);
+	ssp.offset = nilfs_segbuf_sumhdr_bytes(segbuf);
 
 	list_for_each_entry(bh, &segbuf->sb_payload_buffers, b_assoc_buffers) {
 		if (bh == segbuf->sb_super_root)
@@ -1604,6 +1705,8 @@ nilfs_segctor_update_payload_blocknr(struct nilfs_sc_info *sci,
 			ndatablk = le32_to_cpu(finfo->fi_ndatablk);
 
 			inode = bh->b_folio->mapping->host;
+			nilfs_inode_stat_add(NILFS_I(inode)->i_bmap->b_inode,
+					     NILFS_ISTAT_LOG_BLOCKS, nblocks);
 
 			if (mode == SC_LSEG_DSYNC)
 				sc_op = &nilfs_sc_dsync_ops;
@@ -1622,7 +1725,9 @@ nilfs_segctor_update_payload_blocknr(struct nilfs_sc_info *sci,
 		if (unlikely(err))
 			goto failed_bmap;
 
-		if (ndatablk > 0)
+		if (ndatablk > 0 && use_run && ino != NILFS_DAT_INO)
+			run = nilfs_write_file_data_run(sci, &ssp, run, &binfo);
+		else if (ndatablk > 0)
 			sc_op->write_data_binfo(sci, &ssp, &binfo);
 		else
 			sc_op->write_node_binfo(sci, &ssp, &binfo);
@@ -1630,6 +1735,7 @@ nilfs_segctor_update_payload_blocknr(struct nilfs_sc_info *sci,
 		blocknr++;
 		if (--nblocks == 0) {
 			finfo = NULL;
+			run = NULL;
 			if (--nfinfo == 0)
 				break;
 		} else if (ndatablk > 0)
@@ -1725,7 +1831,9 @@ static int nilfs_segctor_write(struct nilfs_sc_info *sci,
 {
 	int ret;
 
-	ret = nilfs_write_logs(&sci->sc_segbufs, nilfs);
+	/* Tag the logs with the priority of tasks waiting for them */
+	ret = nilfs_write_logs(&sci->sc_segbufs, nilfs,
+			       READ_ONCE(sci->sc_ioprio));
 	list_splice_tail_init(&sci->sc_segbufs, &sci->sc_write_logs);
 	return ret;
 }
@@ -1850,10 +1958,12 @@ static void nilfs_segctor_complete_write(struct nilfs_sc_info *sci)
 	struct nilfs_segment_buffer *segbuf;
 	struct page *bd_page = NULL, *fs_page = NULL;
 	struct the_nilfs *nilfs = sci->sc_super->s_fs_info;
+	struct address_space *dat_mapping = nilfs->ns_dat->i_mapping;
 	int update_sr = false;
 
 	list_for_each_entry(segbuf, &sci->sc_write_logs, sb_list) {
 		struct buffer_head *bh;
+		sector_t blocknr;
 
 		list_for_each_entry(bh, &segbuf->sb_segsum_buffers,
 				    b_assoc_buffers) {
@@ -1876,6 +1986,7 @@ static void nilfs_segctor_complete_write(struct nilfs_sc_info *sci)
 		 * guaranteed.  The cleanup code of B-tree node pages needs
 		 * special care.
 		 */
+		blocknr = segbuf->sb_pseg_start + segbuf->sb_sum.nsumblk;
 		list_for_each_entry(bh, &segbuf->sb_payload_buffers,
 				    b_assoc_buffers) {
 			const unsigned long set_bits = BIT(BH_Uptodate);
@@ -1885,6 +1996,10 @@ static void nilfs_segctor_complete_write(struct nilfs_sc_info *sci)
 				 BIT(BH_NILFS_Redirected));
 
 			set_mask_bits(&bh->b_state, clear_bits, set_bits);
+			/* remember where DAT blocks are for deferring them */
+			if (bh->b_folio->mapping == dat_mapping)
+				bh->b_blocknr = blocknr;
+			blocknr++;
 			if (bh == segbuf->sb_super_root) {
 				if (bh->b_page != bd_page) {
 					end_page_writeback(bd_page);
@@ -1917,10 +2032,10 @@ static void nilfs_segctor_complete_write(struct nilfs_sc_info *sci)
 
 	nilfs_end_page_io(fs_page, 0);
 
-	nilfs_drop_collected_inodes(&sci->sc_dirty_files);
+	nilfs_drop_collected_inodes(&sci->sc_dirty_files, update_sr);
 
 	if (nilfs_doing_gc())
-		nilfs_drop_collected_inodes(&sci->sc_gc_inodes);
+		nilfs_drop_collected_inodes(&sci->sc_gc_inodes, false);
 	else
 		nilfs->ns_nongc_ctime = sci->sc_seg_ctime;
 
@@ -1938,6 +2053,7 @@ static void nilfs_segctor_complete_write(struct nilfs_sc_info *sci)
 		clear_bit(NILFS_SC_DIRTY, &sci->sc_flags);
 		set_bit(NILFS_SC_SUPER_ROOT, &sci->sc_flags);
 		nilfs_segctor_clear_metadata_dirty(sci);
+		nilfs_dat_commit_deltas(nilfs->ns_dat);
 	} else
 		clear_bit(NILFS_SC_SUPER_ROOT, &sci->sc_flags);
 }
@@ -2033,12 +2149,36 @@ static void nilfs_segctor_drop_written_files(struct nilfs_sc_info *sci,
 		schedule_work(&sci->sc_iput_work);
 }
 
+/**
+ * nilfs_segctor_yield_flush - check if a flush should yield to sync requests
+ * @sci: segment constructor object
+ * @mode: mode of log forming
+ *
+ * A flush without a checkpoint is stopped at a boundary of partial
+ * segments if a task is waiting for a checkpoint, so that the following
+ * construction for the task writes the remaining blocks together with a
+ * super root without waiting for the whole flush.
+ */
+static bool nilfs_segctor_yield_flush(struct nilfs_sc_info *sci, int mode)
+{
+	bool ret;
+
+	if (mode != SC_FLUSH_FILE && mode != SC_FLUSH_DAT)
+		return false;
+
+	spin_lock(&sci->sc_state_lock);
+	ret = sci->sc_seq_request != sci->sc_seq_done;
+	spin_unlock(&sci->sc_state_lock);
+	return ret;
+}
+
 /*
  * Main procedure of segment constructor
  */
 static int nilfs_segctor_do_construct(struct nilfs_sc_info *sci, int mode)
 {
 	struct the_nilfs *nilfs = sci->sc_super->s_fs_info;
+	bool yield = false;
 	int err;
 
 	if (sb_rdonly(sci->sc_super))
@@ -2071,9 +2211,10 @@ static int nilfs_segctor_do_construct(struct nilfs_sc_info *sci, int mode)
 		if (unlikely(err))
 			goto failed;
 
-		/* Avoid empty segment */
+		/* Avoid empty segment unless it records a file size */
 		if (nilfs_sc_cstage_get(sci) == NILFS_ST_DONE &&
-		    nilfs_segbuf_empty(sci->sc_curseg)) {
+		    nilfs_segbuf_empty(sci->sc_curseg) &&
+		    !sci->sc_curseg->sb_sum.isize_ino) {
 			nilfs_segctor_abort_construction(sci, nilfs, 1);
 			goto out;
 		}
@@ -2091,21 +2232,26 @@ static int nilfs_segctor_do_construct(struct nilfs_sc_info *sci, int mode)
 			if (unlikely(err))
 				goto failed_to_write;
 
-			nilfs_segctor_fill_in_super_root(sci, nilfs);
+			err = nilfs_segctor_fill_in_super_root(sci, nilfs);
+			if (unlikely(err))
+				goto failed_to_write;
 		}
 		nilfs_segctor_update_segusage(sci, nilfs->ns_sufile);
 
 		/* Write partial segments */
 		nilfs_segctor_prepare_write(sci);
 
-		nilfs_add_checksums_on_logs(&sci->sc_segbufs,
-					    nilfs->ns_crc_seed);
+		nilfs_add_checksums_on_logs(&sci->sc_segbufs, nilfs,
+					    nilfs_crc_wq);
 
 		err = nilfs_segctor_write(sci, nilfs);
 		if (unlikely(err))
 			goto failed_to_write;
 
-		if (nilfs_sc_cstage_get(sci) == NILFS_ST_DONE ||
+		if (nilfs_sc_cstage_get(sci) != NILFS_ST_DONE)
+			yield = nilfs_segctor_yield_flush(sci, mode);
+
+		if (nilfs_sc_cstage_get(sci) == NILFS_ST_DONE || yield ||
 		    nilfs->ns_blocksize_bits != PAGE_SHIFT) {
 			/*
 			 * At this point, we avoid double buffering
@@ -2118,7 +2264,7 @@ static int nilfs_segctor_do_construct(struct nilfs_sc_info *sci, int mode)
 			if (err)
 				goto failed_to_write;
 		}
-	} while (nilfs_sc_cstage_get(sci) != NILFS_ST_DONE);
+	} while (nilfs_sc_cstage_get(sci) != NILFS_ST_DONE && !yield);
 
  out:
 	nilfs_segctor_drop_written_files(sci, nilfs);
@@ -2162,7 +2308,7 @@ static void nilfs_segctor_do_flush(struct nilfs_sc_info *sci, int bn)
 
 		sci->sc_flush_request |= BIT(bn);
 		if (!prev_req)
-			wake_up(&sci->sc_wait_daemon);
+			queue_work(nilfs_segctor_wq, &sci->sc_work);
 	}
 	spin_unlock(&sci->sc_state_lock);
 }
@@ -2183,29 +2329,39 @@ void nilfs_flush_segment(struct super_block *sb, ino_t ino)
 					/* assign bit 0 to data files */
 }
 
-struct nilfs_segctor_wait_request {
-	wait_queue_entry_t	wq;
-	__u32		seq;
-	int		err;
-	atomic_t	done;
-};
+/**
+ * nilfs_segctor_add_request - assign a sequence number to a request
+ * @sci: segment constructor object
+ * @wrq: request of a logical segment
+ */
+static void nilfs_segctor_add_request(struct nilfs_sc_info *sci,
+				      struct nilfs_segctor_wait_request *wrq)
+{
+	unsigned short ioprio = get_current_ioprio();
+
+	spin_lock(&sci->sc_state_lock);
+	init_wait(&wrq->wq);
+	wrq->err = 0;
+	atomic_set(&wrq->done, 0);
+	wrq->seq = ++sci->sc_seq_request;
+	/* a smaller value means a higher priority */
+	if (!sci->sc_ioprio || ioprio < sci->sc_ioprio)
+		WRITE_ONCE(sci->sc_ioprio, ioprio);
+	spin_unlock(&sci->sc_state_lock);
+}
 
 static int nilfs_segctor_sync(struct nilfs_sc_info *sci)
 {
 	struct nilfs_segctor_wait_request wait_req;
 	int err = 0;
 
-	spin_lock(&sci->sc_state_lock);
-	init_wait(&wait_req.wq);
-	wait_req.err = 0;
-	atomic_set(&wait_req.done, 0);
-	wait_req.seq = ++sci->sc_seq_request;
-	spin_unlock(&sci->sc_state_lock);
+	wait_req.complete = NULL;
+	nilfs_segctor_add_request(sci, &wait_req);
 
 	init_waitqueue_entry(&wait_req.wq, current);
 	add_wait_queue(&sci->sc_wait_request, &wait_req.wq);
 	set_current_state(TASK_INTERRUPTIBLE);
-	wake_up(&sci->sc_wait_daemon);
+	queue_work(nilfs_segctor_wq, &sci->sc_work);
 
 	for (;;) {
 		if (atomic_read(&wait_req.done)) {
@@ -2244,6 +2400,53 @@ static void nilfs_segctor_wakeup(struct nilfs_sc_info *sci, int err)
 	spin_unlock_irqrestore(&sci->sc_wait_request.lock, flags);
 }
 
+static int nilfs_segctor_complete_request(struct wait_queue_entry *wq,
+					  unsigned int mode, int flags,
+					  void *key)
+{
+	struct nilfs_segctor_wait_request *wrq =
+		container_of(wq, struct nilfs_segctor_wait_request, wq);
+
+	list_del_init(&wq->entry);
+	wrq->complete(wrq);
+	return 1;
+}
+
+/**
+ * nilfs_construct_segment_async - request a logical segment without waiting
+ * @sb: super block
+ * @wrq: request to be queued
+ * @complete: callback called when the request is completed
+ *
+ * nilfs_construct_segment_async() queues @wrq to the log writer and
+ * returns without waiting for the construction.  @complete is called with
+ * the result stored in @wrq->err after a logical segment with a super
+ * root that was started after the request has been written.  It is
+ * called in atomic context and must not sleep, and @wrq must be kept
+ * until it is called.
+ *
+ * Return Value: On success, 0 is returned.  %-EROFS is returned if the
+ * filesystem is read-only, in which case @complete is never called.
+ */
+int nilfs_construct_segment_async(struct super_block *sb,
+				  struct nilfs_segctor_wait_request *wrq,
+				  void (*complete)(struct nilfs_segctor_wait_request *))
+{
+	struct the_nilfs *nilfs = sb->s_fs_info;
+	struct nilfs_sc_info *sci = nilfs->ns_writer;
+
+	if (sb_rdonly(sb) || unlikely(!sci))
+		return -EROFS;
+
+	wrq->complete = complete;
+	nilfs_segctor_add_request(sci, wrq);
+
+	init_waitqueue_func_entry(&wrq->wq, nilfs_segctor_complete_request);
+	add_wait_queue(&sci->sc_wait_request, &wrq->wq);
+	queue_work(nilfs_segctor_wq, &sci->sc_work);
+	return 0;
+}
+
 /**
  * nilfs_construct_segment - construct a logical segment
  * @sb: super block
@@ -2283,6 +2486,14 @@ int nilfs_construct_segment(struct super_block *sb)
  * @start: start byte offset
  * @end: end byte offset (inclusive)
  *
+ * If metadata of @inode has changed, a full logical segment is written
+ * instead, unless @inode is a regular file and the file system is mounted
+ * with the dsync_isize option.  In that case, the file size is recorded in
+ * the data-only logs and the other metadata is left to the next checkpoint.
+ * This is only done if @inode is in the latest checkpoint and has not been
+ * truncated since, because roll-forward can neither create the inode nor
+ * replay the removal of blocks.
+ *
  * Return Value: On success, 0 is returned. On errors, one of the following
  * negative error code is returned.
  *
@@ -2303,6 +2514,7 @@ int nilfs_construct_dsync_segment(struct super_block *sb, struct inode *inode,
 	struct nilfs_sc_info *sci = nilfs->ns_writer;
 	struct nilfs_inode_info *ii;
 	struct nilfs_transaction_info ti;
+	bool isize_sync;
 	int err = 0;
 
 	if (sb_rdonly(sb) || unlikely(!sci))
@@ -2311,7 +2523,10 @@ int nilfs_construct_dsync_segment(struct super_block *sb, struct inode *inode,
 	nilfs_transaction_lock(sb, &ti, 0);
 
 	ii = NILFS_I(inode);
-	if (test_bit(NILFS_I_INODE_SYNC, &ii->i_state) ||
+	isize_sync = test_bit(NILFS_I_INODE_SYNC, &ii->i_state);
+	if ((isize_sync && !(S_ISREG(inode->i_mode) &&
+			     nilfs_test_opt(nilfs, DSYNC_ISIZE) &&
+			     test_bit(NILFS_I_DSYNC_ISIZE, &ii->i_state))) ||
 	    nilfs_test_opt(nilfs, STRICT_ORDER) ||
 	    test_bit(NILFS_SC_UNCLOSED, &sci->sc_flags) ||
 	    nilfs_discontinued(nilfs)) {
@@ -2331,10 +2546,19 @@ int nilfs_construct_dsync_segment(struct super_block *sb, struct inode *inode,
 	sci->sc_dsync_inode = ii;
 	sci->sc_dsync_start = start;
 	sci->sc_dsync_end = end;
+	/*
+	 * The file size is recovered from the logs by roll-forward until
+	 * the next checkpoint writes out the inode.
+	 */
+	if (isize_sync)
+		sci->sc_dsync_isize = i_size_read(inode);
 
 	err = nilfs_segctor_do_construct(sci, SC_LSEG_DSYNC);
-	if (!err)
+	sci->sc_dsync_isize = -1;
+	if (!err) {
 		nilfs->ns_flushed_device = 0;
+		nilfs_inode_stat_add(inode, NILFS_ISTAT_DSYNC_LOGS, 1);
+	}
 
 	nilfs_transaction_unlock(sb);
 	return err;
@@ -2371,6 +2595,8 @@ static void nilfs_segctor_notify(struct nilfs_sc_info *sci, int mode, int err)
 		sci->sc_seq_done = sci->sc_seq_accepted;
 		nilfs_segctor_wakeup(sci, err);
 		sci->sc_flush_request = 0;
+		if (sci->sc_seq_done == sci->sc_seq_request)
+			WRITE_ONCE(sci->sc_ioprio, 0);
 	} else {
 		if (mode == SC_FLUSH_FILE)
 			sci->sc_flush_request &= ~FLUSH_FILE_BIT;
@@ -2429,7 +2655,7 @@ static void nilfs_construction_timeout(struct timer_list *t)
 {
 	struct nilfs_sc_info *sci = from_timer(sci, t, sc_timer);
 
-	wake_up_process(sci->sc_timer_task);
+	queue_work(nilfs_segctor_wq, &sci->sc_work);
 }
 
 static void
@@ -2504,6 +2730,64 @@ int nilfs_clean_segments(struct super_block *sb, struct nilfs_argv *argv,
 	return err;
 }
 
+/**
+ * nilfs_move_log_head - move the head of logs out of trailing segments
+ * @sb: super block instance
+ * @limit: segment number that the current and next segments must be below
+ *
+ * Description: nilfs_move_log_head() terminates the current full segment
+ * and writes a log with a super root while the current or the next
+ * segment of the log is not below @limit.  The range of allocatable
+ * segments must be limited below @limit in advance so that the segments
+ * allocated to continue the log are taken from there.
+ *
+ * Return Value: On success, 0 is returned. On error, one of the following
+ * negative error codes is returned.
+ *
+ * %-EBUSY - The head of logs cannot leave the trailing segments.
+ *
+ * %-EIO - I/O error.
+ *
+ * %-ENOMEM - Insufficient amount of memory available.
+ *
+ * %-ENOSPC - No clean segment left.
+ *
+ * %-EROFS - Read only filesystem.
+ */
+int nilfs_move_log_head(struct super_block *sb, __u64 limit)
+{
+	struct the_nilfs *nilfs = sb->s_fs_info;
+	struct nilfs_sc_info *sci = nilfs->ns_writer;
+	struct nilfs_transaction_info ti;
+	sector_t seg_start, seg_end;
+	int n, err = 0;
+
+	if (unlikely(!sci))
+		return -EROFS;
+
+	nilfs_transaction_lock(sb, &ti, 0);
+
+	/* Two shifts are enough to leave both the current and next segments */
+	for (n = 0; n < 2; n++) {
+		if (nilfs->ns_segnum < limit && nilfs->ns_nextnum < limit)
+			break;
+
+		nilfs_get_segment_range(nilfs, nilfs->ns_segnum, &seg_start,
+					&seg_end);
+		nilfs_terminate_segment(nilfs, seg_start, seg_end);
+		nilfs_mdt_mark_dirty(nilfs->ns_sufile);
+		err = nilfs_segctor_construct(sci, SC_LSEG_SR);
+		if (unlikely(err))
+			goto out_unlock;
+	}
+	if (nilfs->ns_segnum >= limit || nilfs->ns_nextnum >= limit)
+		err = -EBUSY;
+
+ out_unlock:
+	nilfs_transaction_unlock(sb);
+	return err;
+}
+
 static void nilfs_segctor_thread_construct(struct nilfs_sc_info *sci, int mode)
 {
 	struct nilfs_transaction_info ti;
@@ -2555,34 +2839,24 @@ static int nilfs_segctor_flush_mode(struct nilfs_sc_info *sci)
 }
 
 /**
- * nilfs_segctor_thread - main loop of the segment constructor thread.
- * @arg: pointer to a struct nilfs_sc_info.
+ * nilfs_segctor_work - construct logs requested to the log writer
+ * @work: work struct embedded in nilfs_sc_info
  *
- * nilfs_segctor_thread() initializes a timer and serves as a daemon
- * to execute segment constructions.
+ * Constructions of all nilfs instances are executed by workers of the
+ * shared nilfs_segctor_wq.  Those of a log writer are serialized because
+ * a work item never runs on two workers at once.
  */
-static int nilfs_segctor_thread(void *arg)
+static void nilfs_segctor_work(struct work_struct *work)
 {
-	struct nilfs_sc_info *sci = (struct nilfs_sc_info *)arg;
+	struct nilfs_sc_info *sci = container_of(work, struct nilfs_sc_info,
+						 sc_work);
 	struct the_nilfs *nilfs = sci->sc_super->s_fs_info;
-	int timeout = 0;
-
-	sci->sc_timer_task = current;
-
-	/* start sync. */
-	sci->sc_task = current;
-	wake_up(&sci->sc_wait_task); /* for nilfs_segctor_start_thread() */
-	nilfs_info(sci->sc_super,
-		   "segctord starting. Construction interval = %lu seconds, CP frequency < %lu seconds",
-		   sci->sc_interval / HZ, sci->sc_mjcp_freq / HZ);
+	int timeout, mode;
 
 	spin_lock(&sci->sc_state_lock);
- loop:
-	for (;;) {
-		int mode;
-
-		if (sci->sc_state & NILFS_SEGCTOR_QUIT)
-			goto end_thread;
+	while (!(sci->sc_state & NILFS_SEGCTOR_QUIT)) {
+		timeout = ((sci->sc_state & NILFS_SEGCTOR_COMMIT) &&
+			   time_after_eq(jiffies, sci->sc_timer.expires));
 
 		if (timeout || sci->sc_seq_request != sci->sc_seq_done)
 			mode = SC_LSEG_SR;
@@ -2594,79 +2868,60 @@ static int nilfs_segctor_thread(void *arg)
 		spin_unlock(&sci->sc_state_lock);
 		nilfs_segctor_thread_construct(sci, mode);
 		spin_lock(&sci->sc_state_lock);
-		timeout = 0;
 	}
+	spin_unlock(&sci->sc_state_lock);
 
+	if (nilfs_sb_dirty(nilfs) && nilfs_sb_need_update(nilfs))
+		set_nilfs_discontinued(nilfs);
+}
 
-	if (freezing(current)) {
-		spin_unlock(&sci->sc_state_lock);
-		try_to_freeze();
-		spin_lock(&sci->sc_state_lock);
-	} else {
-		DEFINE_WAIT(wait);
-		int should_sleep = 1;
-
-		prepare_to_wait(&sci->sc_wait_daemon, &wait,
-				TASK_INTERRUPTIBLE);
-
-		if (sci->sc_seq_request != sci->sc_seq_done)
-			should_sleep = 0;
-		else if (sci->sc_flush_request)
-			should_sleep = 0;
-		else if (sci->sc_state & NILFS_SEGCTOR_COMMIT)
-			should_sleep = time_before(jiffies,
-					sci->sc_timer.expires);
+static void nilfs_segctor_start_work(struct nilfs_sc_info *sci)
+{
+	nilfs_info(sci->sc_super,
+		   "segctord starting. Construction interval = %lu seconds, CP frequency < %lu seconds",
+		   sci->sc_interval / HZ, sci->sc_mjcp_freq / HZ);
 
-		if (should_sleep) {
-			spin_unlock(&sci->sc_state_lock);
-			schedule();
-			spin_lock(&sci->sc_state_lock);
-		}
-		finish_wait(&sci->sc_wait_daemon, &wait);
-		timeout = ((sci->sc_state & NILFS_SEGCTOR_COMMIT) &&
-			   time_after_eq(jiffies, sci->sc_timer.expires));
+	queue_work(nilfs_segctor_wq, &sci->sc_work);
+}
 
-		if (nilfs_sb_dirty(nilfs) && nilfs_sb_need_update(nilfs))
-			set_nilfs_discontinued(nilfs);
-	}
-	goto loop;
+static void nilfs_segctor_kill_work(struct nilfs_sc_info *sci)
+	__acquires(&sci->sc_state_lock)
+	__releases(&sci->sc_state_lock)
+{
+	sci->sc_state |= NILFS_SEGCTOR_QUIT;
 
- end_thread:
-	/* end sync. */
-	sci->sc_task = NULL;
-	wake_up(&sci->sc_wait_task); /* for nilfs_segctor_kill_thread() */
 	spin_unlock(&sci->sc_state_lock);
-	return 0;
+	cancel_work_sync(&sci->sc_work);
+	spin_lock(&sci->sc_state_lock);
 }
 
-static int nilfs_segctor_start_thread(struct nilfs_sc_info *sci)
+/**
+ * nilfs_segctor_init_workqueues - create workqueues for log writers
+ */
+int __init nilfs_segctor_init_workqueues(void)
 {
-	struct task_struct *t;
-
-	t = kthread_run(nilfs_segctor_thread, sci, "segctord");
-	if (IS_ERR(t)) {
-		int err = PTR_ERR(t);
+	nilfs_segctor_wq = alloc_workqueue("nilfs_segctord",
+					   WQ_UNBOUND | WQ_MEM_RECLAIM |
+					   WQ_FREEZABLE, 0);
+	if (!nilfs_segctor_wq)
+		return -ENOMEM;
 
-		nilfs_err(sci->sc_super, "error %d creating segctord thread",
-			  err);
-		return err;
+	nilfs_crc_wq = alloc_workqueue("nilfs_crc",
+				       WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!nilfs_crc_wq) {
+		destroy_workqueue(nilfs_segctor_wq);
+		return -ENOMEM;
 	}
-	wait_event(sci->sc_wait_task, sci->sc_task != NULL);
 	return 0;
 }
 
-static void nilfs_segctor_kill_thread(struct nilfs_sc_info *sci)
-	__acquires(&sci->sc_state_lock)
-	__releases(&sci->sc_state_lock)
+/**
+ * nilfs_segctor_destroy_workqueues - destroy workqueues for log writers
+ */
+void nilfs_segctor_destroy_workqueues(void)
 {
-	sci->sc_state |= NILFS_SEGCTOR_QUIT;
-
-	while (sci->sc_task) {
-		wake_up(&sci->sc_wait_daemon);
-		spin_unlock(&sci->sc_state_lock);
-		wait_event(sci->sc_wait_task, sci->sc_task == NULL);
-		spin_lock(&sci->sc_state_lock);
-	}
+	destroy_workqueue(nilfs_crc_wq);
+	destroy_workqueue(nilfs_segctor_wq);
 }
 
 /*
@@ -2688,8 +2943,7 @@ static struct nilfs_sc_info *nilfs_segctor_new(struct super_block *sb,
 	sci->sc_root = root;
 
 	init_waitqueue_head(&sci->sc_wait_request);
-	init_waitqueue_head(&sci->sc_wait_daemon);
-	init_waitqueue_head(&sci->sc_wait_task);
+	INIT_WORK(&sci->sc_work, nilfs_segctor_work);
 	spin_lock_init(&sci->sc_state_lock);
 	INIT_LIST_HEAD(&sci->sc_dirty_files);
 	INIT_LIST_HEAD(&sci->sc_segbufs);
@@ -2702,6 +2956,7 @@ static struct nilfs_sc_info *nilfs_segctor_new(struct super_block *sb,
 	sci->sc_interval = HZ * NILFS_SC_DEFAULT_TIMEOUT;
 	sci->sc_mjcp_freq = HZ * NILFS_SC_DEFAULT_SR_FREQ;
 	sci->sc_watermark = NILFS_SC_DEFAULT_WATERMARK;
+	sci->sc_dsync_isize = -1;
 
 	if (nilfs->ns_interval)
 		sci->sc_interval = HZ * nilfs->ns_interval;
@@ -2715,7 +2970,7 @@ static void nilfs_segctor_write_out(struct nilfs_sc_info *sci)
 	int ret, retrycount = NILFS_SC_CLEANUP_RETRY;
 
 	/*
-	 * The segctord thread was stopped and its timer was removed.
+	 * The segctord work was stopped and its timer was removed.
 	 * But some tasks remain.
 	 */
 	do {
@@ -2734,7 +2989,7 @@ static void nilfs_segctor_write_out(struct nilfs_sc_info *sci)
  * nilfs_segctor_destroy - destroy the segment constructor.
  * @sci: nilfs_sc_info
  *
- * nilfs_segctor_destroy() kills the segctord thread and frees
+ * nilfs_segctor_destroy() stops the segctord work and frees
  * the nilfs_sc_info struct.
  * Caller must hold the segment semaphore.
  */
@@ -2746,7 +3001,7 @@ static void nilfs_segctor_destroy(struct nilfs_sc_info *sci)
 	up_write(&nilfs->ns_segctor_sem);
 
 	spin_lock(&sci->sc_state_lock);
-	nilfs_segctor_kill_thread(sci);
+	nilfs_segctor_kill_work(sci);
 	flag = ((sci->sc_state & NILFS_SEGCTOR_COMMIT) || sci->sc_flush_request
 		|| sci->sc_seq_request != sci->sc_seq_done);
 	spin_unlock(&sci->sc_state_lock);
@@ -2754,9 +3009,23 @@ static void nilfs_segctor_destroy(struct nilfs_sc_info *sci)
 	if (flush_work(&sci->sc_iput_work))
 		flag = true;
 
+	if (nilfs_dat_flush_deltas(nilfs->ns_dat)) {
+		/* leave no DAT changes only in super roots */
+		set_bit(NILFS_SC_DIRTY, &sci->sc_flags);
+		flag = true;
+	}
+
 	if (flag || !nilfs_segctor_confirm(sci))
 		nilfs_segctor_write_out(sci);
 
+	/* fail requests that have not been completed by the final write-out */
+	spin_lock(&sci->sc_state_lock);
+	if (sci->sc_seq_done != sci->sc_seq_request) {
+		sci->sc_seq_done = sci->sc_seq_request;
+		nilfs_segctor_wakeup(sci, -EROFS);
+	}
+	spin_unlock(&sci->sc_state_lock);
+
 	if (!list_empty(&sci->sc_dirty_files)) {
 		nilfs_warn(sci->sc_super,
 			   "disposed unprocessed dirty file(s) when stopping log writer");
@@ -2777,6 +3046,8 @@ static void nilfs_segctor_destroy(struct nilfs_sc_info *sci)
 	down_write(&nilfs->ns_segctor_sem);
 
 	timer_shutdown_sync(&sci->sc_timer);
+	/* The timer may have queued the work after it was stopped */
+	cancel_work_sync(&sci->sc_work);
 	kfree(sci);
 }
 
@@ -2796,7 +3067,6 @@ static void nilfs_segctor_destroy(struct nilfs_sc_info *sci)
 int nilfs_attach_log_writer(struct super_block *sb, struct nilfs_root *root)
 {
 	struct the_nilfs *nilfs = sb->s_fs_info;
-	int err;
 
 	if (nilfs->ns_writer) {
 		/*
@@ -2814,11 +3084,8 @@ int nilfs_attach_log_writer(struct super_block *sb, struct nilfs_root *root)
 
 	inode_attach_wb(nilfs->ns_bdev->bd_inode, NULL);
 
-	err = nilfs_segctor_start_thread(nilfs->ns_writer);
-	if (unlikely(err))
-		nilfs_detach_log_writer(sb);
-
-	return err;
+	nilfs_segctor_start_work(nilfs->ns_writer);
+	return 0;
 }
 
 /**
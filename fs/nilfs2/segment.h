@@ -31,6 +31,8 @@ struct nilfs_root;
  * @ri_seq: Sequence number on the last partial segment
  * @ri_segnum: Segment number on the last partial segment
  * @ri_nextnum: Next segment number on the last partial segment
+ * @ri_nscanned_logs: Number of valid logs read during recovery
+ * @ri_nsalvaged_blocks: Number of blocks salvaged by roll-forward
  */
 struct nilfs_recovery_info {
 	int			ri_need_recovery;
@@ -45,6 +47,8 @@ struct nilfs_recovery_info {
 	u64			ri_seq;
 	__u64			ri_segnum;
 	__u64			ri_nextnum;
+	unsigned long		ri_nscanned_logs;
+	unsigned long		ri_nsalvaged_blocks;
 };
 
 /* ri_need_recovery */
@@ -73,6 +77,22 @@ struct nilfs_segsum_pointer {
 	unsigned int		offset; /* offset in bytes */
 };
 
+/**
+ * struct nilfs_segctor_wait_request - request of a logical segment
+ * @wq: entry of the request queue of the log writer
+ * @seq: sequence number of the request
+ * @err: result of the construction
+ * @done: flag set when the construction for the request has finished
+ * @complete: callback of an asynchronous request, or NULL
+ */
+struct nilfs_segctor_wait_request {
+	wait_queue_entry_t	wq;
+	__u32		seq;
+	int		err;
+	atomic_t	done;
+	void (*complete)(struct nilfs_segctor_wait_request *wrq);
+};
+
 /**
  * struct nilfs_sc_info - Segment constructor information
  * @sc_super: Back pointer to super_block struct
@@ -87,6 +107,7 @@ struct nilfs_segsum_pointer {
  * @sc_dsync_inode: inode whose data pages are written for a sync operation
  * @sc_dsync_start: start byte offset of data pages
  * @sc_dsync_end: end byte offset of data pages (inclusive)
+ * @sc_dsync_isize: file size recorded in data-sync logs, or -1 if none
  * @sc_segbufs: List of segment buffers
  * @sc_write_logs: List of segment buffers to hold logs under writing
  * @sc_segbuf_nblocks: Number of available blocks in segment buffers.
@@ -96,6 +117,8 @@ struct nilfs_segsum_pointer {
  * @sc_binfo_ptr: pointer to the current binfo struct in the segment summary
  * @sc_blk_cnt:	Block count of a file
  * @sc_datablk_cnt: Data block count of a file
+ * @sc_run_blkoff: Block offset that extends the current run of data blocks
+ * @sc_run_vblocknr: Virtual block number that extends the current run
  * @sc_nblk_this_inc: Number of blocks included in the current logical segment
  * @sc_seg_ctime: Creation time
  * @sc_cno: checkpoint number of current log
@@ -104,18 +127,17 @@ struct nilfs_segsum_pointer {
  * @sc_state: Segctord state flags
  * @sc_flush_request: inode bitmap of metadata files to be flushed
  * @sc_wait_request: Client request queue
- * @sc_wait_daemon: Daemon wait queue
- * @sc_wait_task: Start/end wait queue to control segctord task
+ * @sc_work: Work to execute requested constructions
  * @sc_seq_request: Request counter
  * @sc_seq_accept: Accepted request count
  * @sc_seq_done: Completion counter
+ * @sc_ioprio: Highest I/O priority of tasks waiting for a checkpoint, or 0
  * @sc_sync: Request of explicit sync operation
  * @sc_interval: Timeout value of background construction
  * @sc_mjcp_freq: Frequency of creating checkpoints
  * @sc_lseg_stime: Start time of the latest logical segment
  * @sc_watermark: Watermark for the number of dirty buffers
  * @sc_timer: Timer for segctord
- * @sc_task: current thread of segctord
  */
 struct nilfs_sc_info {
 	struct super_block     *sc_super;
@@ -134,6 +156,7 @@ struct nilfs_sc_info {
 	struct nilfs_inode_info *sc_dsync_inode;
 	loff_t			sc_dsync_start;
 	loff_t			sc_dsync_end;
+	loff_t			sc_dsync_isize;
 
 	/* Segment buffers */
 	struct list_head	sc_segbufs;
@@ -147,6 +170,8 @@ struct nilfs_sc_info {
 	struct nilfs_segsum_pointer sc_binfo_ptr;
 	unsigned long		sc_blk_cnt;
 	unsigned long		sc_datablk_cnt;
+	__u64			sc_run_blkoff;
+	__u64			sc_run_vblocknr;
 	unsigned long		sc_nblk_this_inc;
 	time64_t		sc_seg_ctime;
 	__u64			sc_cno;
@@ -157,12 +182,12 @@ struct nilfs_sc_info {
 	unsigned long		sc_flush_request;
 
 	wait_queue_head_t	sc_wait_request;
-	wait_queue_head_t	sc_wait_daemon;
-	wait_queue_head_t	sc_wait_task;
+	struct work_struct	sc_work;
 
 	__u32			sc_seq_request;
 	__u32			sc_seq_accepted;
 	__u32			sc_seq_done;
+	unsigned short		sc_ioprio;
 
 	int			sc_sync;
 	unsigned long		sc_interval;
@@ -171,8 +196,6 @@ struct nilfs_sc_info {
 	unsigned long		sc_watermark;
 
 	struct timer_list	sc_timer;
-	struct task_struct     *sc_timer_task;
-	struct task_struct     *sc_task;
 };
 
 /* sc_flags */
@@ -228,16 +251,36 @@ extern struct kmem_cache *nilfs_transaction_cachep;
 extern void nilfs_relax_pressure_in_lock(struct super_block *);
 
 extern int nilfs_construct_segment(struct super_block *);
+int nilfs_construct_segment_async(struct super_block *sb,
+				  struct nilfs_segctor_wait_request *wrq,
+				  void (*complete)(struct nilfs_segctor_wait_request *));
 extern int nilfs_construct_dsync_segment(struct super_block *, struct inode *,
 					 loff_t, loff_t);
 extern void nilfs_flush_segment(struct super_block *, ino_t);
 extern int nilfs_clean_segments(struct super_block *, struct nilfs_argv *,
 				void **);
+int nilfs_move_log_head(struct super_block *sb, __u64 limit);
 
 int nilfs_attach_log_writer(struct super_block *sb, struct nilfs_root *root);
 void nilfs_detach_log_writer(struct super_block *sb);
+int nilfs_segctor_init_workqueues(void);
+void nilfs_segctor_destroy_workqueues(void);
 
 /* recovery.c */
+struct buffer_head *nilfs_read_log_header(struct the_nilfs *nilfs,
+					  sector_t start_blocknr,
+					  struct nilfs_segment_summary **sum);
+int nilfs_validate_log(struct the_nilfs *nilfs, u64 seg_seq,
+		       struct buffer_head *bh_sum,
+		       struct nilfs_segment_summary *sum);
+void *nilfs_read_summary_info(struct the_nilfs *nilfs,
+			      struct buffer_head **pbh,
+			      unsigned int *offset, unsigned int bytes);
+unsigned long nilfs_read_data_binfo(struct the_nilfs *nilfs,
+				    struct buffer_head **pbh,
+				    unsigned int *offset, unsigned int flags,
+				    unsigned long ndatablk, __u64 *vblocknr,
+				    __u64 *blkoff);
 extern int nilfs_read_super_root_block(struct the_nilfs *, sector_t,
 				       struct buffer_head **, int);
 extern int nilfs_search_super_root(struct the_nilfs *,
@@ -281,6 +281,23 @@ int nilfs_sufile_set_alloc_range(struct inode *sufile, __u64 start, __u64 end)
 	return ret;
 }
 
+/**
+ * nilfs_sufile_get_alloc_range - get range of segment to be allocated
+ * @sufile: inode of segment usage file
+ * @start: place to store minimum segment number of allocatable region
+ * @end: place to store maximum segment number of allocatable region
+ */
+void nilfs_sufile_get_alloc_range(struct inode *sufile, __u64 *start,
+				  __u64 *end)
+{
+	struct nilfs_sufile_info *sui = NILFS_SUI(sufile);
+
+	down_read(&NILFS_MDT(sufile)->mi_sem);
+	*start = sui->allocmin;
+	*end = sui->allocmax;
+	up_read(&NILFS_MDT(sufile)->mi_sem);
+}
+
 /**
  * nilfs_sufile_alloc - allocate a segment
  * @sufile: inode of segment usage file
@@ -159,10 +159,11 @@ struct inode *nilfs_alloc_inode(struct super_block *sb)
 	ii->i_cno = 0;
 	ii->i_assoc_inode = NULL;
 	ii->i_bmap = &ii->i_bmap_data;
+	nilfs_inode_stat_init(&ii->vfs_inode);
 	return &ii->vfs_inode;
 }
 
-static void nilfs_free_inode(struct inode *inode)
+void nilfs_free_inode(struct inode *inode)
 {
 	if (nilfs_is_metadata_file_inode(inode))
 		nilfs_mdt_destroy(inode);
@@ -394,12 +395,15 @@ static int nilfs_move_2nd_super(struct super_block *sb, loff_t sb2off)
  * nilfs_resize_fs - resize the filesystem
  * @sb: super block instance
  * @newsize: new size of the filesystem (in bytes)
+ *
+ * When shrinking, segments in use beyond @newsize are emptied by
+ * nilfs_evacuate_segments() before they are truncated.
  */
 int nilfs_resize_fs(struct super_block *sb, __u64 newsize)
 {
 	struct the_nilfs *nilfs = sb->s_fs_info;
 	struct nilfs_super_block **sbp;
-	__u64 devsize, newnsegs;
+	__u64 devsize, newnsegs, allocmin, allocmax;
 	loff_t sb2off;
 	int ret;
 
@@ -430,6 +434,24 @@ int nilfs_resize_fs(struct super_block *sb, __u64 newsize)
 
 	ret = nilfs_sufile_resize(nilfs->ns_sufile, newnsegs);
 	up_write(&nilfs->ns_segctor_sem);
+	if (ret == -EBUSY) {
+		/*
+		 * Relocate live blocks out of the segments to be truncated.
+		 * This narrows the allocatable range, so keep the one set by
+		 * NILFS_IOCTL_SET_ALLOC_RANGE to restore it on failure.
+		 */
+		nilfs_sufile_get_alloc_range(nilfs->ns_sufile, &allocmin,
+					     &allocmax);
+		ret = nilfs_evacuate_segments(sb, newnsegs);
+		if (!ret) {
+			down_write(&nilfs->ns_segctor_sem);
+			ret = nilfs_sufile_resize(nilfs->ns_sufile, newnsegs);
+			up_write(&nilfs->ns_segctor_sem);
+		}
+		if (ret < 0)
+			nilfs_sufile_set_alloc_range(nilfs->ns_sufile,
+						     allocmin, allocmax);
+	}
 	if (ret < 0)
 		goto out;
 
@@ -474,6 +496,10 @@ static void nilfs_put_super(struct super_block *sb)
 {
 	struct the_nilfs *nilfs = sb->s_fs_info;
 
+	nilfs_destroy_scrub(nilfs);
+	nilfs_stop_orphan_purge(nilfs);
+	nilfs_cancel_ifile_prefetch(nilfs);
+	nilfs_fh_cache_forget(nilfs, 0);
 	nilfs_detach_log_writer(sb);
 
 	if (!sb_rdonly(sb)) {
@@ -482,6 +508,7 @@ static void nilfs_put_super(struct super_block *sb)
 		up_write(&nilfs->ns_sem);
 	}
 
+	nilfs_mdt_unregister_shrinker(nilfs);
 	nilfs_sysfs_delete_device_group(nilfs);
 	iput(nilfs->ns_sufile);
 	iput(nilfs->ns_cpfile);
@@ -558,8 +585,16 @@ int nilfs_attach_checkpoint(struct super_block *sb, __u64 cno, int curr_mnt,
 	atomic64_set(&root->blocks_count,
 			le64_to_cpu(raw_cp->cp_blocks_count));
 
+	/* without the maintained count, statfs counts it from the ifile */
+	err = nilfs_ifile_init_free_count(root->ifile);
+	if (unlikely(err))
+		nilfs_warn(sb, "failed to count free inodes: err=%d", err);
+
 	nilfs_cpfile_put_checkpoint(nilfs->ns_cpfile, cno, bh_cp);
 
+	if (nilfs_test_opt(nilfs, IFILE_PREFETCH))
+		nilfs_queue_ifile_prefetch(root);
+
  reuse:
 	*rootp = root;
 	return 0;
@@ -635,6 +670,13 @@ static int nilfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 	if (unlikely(err))
 		return err;
 
+	if (nilfs_test_opt(nilfs, STATFS_RECLAIMABLE)) {
+		sector_t nreclaimable;
+
+		nilfs_count_reclaimable_blocks(nilfs, &nreclaimable);
+		nfreeblocks += nreclaimable;
+	}
+
 	err = nilfs_ifile_count_free_inodes(root->ifile,
 					    &nmaxinodes, &nfreeinodes);
 	if (unlikely(err)) {
@@ -687,6 +729,12 @@ static int nilfs_show_options(struct seq_file *seq, struct dentry *dentry)
 		seq_puts(seq, ",norecovery");
 	if (nilfs_test_opt(nilfs, DISCARD))
 		seq_puts(seq, ",discard");
+	if (nilfs_test_opt(nilfs, STATFS_RECLAIMABLE))
+		seq_puts(seq, ",statfs=reclaimable");
+	if (nilfs_test_opt(nilfs, IFILE_PREFETCH))
+		seq_puts(seq, ",prefetch");
+	if (nilfs_test_opt(nilfs, DSYNC_ISIZE))
+		seq_puts(seq, ",dsync_isize");
 
 	return 0;
 }
@@ -708,7 +756,8 @@ static const struct super_operations nilfs_sops = {
 enum {
 	Opt_err_cont, Opt_err_panic, Opt_err_ro,
 	Opt_barrier, Opt_nobarrier, Opt_snapshot, Opt_order, Opt_norecovery,
-	Opt_discard, Opt_nodiscard, Opt_err,
+	Opt_discard, Opt_nodiscard, Opt_statfs, Opt_prefetch, Opt_noprefetch,
+	Opt_dsync_isize, Opt_nodsync_isize, Opt_err,
 };
 
 static match_table_t tokens = {
@@ -722,6 +771,11 @@ static match_table_t tokens = {
 	{Opt_norecovery, "norecovery"},
 	{Opt_discard, "discard"},
 	{Opt_nodiscard, "nodiscard"},
+	{Opt_statfs, "statfs=%s"},
+	{Opt_prefetch, "prefetch"},
+	{Opt_noprefetch, "noprefetch"},
+	{Opt_dsync_isize, "dsync_isize"},
+	{Opt_nodsync_isize, "nodsync_isize"},
 	{Opt_err, NULL}
 };
 
@@ -784,6 +838,28 @@ static int parse_options(char *options, struct super_block *sb, int is_remount)
 		case Opt_nodiscard:
 			nilfs_clear_opt(nilfs, DISCARD);
 			break;
+		case Opt_statfs:
+			if (strcmp(args[0].from, "clean") == 0)
+				/* Count only clean segments as free */
+				nilfs_clear_opt(nilfs, STATFS_RECLAIMABLE);
+			else if (strcmp(args[0].from, "reclaimable") == 0)
+				/* Also count blocks reclaimable by GC */
+				nilfs_set_opt(nilfs, STATFS_RECLAIMABLE);
+			else
+				return 0;
+			break;
+		case Opt_prefetch:
+			nilfs_set_opt(nilfs, IFILE_PREFETCH);
+			break;
+		case Opt_noprefetch:
+			nilfs_clear_opt(nilfs, IFILE_PREFETCH);
+			break;
+		case Opt_dsync_isize:
+			nilfs_set_opt(nilfs, DSYNC_ISIZE);
+			break;
+		case Opt_nodsync_isize:
+			nilfs_clear_opt(nilfs, DSYNC_ISIZE);
+			break;
 		default:
 			nilfs_err(sb, "unrecognized mount option \"%s\"", p);
 			return 0;
@@ -1070,13 +1146,17 @@ nilfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (err)
 		goto failed_nilfs;
 
+	err = nilfs_mdt_register_shrinker(nilfs);
+	if (err)
+		goto failed_unload;
+
 	cno = nilfs_last_cno(nilfs);
 	err = nilfs_attach_checkpoint(sb, cno, true, &fsroot);
 	if (err) {
 		nilfs_err(sb,
 			  "error %d while loading last checkpoint (checkpoint number=%llu)",
 			  err, (unsigned long long)cno);
-		goto failed_unload;
+		goto failed_shrinker;
 	}
 
 	if (!sb_rdonly(sb)) {
@@ -1095,6 +1175,7 @@ nilfs_fill_super(struct super_block *sb, void *data, int silent)
 		down_write(&nilfs->ns_sem);
 		nilfs_setup_super(sb, true);
 		up_write(&nilfs->ns_sem);
+		nilfs_start_orphan_purge(nilfs);
 	}
 
 	return 0;
@@ -1103,8 +1184,12 @@ nilfs_fill_super(struct super_block *sb, void *data, int silent)
 	nilfs_detach_log_writer(sb);
 
  failed_checkpoint:
+	nilfs_cancel_ifile_prefetch(nilfs);
 	nilfs_put_root(fsroot);
 
+ failed_shrinker:
+	nilfs_mdt_unregister_shrinker(nilfs);
+
  failed_unload:
 	nilfs_sysfs_delete_device_group(nilfs);
 	iput(nilfs->ns_sufile);
@@ -1144,6 +1229,11 @@ static int nilfs_remount(struct super_block *sb, int *flags, char *data)
 	if ((bool)(*flags & SB_RDONLY) == sb_rdonly(sb))
 		goto out;
 	if (*flags & SB_RDONLY) {
+		nilfs_stop_scrub(nilfs);
+		/* write back orphans whose purge was interrupted */
+		nilfs_stop_orphan_purge(nilfs);
+		sync_filesystem(sb);
+
 		sb->s_flags |= SB_RDONLY;
 
 		/*
@@ -1184,6 +1274,7 @@ static int nilfs_remount(struct super_block *sb, int *flags, char *data)
 		down_write(&nilfs->ns_sem);
 		nilfs_setup_super(sb, true);
 		up_write(&nilfs->ns_sem);
+		nilfs_start_orphan_purge(nilfs);
 	}
  out:
 	return 0;
@@ -1451,10 +1542,14 @@ static int __init init_nilfs_fs(void)
 	if (err)
 		goto fail;
 
-	err = nilfs_sysfs_init();
+	err = nilfs_segctor_init_workqueues();
 	if (err)
 		goto free_cachep;
 
+	err = nilfs_sysfs_init();
+	if (err)
+		goto destroy_workqueues;
+
 	err = register_filesystem(&nilfs_fs_type);
 	if (err)
 		goto deinit_sysfs_entry;
@@ -1464,6 +1559,8 @@ static int __init init_nilfs_fs(void)
 
 deinit_sysfs_entry:
 	nilfs_sysfs_exit();
+destroy_workqueues:
+	nilfs_segctor_destroy_workqueues();
 free_cachep:
 	nilfs_destroy_cachep();
 fail:
@@ -1475,6 +1572,7 @@ static void __exit exit_nilfs_fs(void)
 	nilfs_destroy_cachep();
 	nilfs_sysfs_exit();
 	unregister_filesystem(&nilfs_fs_type);
+	nilfs_segctor_destroy_workqueues();
 }
 
 module_init(init_nilfs_fs)
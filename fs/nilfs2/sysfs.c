@@ -401,13 +401,133 @@ nilfs_segments_dirty_segments_show(struct nilfs_segments_attr *attr,
 	return sysfs_emit(buf, "%llu\n", sustat.ss_ndirtysegs);
 }
 
+static ssize_t
+nilfs_segments_reclaimable_blocks_show(struct nilfs_segments_attr *attr,
+					struct the_nilfs *nilfs,
+					char *buf)
+{
+	sector_t nblocks;
+
+	nilfs_count_reclaimable_blocks(nilfs, &nblocks);
+	return sysfs_emit(buf, "%llu\n", (unsigned long long)nblocks);
+}
+
+static ssize_t
+nilfs_segments_scrub_show(struct nilfs_segments_attr *attr,
+			  struct the_nilfs *nilfs,
+			  char *buf)
+{
+	unsigned int nbad;
+	__u64 segnum;
+	bool running;
+
+	running = nilfs_scrub_status(nilfs, &segnum, NULL, &nbad);
+	return sysfs_emit(buf, "%d\n", running);
+}
+
+static ssize_t
+nilfs_segments_scrub_store(struct nilfs_segments_attr *attr,
+			   struct the_nilfs *nilfs,
+			   const char *buf, size_t count)
+{
+	bool val;
+	int err;
+
+	err = kstrtobool(skip_spaces(buf), &val);
+	if (err) {
+		nilfs_err(nilfs->ns_sb, "unable to convert string: err=%d",
+			  err);
+		return err;
+	}
+
+	if (!val) {
+		nilfs_stop_scrub(nilfs);
+		return count;
+	}
+
+	err = nilfs_start_scrub(nilfs);
+	return err ? err : count;
+}
+
+static ssize_t
+nilfs_segments_scrub_rate_show(struct nilfs_segments_attr *attr,
+			       struct the_nilfs *nilfs,
+			       char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(nilfs->ns_scrub_rate));
+}
+
+static ssize_t
+nilfs_segments_scrub_rate_store(struct nilfs_segments_attr *attr,
+				struct the_nilfs *nilfs,
+				const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	err = kstrtoul(skip_spaces(buf), 0, &val);
+	if (err) {
+		nilfs_err(nilfs->ns_sb, "unable to convert string: err=%d",
+			  err);
+		return err;
+	}
+
+	WRITE_ONCE(nilfs->ns_scrub_rate, val);
+	return count;
+}
+
+static ssize_t
+nilfs_segments_scrub_position_show(struct nilfs_segments_attr *attr,
+				   struct the_nilfs *nilfs,
+				   char *buf)
+{
+	unsigned int nbad;
+	__u64 segnum;
+
+	nilfs_scrub_status(nilfs, &segnum, NULL, &nbad);
+	return sysfs_emit(buf, "%llu\n", segnum);
+}
+
+static ssize_t
+nilfs_segments_scrub_bad_segments_show(struct nilfs_segments_attr *attr,
+				       struct the_nilfs *nilfs,
+				       char *buf)
+{
+	__u64 bad[NILFS_SCRUB_MAX_REPORTED];
+	unsigned int i, nbad;
+	__u64 segnum;
+	int len = 0;
+
+	nilfs_scrub_status(nilfs, &segnum, bad, &nbad);
+	for (i = 0; i < min_t(unsigned int, nbad, NILFS_SCRUB_MAX_REPORTED);
+	     i++)
+		len += sysfs_emit_at(buf, len, "%s%llu", i ? " " : "", bad[i]);
+	if (nbad > NILFS_SCRUB_MAX_REPORTED)
+		len += sysfs_emit_at(buf, len, " ...");
+	len += sysfs_emit_at(buf, len, "\n");
+	return len;
+}
+
 static const char segments_readme_str[] =
 	"The segments group contains attributes that describe\n"
 	"details about volume's segments.\n\n"
 	"(1) segments_number\n\tshow number of segments on volume.\n\n"
 	"(2) blocks_per_segment\n\tshow number of blocks in segment.\n\n"
 	"(3) clean_segments\n\tshow count of clean segments.\n\n"
-	"(4) dirty_segments\n\tshow count of dirty segments.\n\n";
+	"(4) dirty_segments\n\tshow count of dirty segments.\n\n"
+	"(5) reclaimable_blocks\n"
+	"\tshow estimated count of blocks that GC can reclaim.\n\n"
+	"(6) scrub\n"
+	"\tshow whether the scrubber is running, or write 1 to start\n"
+	"\tverifying checksums of logs in all in-use segments and 0 to\n"
+	"\tstop it.\n\n"
+	"(7) scrub_rate\n"
+	"\tshow/set I/O budget of the scrubber in KiB/s (0 means no limit).\n\n"
+	"(8) scrub_position\n"
+	"\tshow next segment number to be scrubbed.\n\n"
+	"(9) scrub_bad_segments\n"
+	"\tshow numbers of segments found broken by the last scrub, which\n"
+	"\tare marked erroneous.\n\n";
 
 static ssize_t
 nilfs_segments_README_show(struct nilfs_segments_attr *attr,
@@ -421,6 +541,11 @@ NILFS_SEGMENTS_RO_ATTR(segments_number);
 NILFS_SEGMENTS_RO_ATTR(blocks_per_segment);
 NILFS_SEGMENTS_RO_ATTR(clean_segments);
 NILFS_SEGMENTS_RO_ATTR(dirty_segments);
+NILFS_SEGMENTS_RO_ATTR(reclaimable_blocks);
+NILFS_SEGMENTS_RW_ATTR(scrub);
+NILFS_SEGMENTS_RW_ATTR(scrub_rate);
+NILFS_SEGMENTS_RO_ATTR(scrub_position);
+NILFS_SEGMENTS_RO_ATTR(scrub_bad_segments);
 NILFS_SEGMENTS_RO_ATTR(README);
 
 static struct attribute *nilfs_segments_attrs[] = {
@@ -428,6 +553,11 @@ static struct attribute *nilfs_segments_attrs[] = {
 	NILFS_SEGMENTS_ATTR_LIST(blocks_per_segment),
 	NILFS_SEGMENTS_ATTR_LIST(clean_segments),
 	NILFS_SEGMENTS_ATTR_LIST(dirty_segments),
+	NILFS_SEGMENTS_ATTR_LIST(reclaimable_blocks),
+	NILFS_SEGMENTS_ATTR_LIST(scrub),
+	NILFS_SEGMENTS_ATTR_LIST(scrub_rate),
+	NILFS_SEGMENTS_ATTR_LIST(scrub_position),
+	NILFS_SEGMENTS_ATTR_LIST(scrub_bad_segments),
 	NILFS_SEGMENTS_ATTR_LIST(README),
 	NULL,
 };
@@ -624,6 +754,79 @@ nilfs_segctor_dirty_data_blocks_count_show(struct nilfs_segctor_attr *attr,
 	return sysfs_emit(buf, "%u\n", ndirtyblks);
 }
 
+#define NILFS_SYSFS_TOP_WRITERS	16
+
+struct nilfs_top_writer {
+	u64 blocks;
+	ino_t ino;
+	__u64 cno;
+	u64 stats[NILFS_ISTAT_NR];
+};
+
+static ssize_t
+nilfs_segctor_top_writers_show(struct nilfs_segctor_attr *attr,
+			       struct the_nilfs *nilfs,
+			       char *buf)
+{
+	struct super_block *sb = nilfs->ns_sb;
+	struct nilfs_top_writer *top, *w;
+	struct nilfs_inode_info *ii;
+	struct inode *inode;
+	ssize_t count;
+	int i, n = 0;
+	u64 blocks;
+
+	top = kcalloc(NILFS_SYSFS_TOP_WRITERS, sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		ii = NILFS_I(inode);
+		if (test_bit(NILFS_I_GCINODE, &ii->i_state) ||
+		    test_bit(NILFS_I_BTNC, &ii->i_state) ||
+		    test_bit(NILFS_I_SHADOW, &ii->i_state))
+			continue;
+
+		blocks = nilfs_inode_stat_read(inode, NILFS_ISTAT_LOG_BLOCKS) +
+			nilfs_inode_stat_read(inode, NILFS_ISTAT_GC_BLOCKS);
+		if (!blocks)
+			continue;
+		if (n < NILFS_SYSFS_TOP_WRITERS)
+			i = n++;
+		else if (blocks > top[n - 1].blocks)
+			i = n - 1;
+		else
+			continue;
+
+		/* keep the array sorted in descending order of blocks */
+		for (; i > 0 && top[i - 1].blocks < blocks; i--)
+			top[i] = top[i - 1];
+		w = &top[i];
+		w->blocks = blocks;
+		w->ino = inode->i_ino;
+		w->cno = ii->i_root ? ii->i_root->cno : 0;
+		for (i = 0; i < NILFS_ISTAT_NR; i++)
+			w->stats[i] = nilfs_inode_stat_read(inode, i);
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+
+	count = sysfs_emit(buf,
+			   "ino cno log_blocks gc_blocks dat_allocs dsync_logs\n");
+	for (i = 0; i < n; i++) {
+		w = &top[i];
+		count += sysfs_emit_at(buf, count,
+				       "%lu %llu %llu %llu %llu %llu\n",
+				       w->ino, w->cno,
+				       w->stats[NILFS_ISTAT_LOG_BLOCKS],
+				       w->stats[NILFS_ISTAT_GC_BLOCKS],
+				       w->stats[NILFS_ISTAT_DAT_ALLOCS],
+				       w->stats[NILFS_ISTAT_DSYNC_LOGS]);
+	}
+	kfree(top);
+	return count;
+}
+
 static const char segctor_readme_str[] =
 	"The segctor group contains attributes that describe\n"
 	"segctor thread activity details.\n\n"
@@ -652,7 +855,11 @@ static const char segctor_readme_str[] =
 	"\tshow write time of the last segment not for cleaner operation "
 	"in seconds.\n\n"
 	"(13) dirty_data_blocks_count\n"
-	"\tshow number of dirty data blocks.\n\n";
+	"\tshow number of dirty data blocks.\n\n"
+	"(14) top_writers\n"
+	"\tshow in-memory inodes that wrote the most blocks to logs,\n"
+	"\tincluding blocks relocated by GC (needs\n"
+	"\tCONFIG_NILFS2_FS_INODE_STATS).\n\n";
 
 static ssize_t
 nilfs_segctor_README_show(struct nilfs_segctor_attr *attr,
@@ -674,6 +881,7 @@ NILFS_SEGCTOR_RO_ATTR(last_seg_write_time_secs);
 NILFS_SEGCTOR_RO_ATTR(last_nongc_write_time);
 NILFS_SEGCTOR_RO_ATTR(last_nongc_write_time_secs);
 NILFS_SEGCTOR_RO_ATTR(dirty_data_blocks_count);
+NILFS_SEGCTOR_RO_ATTR(top_writers);
 NILFS_SEGCTOR_RO_ATTR(README);
 
 static struct attribute *nilfs_segctor_attrs[] = {
@@ -690,6 +898,7 @@ static struct attribute *nilfs_segctor_attrs[] = {
 	NILFS_SEGCTOR_ATTR_LIST(last_nongc_write_time),
 	NILFS_SEGCTOR_ATTR_LIST(last_nongc_write_time_secs),
 	NILFS_SEGCTOR_ATTR_LIST(dirty_data_blocks_count),
+	NILFS_SEGCTOR_ATTR_LIST(top_writers),
 	NILFS_SEGCTOR_ATTR_LIST(README),
 	NULL,
 };
@@ -699,6 +908,310 @@ NILFS_DEV_INT_GROUP_OPS(segctor, dev);
 NILFS_DEV_INT_GROUP_TYPE(segctor, dev);
 NILFS_DEV_INT_GROUP_FNS(segctor, dev);
 
+/************************************************************************
+ *                        NILFS recovery attrs                          *
+ ************************************************************************/
+
+static ssize_t
+nilfs_recovery_search_time_us_show(struct nilfs_recovery_attr *attr,
+				   struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n",
+			  div_u64(nilfs->ns_recovery_search_ns, NSEC_PER_USEC));
+}
+
+static ssize_t
+nilfs_recovery_rollforward_time_us_show(struct nilfs_recovery_attr *attr,
+					struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n",
+			  div_u64(nilfs->ns_recovery_rollforward_ns,
+				  NSEC_PER_USEC));
+}
+
+static ssize_t
+nilfs_recovery_total_time_us_show(struct nilfs_recovery_attr *attr,
+				  struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n",
+			  div_u64(nilfs->ns_recovery_total_ns, NSEC_PER_USEC));
+}
+
+static ssize_t
+nilfs_recovery_scanned_logs_show(struct nilfs_recovery_attr *attr,
+				 struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", nilfs->ns_recovery_scanned_logs);
+}
+
+static ssize_t
+nilfs_recovery_salvaged_blocks_show(struct nilfs_recovery_attr *attr,
+				    struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", nilfs->ns_recovery_salvaged_blocks);
+}
+
+static const char recovery_readme_str[] =
+	"The recovery group contains attributes that describe the recovery\n"
+	"done when the device was mounted.\n\n"
+	"(1) search_time_us\n"
+	"\tshow time taken to search the latest super root (in microseconds).\n\n"
+	"(2) rollforward_time_us\n"
+	"\tshow time taken to roll forward logs written after the latest\n"
+	"\tcheckpoint (in microseconds).\n\n"
+	"(3) total_time_us\n"
+	"\tshow time taken to load and recover the file system "
+	"(in microseconds).\n\n"
+	"(4) scanned_logs\n\tshow number of logs read during recovery.\n\n"
+	"(5) salvaged_blocks\n"
+	"\tshow number of blocks salvaged by roll-forward.\n\n";
+
+static ssize_t
+nilfs_recovery_README_show(struct nilfs_recovery_attr *attr,
+			   struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, recovery_readme_str);
+}
+
+NILFS_RECOVERY_RO_ATTR(search_time_us);
+NILFS_RECOVERY_RO_ATTR(rollforward_time_us);
+NILFS_RECOVERY_RO_ATTR(total_time_us);
+NILFS_RECOVERY_RO_ATTR(scanned_logs);
+NILFS_RECOVERY_RO_ATTR(salvaged_blocks);
+NILFS_RECOVERY_RO_ATTR(README);
+
+static struct attribute *nilfs_recovery_attrs[] = {
+	NILFS_RECOVERY_ATTR_LIST(search_time_us),
+	NILFS_RECOVERY_ATTR_LIST(rollforward_time_us),
+	NILFS_RECOVERY_ATTR_LIST(total_time_us),
+	NILFS_RECOVERY_ATTR_LIST(scanned_logs),
+	NILFS_RECOVERY_ATTR_LIST(salvaged_blocks),
+	NILFS_RECOVERY_ATTR_LIST(README),
+	NULL,
+};
+ATTRIBUTE_GROUPS(nilfs_recovery);
+
+NILFS_DEV_INT_GROUP_OPS(recovery, dev);
+NILFS_DEV_INT_GROUP_TYPE(recovery, dev);
+NILFS_DEV_INT_GROUP_FNS(recovery, dev);
+
+/************************************************************************
+ *                        NILFS mdt_cache attrs                         *
+ ************************************************************************/
+
+static ssize_t
+nilfs_mdt_cache_soft_limit_store(struct the_nilfs *nilfs, int type,
+				 const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	err = kstrtoul(skip_spaces(buf), 0, &val);
+	if (err) {
+		nilfs_err(nilfs->ns_sb, "unable to convert string: err=%d",
+			  err);
+		return err;
+	}
+
+	WRITE_ONCE(nilfs->ns_mdt_soft_limit[type], val);
+	return count;
+}
+
+static ssize_t
+nilfs_mdt_cache_dat_pages_show(struct nilfs_mdt_cache_attr *attr,
+			       struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  nilfs_mdt_cache_nrpages(nilfs, NILFS_MDT_CACHE_DAT,
+						  false));
+}
+
+static ssize_t
+nilfs_mdt_cache_ifile_pages_show(struct nilfs_mdt_cache_attr *attr,
+				 struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  nilfs_mdt_cache_nrpages(nilfs, NILFS_MDT_CACHE_IFILE,
+						  false));
+}
+
+static ssize_t
+nilfs_mdt_cache_cpfile_pages_show(struct nilfs_mdt_cache_attr *attr,
+				  struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  nilfs_mdt_cache_nrpages(nilfs, NILFS_MDT_CACHE_CPFILE,
+						  false));
+}
+
+static ssize_t
+nilfs_mdt_cache_sufile_pages_show(struct nilfs_mdt_cache_attr *attr,
+				  struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  nilfs_mdt_cache_nrpages(nilfs, NILFS_MDT_CACHE_SUFILE,
+						  false));
+}
+
+static ssize_t
+nilfs_mdt_cache_btnode_pages_show(struct nilfs_mdt_cache_attr *attr,
+				  struct the_nilfs *nilfs, char *buf)
+{
+	unsigned long nrpages = 0;
+	int type;
+
+	for (type = 0; type < NILFS_MDT_CACHE_NR; type++)
+		nrpages += nilfs_mdt_cache_nrpages(nilfs, type, true);
+
+	return sysfs_emit(buf, "%lu\n", nrpages);
+}
+
+static ssize_t
+nilfs_mdt_cache_gc_pages_show(struct nilfs_mdt_cache_attr *attr,
+			      struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(nilfs->ns_gc_cache_pages));
+}
+
+static ssize_t
+nilfs_mdt_cache_dat_soft_limit_show(struct nilfs_mdt_cache_attr *attr,
+				    struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  READ_ONCE(nilfs->ns_mdt_soft_limit[NILFS_MDT_CACHE_DAT]));
+}
+
+static ssize_t
+nilfs_mdt_cache_dat_soft_limit_store(struct nilfs_mdt_cache_attr *attr,
+				     struct the_nilfs *nilfs,
+				     const char *buf, size_t count)
+{
+	return nilfs_mdt_cache_soft_limit_store(nilfs, NILFS_MDT_CACHE_DAT,
+						buf, count);
+}
+
+static ssize_t
+nilfs_mdt_cache_ifile_soft_limit_show(struct nilfs_mdt_cache_attr *attr,
+				      struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  READ_ONCE(nilfs->ns_mdt_soft_limit[NILFS_MDT_CACHE_IFILE]));
+}
+
+static ssize_t
+nilfs_mdt_cache_ifile_soft_limit_store(struct nilfs_mdt_cache_attr *attr,
+				       struct the_nilfs *nilfs,
+				       const char *buf, size_t count)
+{
+	return nilfs_mdt_cache_soft_limit_store(nilfs, NILFS_MDT_CACHE_IFILE,
+						buf, count);
+}
+
+static ssize_t
+nilfs_mdt_cache_cpfile_soft_limit_show(struct nilfs_mdt_cache_attr *attr,
+				       struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  READ_ONCE(nilfs->ns_mdt_soft_limit[NILFS_MDT_CACHE_CPFILE]));
+}
+
+static ssize_t
+nilfs_mdt_cache_cpfile_soft_limit_store(struct nilfs_mdt_cache_attr *attr,
+					struct the_nilfs *nilfs,
+					const char *buf, size_t count)
+{
+	return nilfs_mdt_cache_soft_limit_store(nilfs, NILFS_MDT_CACHE_CPFILE,
+						buf, count);
+}
+
+static ssize_t
+nilfs_mdt_cache_sufile_soft_limit_show(struct nilfs_mdt_cache_attr *attr,
+				       struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  READ_ONCE(nilfs->ns_mdt_soft_limit[NILFS_MDT_CACHE_SUFILE]));
+}
+
+static ssize_t
+nilfs_mdt_cache_sufile_soft_limit_store(struct nilfs_mdt_cache_attr *attr,
+					struct the_nilfs *nilfs,
+					const char *buf, size_t count)
+{
+	return nilfs_mdt_cache_soft_limit_store(nilfs, NILFS_MDT_CACHE_SUFILE,
+						buf, count);
+}
+
+static ssize_t
+nilfs_mdt_cache_reclaimed_pages_show(struct nilfs_mdt_cache_attr *attr,
+				     struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  atomic_long_read(&nilfs->ns_mdt_reclaimed));
+}
+
+static const char mdt_cache_readme_str[] =
+	"The mdt_cache group contains attributes that describe the page\n"
+	"caches of metadata files and control their reclamation.\n\n"
+	"(1) dat_pages\n\tshow number of pages cached for DAT.\n\n"
+	"(2) ifile_pages\n"
+	"\tshow number of pages cached for ifiles of the current checkpoint\n"
+	"\tand mounted snapshots.\n\n"
+	"(3) cpfile_pages\n\tshow number of pages cached for cpfile.\n\n"
+	"(4) sufile_pages\n\tshow number of pages cached for sufile.\n\n"
+	"(5) btnode_pages\n"
+	"\tshow number of B-tree node pages cached for metadata files.\n\n"
+	"(6) gc_pages\n"
+	"\tshow number of pages cached by GC inodes in the last GC pass.\n\n"
+	"(7) dat_soft_limit\n"
+	"(8) ifile_soft_limit\n"
+	"(9) cpfile_soft_limit\n"
+	"(10) sufile_soft_limit\n"
+	"\tshow/set number of pages above which the cache is trimmed first\n"
+	"\tunder memory pressure (0 means no limit).\n\n"
+	"(11) reclaimed_pages\n"
+	"\tshow number of pages reclaimed by the metadata file shrinker.\n\n";
+
+static ssize_t
+nilfs_mdt_cache_README_show(struct nilfs_mdt_cache_attr *attr,
+			    struct the_nilfs *nilfs, char *buf)
+{
+	return sysfs_emit(buf, mdt_cache_readme_str);
+}
+
+NILFS_MDT_CACHE_RO_ATTR(dat_pages);
+NILFS_MDT_CACHE_RO_ATTR(ifile_pages);
+NILFS_MDT_CACHE_RO_ATTR(cpfile_pages);
+NILFS_MDT_CACHE_RO_ATTR(sufile_pages);
+NILFS_MDT_CACHE_RO_ATTR(btnode_pages);
+NILFS_MDT_CACHE_RO_ATTR(gc_pages);
+NILFS_MDT_CACHE_RW_ATTR(dat_soft_limit);
+NILFS_MDT_CACHE_RW_ATTR(ifile_soft_limit);
+NILFS_MDT_CACHE_RW_ATTR(cpfile_soft_limit);
+NILFS_MDT_CACHE_RW_ATTR(sufile_soft_limit);
+NILFS_MDT_CACHE_RO_ATTR(reclaimed_pages);
+NILFS_MDT_CACHE_RO_ATTR(README);
+
+static struct attribute *nilfs_mdt_cache_attrs[] = {
+	NILFS_MDT_CACHE_ATTR_LIST(dat_pages),
+	NILFS_MDT_CACHE_ATTR_LIST(ifile_pages),
+	NILFS_MDT_CACHE_ATTR_LIST(cpfile_pages),
+	NILFS_MDT_CACHE_ATTR_LIST(sufile_pages),
+	NILFS_MDT_CACHE_ATTR_LIST(btnode_pages),
+	NILFS_MDT_CACHE_ATTR_LIST(gc_pages),
+	NILFS_MDT_CACHE_ATTR_LIST(dat_soft_limit),
+	NILFS_MDT_CACHE_ATTR_LIST(ifile_soft_limit),
+	NILFS_MDT_CACHE_ATTR_LIST(cpfile_soft_limit),
+	NILFS_MDT_CACHE_ATTR_LIST(sufile_soft_limit),
+	NILFS_MDT_CACHE_ATTR_LIST(reclaimed_pages),
+	NILFS_MDT_CACHE_ATTR_LIST(README),
+	NULL,
+};
+ATTRIBUTE_GROUPS(nilfs_mdt_cache);
+
+NILFS_DEV_INT_GROUP_OPS(mdt_cache, dev);
+NILFS_DEV_INT_GROUP_TYPE(mdt_cache, dev);
+NILFS_DEV_INT_GROUP_FNS(mdt_cache, dev);
+
 /************************************************************************
  *                        NILFS superblock attrs                        *
  ************************************************************************/
@@ -1013,8 +1526,22 @@ int nilfs_sysfs_create_device_group(struct super_block *sb)
 	if (err)
 		goto delete_superblock_group;
 
+	err = nilfs_sysfs_create_recovery_group(nilfs);
+	if (err)
+		goto delete_segctor_group;
+
+	err = nilfs_sysfs_create_mdt_cache_group(nilfs);
+	if (err)
+		goto delete_recovery_group;
+
 	return 0;
 
+delete_recovery_group:
+	nilfs_sysfs_delete_recovery_group(nilfs);
+
+delete_segctor_group:
+	nilfs_sysfs_delete_segctor_group(nilfs);
+
 delete_superblock_group:
 	nilfs_sysfs_delete_superblock_group(nilfs);
 
@@ -1042,6 +1569,8 @@ void nilfs_sysfs_delete_device_group(struct the_nilfs *nilfs)
 	nilfs_sysfs_delete_segments_group(nilfs);
 	nilfs_sysfs_delete_superblock_group(nilfs);
 	nilfs_sysfs_delete_segctor_group(nilfs);
+	nilfs_sysfs_delete_recovery_group(nilfs);
+	nilfs_sysfs_delete_mdt_cache_group(nilfs);
 	kobject_del(&nilfs->ns_dev_kobj);
 	kobject_put(&nilfs->ns_dev_kobj);
 	kfree(nilfs->ns_dev_subgroups);
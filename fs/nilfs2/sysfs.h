@@ -27,6 +27,10 @@
  * @sg_checkpoints_kobj_unregister: completion state
  * @sg_segments_kobj: /sys/fs/<nilfs>/<device>/segments
  * @sg_segments_kobj_unregister: completion state
+ * @sg_recovery_kobj: /sys/fs/<nilfs>/<device>/recovery
+ * @sg_recovery_kobj_unregister: completion state
+ * @sg_mdt_cache_kobj: /sys/fs/<nilfs>/<device>/mdt_cache
+ * @sg_mdt_cache_kobj_unregister: completion state
  */
 struct nilfs_sysfs_dev_subgroups {
 	/* /sys/fs/<nilfs>/<device>/superblock */
@@ -48,6 +52,14 @@ struct nilfs_sysfs_dev_subgroups {
 	/* /sys/fs/<nilfs>/<device>/segments */
 	struct kobject sg_segments_kobj;
 	struct completion sg_segments_kobj_unregister;
+
+	/* /sys/fs/<nilfs>/<device>/recovery */
+	struct kobject sg_recovery_kobj;
+	struct completion sg_recovery_kobj_unregister;
+
+	/* /sys/fs/<nilfs>/<device>/mdt_cache */
+	struct kobject sg_mdt_cache_kobj;
+	struct completion sg_mdt_cache_kobj_unregister;
 };
 
 #define NILFS_COMMON_ATTR_STRUCT(name) \
@@ -76,6 +88,8 @@ NILFS_DEV_ATTR_STRUCT(mounted_snapshots);
 NILFS_DEV_ATTR_STRUCT(checkpoints);
 NILFS_DEV_ATTR_STRUCT(superblock);
 NILFS_DEV_ATTR_STRUCT(segctor);
+NILFS_DEV_ATTR_STRUCT(recovery);
+NILFS_DEV_ATTR_STRUCT(mdt_cache);
 
 #define NILFS_CP_ATTR_STRUCT(name) \
 struct nilfs_##name##_attr { \
@@ -118,7 +132,7 @@ NILFS_CP_ATTR_STRUCT(snapshot);
 #define NILFS_SEGMENTS_RO_ATTR(name) \
 	NILFS_RO_ATTR(segments, name)
 #define NILFS_SEGMENTS_RW_ATTR(name) \
-	NILFS_RW_ATTR(segs_info, name)
+	NILFS_RW_ATTR(segments, name)
 
 #define NILFS_MOUNTED_SNAPSHOTS_RO_ATTR(name) \
 	NILFS_RO_ATTR(mounted_snapshots, name)
@@ -147,6 +161,14 @@ NILFS_CP_ATTR_STRUCT(snapshot);
 #define NILFS_SEGCTOR_RW_ATTR(name) \
 	NILFS_RW_ATTR(segctor, name)
 
+#define NILFS_RECOVERY_RO_ATTR(name) \
+	NILFS_RO_ATTR(recovery, name)
+
+#define NILFS_MDT_CACHE_RO_ATTR(name) \
+	NILFS_RO_ATTR(mdt_cache, name)
+#define NILFS_MDT_CACHE_RW_ATTR(name) \
+	NILFS_RW_ATTR(mdt_cache, name)
+
 #define NILFS_FEATURE_ATTR_LIST(name) \
 	(&nilfs_feature_attr_##name.attr)
 #define NILFS_DEV_ATTR_LIST(name) \
@@ -163,5 +185,9 @@ NILFS_CP_ATTR_STRUCT(snapshot);
 	(&nilfs_superblock_attr_##name.attr)
 #define NILFS_SEGCTOR_ATTR_LIST(name) \
 	(&nilfs_segctor_attr_##name.attr)
+#define NILFS_RECOVERY_ATTR_LIST(name) \
+	(&nilfs_recovery_attr_##name.attr)
+#define NILFS_MDT_CACHE_ATTR_LIST(name) \
+	(&nilfs_mdt_cache_attr_##name.attr)
 
 #endif /* _NILFS_SYSFS_H */
@@ -19,6 +19,7 @@
 #include "segment.h"
 #include "alloc.h"
 #include "cpfile.h"
+#include "ifile.h"
 #include "sufile.h"
 #include "dat.h"
 #include "segbuf.h"
@@ -68,11 +69,21 @@ struct the_nilfs *alloc_nilfs(struct super_block *sb)
 	mutex_init(&nilfs->ns_snapshot_mount_mutex);
 	INIT_LIST_HEAD(&nilfs->ns_dirty_files);
 	INIT_LIST_HEAD(&nilfs->ns_gc_inodes);
+	INIT_LIST_HEAD(&nilfs->ns_orphan_list);
+	INIT_WORK(&nilfs->ns_orphan_work, nilfs_orphan_purge_work);
+	mutex_init(&nilfs->ns_scrub_mutex);
+	nilfs->ns_scrub_rate = NILFS_SCRUB_DEFAULT_RATE;
+	INIT_LIST_HEAD(&nilfs->ns_prefetch_list);
+	INIT_WORK(&nilfs->ns_prefetch_work, nilfs_ifile_prefetch_work);
 	spin_lock_init(&nilfs->ns_inode_lock);
 	spin_lock_init(&nilfs->ns_next_gen_lock);
+	spin_lock_init(&nilfs->ns_orphan_lock);
+	spin_lock_init(&nilfs->ns_prefetch_lock);
+	spin_lock_init(&nilfs->ns_fh_cache_lock);
 	spin_lock_init(&nilfs->ns_last_segment_lock);
 	nilfs->ns_cptree = RB_ROOT;
 	spin_lock_init(&nilfs->ns_cptree_lock);
+	seqcount_spinlock_init(&nilfs->ns_cptree_seq, &nilfs->ns_cptree_lock);
 	init_rwsem(&nilfs->ns_segctor_sem);
 	nilfs->ns_sb_update_freq = NILFS_SB_FREQ;
 
@@ -101,7 +112,7 @@ static int nilfs_load_super_root(struct the_nilfs *nilfs,
 	struct nilfs_super_block **sbp = nilfs->ns_sbp;
 	struct nilfs_inode *rawi;
 	unsigned int dat_entry_size, segment_usage_size, checkpoint_size;
-	unsigned int inode_size;
+	unsigned int inode_size, sr_bytes;
 	int err;
 
 	err = nilfs_read_super_root_block(nilfs, sr_block, &bh_sr, 1);
@@ -135,10 +146,23 @@ static int nilfs_load_super_root(struct the_nilfs *nilfs,
 	raw_sr = (struct nilfs_super_root *)bh_sr->b_data;
 	nilfs->ns_nongc_ctime = le64_to_cpu(raw_sr->sr_nongc_ctime);
 
+	sr_bytes = le16_to_cpu(raw_sr->sr_bytes);
+	if (nilfs_has_dat_deltas(nilfs) &&
+	    sr_bytes > NILFS_SR_BYTES(inode_size)) {
+		err = nilfs_dat_read_deltas(nilfs->ns_dat, (void *)raw_sr +
+					    NILFS_SR_BYTES(inode_size),
+					    sr_bytes - NILFS_SR_BYTES(inode_size));
+		if (err)
+			goto failed_sufile;
+	}
+
  failed:
 	brelse(bh_sr);
 	return err;
 
+ failed_sufile:
+	iput(nilfs->ns_sufile);
+
  failed_cpfile:
 	iput(nilfs->ns_cpfile);
 
@@ -235,6 +259,7 @@ int load_nilfs(struct the_nilfs *nilfs, struct super_block *sb)
 	unsigned int s_flags = sb->s_flags;
 	int really_read_only = bdev_read_only(nilfs->ns_bdev);
 	int valid_fs = nilfs_valid_fs(nilfs);
+	u64 start, t;
 	int err;
 
 	if (!valid_fs) {
@@ -249,6 +274,7 @@ int load_nilfs(struct the_nilfs *nilfs, struct super_block *sb)
 
 	nilfs_init_recovery_info(&ri);
 
+	start = ktime_get_ns();
 	err = nilfs_search_super_root(nilfs, &ri);
 	if (unlikely(err)) {
 		struct nilfs_super_block **sbp = nilfs->ns_sbp;
@@ -297,6 +323,7 @@ int load_nilfs(struct the_nilfs *nilfs, struct super_block *sb)
 		if (err)
 			goto scan_error;
 	}
+	nilfs->ns_recovery_search_ns = ktime_get_ns() - start;
 
 	err = nilfs_load_super_root(nilfs, sb, ri.ri_super_root);
 	if (unlikely(err)) {
@@ -342,9 +369,11 @@ int load_nilfs(struct the_nilfs *nilfs, struct super_block *sb)
 		goto failed_unload;
 	}
 
+	t = ktime_get_ns();
 	err = nilfs_salvage_orphan_logs(nilfs, sb, &ri);
 	if (err)
 		goto failed_unload;
+	nilfs->ns_recovery_rollforward_ns = ktime_get_ns() - t;
 
 	down_write(&nilfs->ns_sem);
 	nilfs->ns_mount_state |= NILFS_VALID_FS; /* set "clean" flag */
@@ -360,6 +389,9 @@ int load_nilfs(struct the_nilfs *nilfs, struct super_block *sb)
 	nilfs_info(sb, "recovery complete");
 
  skip_recovery:
+	nilfs->ns_recovery_scanned_logs = ri.ri_nscanned_logs;
+	nilfs->ns_recovery_salvaged_blocks = ri.ri_nsalvaged_blocks;
+	nilfs->ns_recovery_total_ns = ktime_get_ns() - start;
 	nilfs_clear_recovery_info(&ri);
 	sb->s_flags = s_flags;
 	return 0;
@@ -438,6 +470,8 @@ static int nilfs_store_disk_layout(struct the_nilfs *nilfs,
 	}
 
 	nilfs->ns_first_ino = le32_to_cpu(sbp->s_first_ino);
+	nilfs->ns_feature_compat_ro = le64_to_cpu(sbp->s_feature_compat_ro);
+	nilfs->ns_feature_incompat = le64_to_cpu(sbp->s_feature_incompat);
 
 	nilfs->ns_blocks_per_segment = le32_to_cpu(sbp->s_blocks_per_segment);
 	if (nilfs->ns_blocks_per_segment < NILFS_SEG_MIN_BLOCKS) {
@@ -760,6 +794,51 @@ int nilfs_count_free_blocks(struct the_nilfs *nilfs, sector_t *nblocks)
 	return 0;
 }
 
+static inline u64 nilfs_mdt_nblocks(struct inode *inode)
+{
+	return inode->i_blocks >> (inode->i_blkbits - 9);
+}
+
+/**
+ * nilfs_count_reclaimable_blocks - estimate number of blocks GC can reclaim
+ * @nilfs: nilfs object
+ * @nblocks: place to store the estimate
+ *
+ * The estimate is the number of blocks in segments in use minus the blocks
+ * of the latest checkpoint and of the DAT, cpfile and sufile, all of which
+ * are maintained incrementally, so this is cheap enough for statfs.
+ * Blocks only referenced by snapshots or by checkpoints in the protection
+ * period of the cleaner are counted as reclaimable, so the estimate is an
+ * upper bound.
+ */
+void nilfs_count_reclaimable_blocks(struct the_nilfs *nilfs,
+				    sector_t *nblocks)
+{
+	struct nilfs_root *root;
+	unsigned long nsegs;
+	u64 nused, nlive;
+
+	*nblocks = 0;
+	root = nilfs_lookup_root(nilfs, NILFS_CPTREE_CURRENT_CNO);
+	if (!root)
+		return;
+	nlive = atomic64_read(&root->blocks_count);
+	nilfs_put_root(root);
+
+	nlive += nilfs_mdt_nblocks(nilfs->ns_dat) +
+		nilfs_mdt_nblocks(nilfs->ns_cpfile) +
+		nilfs_mdt_nblocks(nilfs->ns_sufile);
+
+	/* the next segment is allocated in advance but is still empty */
+	nsegs = nilfs->ns_nsegments -
+		nilfs_sufile_get_ncleansegs(nilfs->ns_sufile);
+	nused = nsegs > 1 ?
+		(u64)(nsegs - 1) * nilfs->ns_blocks_per_segment : 0;
+
+	if (nused > nlive)
+		*nblocks = nused - nlive;
+}
+
 int nilfs_near_disk_full(struct the_nilfs *nilfs)
 {
 	unsigned long ncleansegs, nincsegs;
@@ -771,27 +850,56 @@ int nilfs_near_disk_full(struct the_nilfs *nilfs)
 	return ncleansegs <= nilfs->ns_nrsvsegs + nincsegs;
 }
 
-struct nilfs_root *nilfs_lookup_root(struct the_nilfs *nilfs, __u64 cno)
+static struct nilfs_root *nilfs_cptree_find(struct the_nilfs *nilfs,
+					     __u64 cno)
 {
 	struct rb_node *n;
 	struct nilfs_root *root;
 
-	spin_lock(&nilfs->ns_cptree_lock);
-	n = nilfs->ns_cptree.rb_node;
+	n = rcu_dereference_raw(nilfs->ns_cptree.rb_node);
 	while (n) {
 		root = rb_entry(n, struct nilfs_root, rb_node);
 
-		if (cno < root->cno) {
-			n = n->rb_left;
-		} else if (cno > root->cno) {
-			n = n->rb_right;
-		} else {
-			refcount_inc(&root->count);
-			spin_unlock(&nilfs->ns_cptree_lock);
+		if (cno < root->cno)
+			n = rcu_dereference_raw(n->rb_left);
+		else if (cno > root->cno)
+			n = rcu_dereference_raw(n->rb_right);
+		else
 			return root;
-		}
 	}
-	spin_unlock(&nilfs->ns_cptree_lock);
+	return NULL;
+}
+
+/**
+ * nilfs_lookup_root - get the root object of a checkpoint in use
+ * @nilfs: nilfs object
+ * @cno: checkpoint number, or NILFS_CPTREE_CURRENT_CNO
+ *
+ * nilfs_lookup_root() walks the checkpoint tree without taking
+ * ns_cptree_lock, so that many snapshot mounts can be looked up in
+ * parallel.  A walk that raced with an insertion or a removal is retried
+ * if it found nothing; a root found in the walk is valid as long as its
+ * reference count could be raised from non-zero, because roots are freed
+ * only after an RCU grace period.
+ *
+ * Return Value: the root object with its reference count raised, or NULL
+ * if the checkpoint is not in use.
+ */
+struct nilfs_root *nilfs_lookup_root(struct the_nilfs *nilfs, __u64 cno)
+{
+	struct nilfs_root *root;
+	unsigned int seq;
+
+	rcu_read_lock();
+	do {
+		seq = read_seqcount_begin(&nilfs->ns_cptree_seq);
+		root = nilfs_cptree_find(nilfs, cno);
+		if (root && refcount_inc_not_zero(&root->count)) {
+			rcu_read_unlock();
+			return root;
+		}
+	} while (read_seqcount_retry(&nilfs->ns_cptree_seq, seq));
+	rcu_read_unlock();
 
 	return NULL;
 }
@@ -836,17 +944,26 @@ nilfs_find_or_create_root(struct the_nilfs *nilfs, __u64 cno)
 	new->ifile = NULL;
 	new->nilfs = nilfs;
 	refcount_set(&new->count, 1);
+	INIT_LIST_HEAD(&new->prefetch_list);
 	atomic64_set(&new->inodes_count, 0);
 	atomic64_set(&new->blocks_count, 0);
 
-	rb_link_node(&new->rb_node, parent, p);
+	write_seqcount_begin(&nilfs->ns_cptree_seq);
+	rb_link_node_rcu(&new->rb_node, parent, p);
 	rb_insert_color(&new->rb_node, &nilfs->ns_cptree);
+	write_seqcount_end(&nilfs->ns_cptree_seq);
 
 	spin_unlock(&nilfs->ns_cptree_lock);
 
 	err = nilfs_sysfs_create_snapshot_group(new);
 	if (err) {
-		kfree(new);
+		spin_lock(&nilfs->ns_cptree_lock);
+		write_seqcount_begin(&nilfs->ns_cptree_seq);
+		rb_erase(&new->rb_node, &nilfs->ns_cptree);
+		write_seqcount_end(&nilfs->ns_cptree_seq);
+		spin_unlock(&nilfs->ns_cptree_lock);
+
+		kfree_rcu(new, rcu);
 		new = NULL;
 	}
 
@@ -858,12 +975,15 @@ void nilfs_put_root(struct nilfs_root *root)
 	struct the_nilfs *nilfs = root->nilfs;
 
 	if (refcount_dec_and_lock(&root->count, &nilfs->ns_cptree_lock)) {
+		write_seqcount_begin(&nilfs->ns_cptree_seq);
 		rb_erase(&root->rb_node, &nilfs->ns_cptree);
+		write_seqcount_end(&nilfs->ns_cptree_seq);
 		spin_unlock(&nilfs->ns_cptree_lock);
 
 		nilfs_sysfs_delete_snapshot_group(root);
 		iput(root->ifile);
 
-		kfree(root);
+		/* lockless lookups may still be walking through the node */
+		kfree_rcu(root, rcu);
 	}
 }
@@ -19,16 +19,48 @@
 #include <linux/backing-dev.h>
 #include <linux/slab.h>
 #include <linux/refcount.h>
+#include <linux/seqlock.h>
+#include <linux/shrinker.h>
+#include <linux/workqueue.h>
 
 struct nilfs_sc_info;
 struct nilfs_sysfs_dev_subgroups;
 
+/* Number of slots (bits) of the cache of inodes decoded from file handles */
+#define NILFS_FH_CACHE_BITS	6
+#define NILFS_FH_CACHE_SIZE	(1 << NILFS_FH_CACHE_BITS)
+
+/**
+ * struct nilfs_fh_cache_entry - inode recently decoded from a file handle
+ * @cno: checkpoint number of the snapshot
+ * @ino: inode number
+ * @inode: inode object pinned by the entry
+ */
+struct nilfs_fh_cache_entry {
+	__u64 cno;
+	ino_t ino;
+	struct inode *inode;
+};
+
 /* the_nilfs struct */
 enum {
 	THE_NILFS_INIT = 0,     /* Information from super_block is set */
 	THE_NILFS_DISCONTINUED,	/* 'next' pointer chain has broken */
 	THE_NILFS_GC_RUNNING,	/* gc process is running */
 	THE_NILFS_SB_DIRTY,	/* super block is dirty */
+	THE_NILFS_PURGING,	/* orphan inodes are being purged */
+};
+
+/*
+ * Page caches of metadata files, in the order they are reclaimed by the
+ * metadata file shrinker
+ */
+enum {
+	NILFS_MDT_CACHE_DAT = 0,
+	NILFS_MDT_CACHE_IFILE,
+	NILFS_MDT_CACHE_CPFILE,
+	NILFS_MDT_CACHE_SUFILE,
+	NILFS_MDT_CACHE_NR,
 };
 
 /**
@@ -67,9 +99,23 @@ enum {
  * @ns_sufile: segusage file inode
  * @ns_cptree: rb-tree of all mounted checkpoints (nilfs_root)
  * @ns_cptree_lock: lock protecting @ns_cptree
+ * @ns_cptree_seq: sequence counter for lockless lookups of @ns_cptree
  * @ns_dirty_files: list of dirty files
  * @ns_inode_lock: lock protecting @ns_dirty_files
  * @ns_gc_inodes: dummy inodes to keep live blocks
+ * @ns_gc_cache_pages: number of pages cached by GC inodes in the last GC pass
+ * @ns_orphan_lock: lock protecting @ns_orphan_list
+ * @ns_orphan_list: list of unlinked inodes whose blocks are to be released
+ * @ns_orphan_work: work releasing blocks of unlinked inodes
+ * @ns_orphan_scan_ino: next inode number to look up orphans in the ifile
+ * @ns_scrub_mutex: mutex serializing control of the scrubber
+ * @ns_scrub: state of the scrubber, allocated when it is first started
+ * @ns_scrub_rate: I/O budget of the scrubber in KiB/s (0 means no limit)
+ * @ns_prefetch_lock: lock protecting @ns_prefetch_list
+ * @ns_prefetch_list: list of roots whose ifiles are to be read ahead
+ * @ns_prefetch_work: work reading ahead ifiles of queued roots
+ * @ns_fh_cache_lock: lock protecting @ns_fh_cache
+ * @ns_fh_cache: snapshot inodes recently decoded from file handles
  * @ns_next_generation: next generation number for inodes
  * @ns_next_gen_lock: lock protecting @ns_next_generation
  * @ns_mount_opt: mount options
@@ -87,6 +133,16 @@ enum {
  * @ns_inode_size: size of on-disk inode
  * @ns_first_ino: first not-special inode number
  * @ns_crc_seed: seed value of CRC32 calculation
+ * @ns_feature_compat_ro: read-only compatible feature set
+ * @ns_feature_incompat: incompatible feature set
+ * @ns_recovery_search_ns: time taken to search the latest super root (ns)
+ * @ns_recovery_rollforward_ns: time taken to salvage orphan logs (ns)
+ * @ns_recovery_total_ns: time taken to load and recover the nilfs (ns)
+ * @ns_recovery_scanned_logs: number of logs read to recover the nilfs
+ * @ns_recovery_salvaged_blocks: number of blocks salvaged by roll-forward
+ * @ns_mdt_shrinker: shrinker of metadata file page caches
+ * @ns_mdt_soft_limit: soft limits of metadata file page caches (in pages)
+ * @ns_mdt_reclaimed: number of pages reclaimed by @ns_mdt_shrinker
  * @ns_dev_kobj: /sys/fs/<nilfs>/<device>
  * @ns_dev_kobj_unregister: completion state
  * @ns_dev_subgroups: <device> subgroups pointer
@@ -152,6 +208,7 @@ struct the_nilfs {
 	/* Checkpoint tree */
 	struct rb_root		ns_cptree;
 	spinlock_t		ns_cptree_lock;
+	seqcount_spinlock_t	ns_cptree_seq;
 
 	/* Dirty inode list */
 	struct list_head	ns_dirty_files;
@@ -159,6 +216,27 @@ struct the_nilfs {
 
 	/* GC inode list */
 	struct list_head	ns_gc_inodes;
+	unsigned long		ns_gc_cache_pages;
+
+	/* Orphan inode purger */
+	spinlock_t		ns_orphan_lock;
+	struct list_head	ns_orphan_list;
+	struct work_struct	ns_orphan_work;
+	ino_t			ns_orphan_scan_ino;
+
+	/* Background scrubber */
+	struct mutex		ns_scrub_mutex;
+	struct nilfs_scrub     *ns_scrub;
+	unsigned long		ns_scrub_rate;
+
+	/* Ifile prefetch */
+	spinlock_t		ns_prefetch_lock;
+	struct list_head	ns_prefetch_list;
+	struct work_struct	ns_prefetch_work;
+
+	/* File handle decode cache */
+	spinlock_t		ns_fh_cache_lock;
+	struct nilfs_fh_cache_entry ns_fh_cache[NILFS_FH_CACHE_SIZE];
 
 	/* Inode allocator */
 	u32			ns_next_generation;
@@ -183,6 +261,20 @@ struct the_nilfs {
 	int			ns_inode_size;
 	int			ns_first_ino;
 	u32			ns_crc_seed;
+	u64			ns_feature_compat_ro;
+	u64			ns_feature_incompat;
+
+	/* Statistics of the recovery done by load_nilfs() */
+	u64			ns_recovery_search_ns;
+	u64			ns_recovery_rollforward_ns;
+	u64			ns_recovery_total_ns;
+	unsigned long		ns_recovery_scanned_logs;
+	unsigned long		ns_recovery_salvaged_blocks;
+
+	/* Page cache control of metadata files */
+	struct shrinker		ns_mdt_shrinker;
+	unsigned long		ns_mdt_soft_limit[NILFS_MDT_CACHE_NR];
+	atomic_long_t		ns_mdt_reclaimed;
 
 	/* /sys/fs/<nilfs>/<device> */
 	struct kobject ns_dev_kobj;
@@ -208,6 +300,7 @@ THE_NILFS_FNS(INIT, init)
 THE_NILFS_FNS(DISCONTINUED, discontinued)
 THE_NILFS_FNS(GC_RUNNING, gc_running)
 THE_NILFS_FNS(SB_DIRTY, sb_dirty)
+THE_NILFS_FNS(PURGING, purging)
 
 /*
  * Mount option operations
@@ -233,6 +326,8 @@ THE_NILFS_FNS(SB_DIRTY, sb_dirty)
  * @blocks_count: number of blocks
  * @snapshot_kobj: /sys/fs/<nilfs>/<device>/mounted_snapshots/<snapshot>
  * @snapshot_kobj_unregister: completion state for kernel object
+ * @prefetch_list: entry of the_nilfs->ns_prefetch_list
+ * @rcu: rcu head for deferred freeing after lockless lookups
  */
 struct nilfs_root {
 	__u64 cno;
@@ -248,6 +343,9 @@ struct nilfs_root {
 	/* /sys/fs/<nilfs>/<device>/mounted_snapshots/<snapshot> */
 	struct kobject snapshot_kobj;
 	struct completion snapshot_kobj_unregister;
+
+	struct list_head prefetch_list;
+	struct rcu_head rcu;
 };
 
 /* Special checkpoint number */
@@ -280,6 +378,8 @@ unsigned long nilfs_nrsvsegs(struct the_nilfs *nilfs, unsigned long nsegs);
 void nilfs_set_nsegments(struct the_nilfs *nilfs, unsigned long nsegs);
 int nilfs_discard_segments(struct the_nilfs *, __u64 *, size_t);
 int nilfs_count_free_blocks(struct the_nilfs *, sector_t *);
+void nilfs_count_reclaimable_blocks(struct the_nilfs *nilfs,
+				    sector_t *nblocks);
 struct nilfs_root *nilfs_lookup_root(struct the_nilfs *nilfs, __u64 cno);
 struct nilfs_root *nilfs_find_or_create_root(struct the_nilfs *nilfs,
 					     __u64 cno);
@@ -361,6 +461,22 @@ static inline int nilfs_segment_is_active(struct the_nilfs *nilfs, __u64 n)
 	return n == nilfs->ns_segnum || n == nilfs->ns_nextnum;
 }
 
+static inline bool nilfs_has_shared_blocks(struct the_nilfs *nilfs)
+{
+	return nilfs->ns_feature_compat_ro &
+		NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS;
+}
+
+static inline bool nilfs_has_orphans(struct the_nilfs *nilfs)
+{
+	return nilfs->ns_feature_compat_ro & NILFS_FEATURE_COMPAT_RO_ORPHANS;
+}
+
+static inline bool nilfs_has_dat_deltas(struct the_nilfs *nilfs)
+{
+	return nilfs->ns_feature_incompat & NILFS_FEATURE_INCOMPAT_DAT_DELTA;
+}
+
 static inline int nilfs_flush_device(struct the_nilfs *nilfs)
 {
 	int err;
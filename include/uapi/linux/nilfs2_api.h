@@ -261,6 +261,51 @@ struct nilfs_bdesc {
 	__u32 bd_pad;
 };
 
+/**
+ * struct nilfs_inode_stats - log statistics of an inode
+ * @is_log_blocks: number of blocks written to logs
+ * @is_gc_blocks: number of blocks relocated by garbage collection
+ * @is_dat_allocs: number of DAT entries allocated
+ * @is_dsync_logs: number of data-sync logs written
+ *
+ * The counters start at zero when the inode is read into memory.
+ */
+struct nilfs_inode_stats {
+	__u64 is_log_blocks;
+	__u64 is_gc_blocks;
+	__u64 is_dat_allocs;
+	__u64 is_dsync_logs;
+};
+
+/**
+ * struct nilfs_mdt_view - read-only view of a metadata file
+ * @mv_ino: inode number of the metadata file (NILFS_DAT_INO,
+ *	NILFS_CPFILE_INO or NILFS_SUFILE_INO)
+ * @mv_size: size of the file up to its last existing block
+ * @mv_generation: counter advanced by every modification of the file
+ * @mv_flags: flags (must be zero)
+ * @mv_blocksize: block size
+ * @mv_entry_size: size of an entry
+ * @mv_first_entry_offset: offset of the first entry
+ *
+ * The generation is maintained once a view of the file has been opened.
+ * For the SUFILE and CPFILE, a scan is consistent if the generation read
+ * before the scan equals the one read after it; otherwise the scan should
+ * be retried.  DAT entries are updated without the lock that orders the
+ * generation, so a single DAT entry may still be seen half-updated, as
+ * with NILFS_IOCTL_GET_VINFO.  Pages of the view beyond @mv_size raise
+ * SIGBUS, and holes read as zero.
+ */
+struct nilfs_mdt_view {
+	__u64 mv_ino;
+	__u64 mv_size;
+	__u64 mv_generation;
+	__u32 mv_flags;
+	__u32 mv_blocksize;
+	__u32 mv_entry_size;
+	__u32 mv_first_entry_offset;
+};
+
 #define NILFS_IOCTL_IDENT	'n'
 
 #define NILFS_IOCTL_CHANGE_CPMODE					\
@@ -289,5 +334,13 @@ struct nilfs_bdesc {
 	_IOW(NILFS_IOCTL_IDENT, 0x8C, __u64[2])
 #define NILFS_IOCTL_SET_SUINFO						\
 	_IOW(NILFS_IOCTL_IDENT, 0x8D, struct nilfs_argv)
+#define NILFS_IOCTL_GET_INODE_STATS					\
+	_IOR(NILFS_IOCTL_IDENT, 0x8E, struct nilfs_inode_stats)
+#define NILFS_IOCTL_PREFETCH_IFILE					\
+	_IO(NILFS_IOCTL_IDENT, 0x8F)
+#define NILFS_IOCTL_OPEN_MDT_VIEW					\
+	_IOWR(NILFS_IOCTL_IDENT, 0x90, struct nilfs_mdt_view)
+#define NILFS_IOCTL_GET_MDT_VIEW					\
+	_IOR(NILFS_IOCTL_IDENT, 0x91, struct nilfs_mdt_view)
 
 #endif /* _LINUX_NILFS2_API_H */
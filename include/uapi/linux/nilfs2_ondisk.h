@@ -129,6 +129,18 @@ struct nilfs_super_root {
 						 * mount-time recovery
 						 */
 #define NILFS_MOUNT_DISCARD		0x8000  /* Issue DISCARD requests */
+#define NILFS_MOUNT_STATFS_RECLAIMABLE	0x10000	/*
+						 * Count blocks reclaimable
+						 * by GC as free in statfs
+						 */
+#define NILFS_MOUNT_IFILE_PREFETCH	0x20000	/*
+						 * Read ahead ifiles of mounted
+						 * checkpoints in background
+						 */
+#define NILFS_MOUNT_DSYNC_ISIZE		0x40000	/*
+						 * Record file size in data-sync
+						 * logs instead of checkpointing
+						 */
 
 
 /**
@@ -221,10 +233,18 @@ struct nilfs_super_block {
  * doesn't know about, it should refuse to mount the filesystem.
  */
 #define NILFS_FEATURE_COMPAT_RO_BLOCK_COUNT	0x00000001ULL
+#define NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS	0x00000002ULL
+#define NILFS_FEATURE_COMPAT_RO_ORPHANS		0x00000004ULL
+
+#define NILFS_FEATURE_INCOMPAT_BINFO_RUN	0x00000001ULL
+#define NILFS_FEATURE_INCOMPAT_DAT_DELTA	0x00000002ULL
 
 #define NILFS_FEATURE_COMPAT_SUPP	0ULL
-#define NILFS_FEATURE_COMPAT_RO_SUPP	NILFS_FEATURE_COMPAT_RO_BLOCK_COUNT
-#define NILFS_FEATURE_INCOMPAT_SUPP	0ULL
+#define NILFS_FEATURE_COMPAT_RO_SUPP	(NILFS_FEATURE_COMPAT_RO_BLOCK_COUNT | \
+					 NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS | \
+					 NILFS_FEATURE_COMPAT_RO_ORPHANS)
+#define NILFS_FEATURE_INCOMPAT_SUPP	(NILFS_FEATURE_INCOMPAT_BINFO_RUN | \
+					 NILFS_FEATURE_INCOMPAT_DAT_DELTA)
 
 /*
  * Bytes count of super_block for CRC-calculation
@@ -357,6 +377,24 @@ struct nilfs_binfo_v {
 	__le64 bi_blkoff;
 };
 
+/**
+ * struct nilfs_binfo_run - information on consecutive data blocks
+ * @bi_vblocknr: virtual block number of the first block
+ * @bi_blkoff: block offset of the first block
+ * @bi_count: number of blocks
+ * @bi_pad: padding
+ *
+ * In logs flagged with NILFS_SS_BINFO_RUN, data blocks of files other than
+ * DAT are described by runs of blocks whose block offsets and virtual
+ * block numbers are both consecutive, instead of nilfs_binfo_v structures.
+ */
+struct nilfs_binfo_run {
+	__le64 bi_vblocknr;
+	__le64 bi_blkoff;
+	__le32 bi_count;
+	__le32 bi_pad;
+};
+
 /**
  * struct nilfs_binfo_dat - information on a DAT node block
  * @bi_blkoff: block offset
@@ -422,6 +460,21 @@ struct nilfs_segment_summary {
 #define NILFS_SS_SR     0x0004  /* has super root */
 #define NILFS_SS_SYNDT  0x0008  /* includes data only updates */
 #define NILFS_SS_GC     0x0010  /* segment written for cleaner operation */
+#define NILFS_SS_ISIZE  0x0020  /* includes the file size of data-sync log */
+#define NILFS_SS_BINFO_RUN 0x0040  /* describes data blocks by runs */
+
+/**
+ * struct nilfs_segsum_isize - file size recorded in a data-sync log
+ * @si_ino: inode number of the file
+ * @si_size: size of the file in bytes
+ *
+ * This structure follows the segment summary header of a log flagged with
+ * NILFS_SS_ISIZE, and is included in ss_bytes of the header.
+ */
+struct nilfs_segsum_isize {
+	__le64 si_ino;
+	__le64 si_size;
+};
 
 /**
  * struct nilfs_btree_node - header of B-tree node block
@@ -468,7 +521,9 @@ struct nilfs_palloc_group_desc {
  * @de_blocknr: block number
  * @de_start: start checkpoint number
  * @de_end: end checkpoint number
- * @de_rsv: reserved for future use
+ * @de_rsv: number of references to the block from files other than its
+ *	first owner, if NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS is set;
+ *	otherwise reserved for future use
  */
 struct nilfs_dat_entry {
 	__le64 de_blocknr;
@@ -479,6 +534,21 @@ struct nilfs_dat_entry {
 
 #define NILFS_MIN_DAT_ENTRY_SIZE	32
 
+/**
+ * struct nilfs_dat_delta - DAT entry carried by a super root
+ * @dd_vblocknr: virtual block number of the entry
+ * @dd_entry: contents of the entry
+ *
+ * If NILFS_FEATURE_INCOMPAT_DAT_DELTA is set, an array of these records
+ * may follow the metadata file inodes of a super root, within sr_bytes.
+ * They hold the entries that changed in DAT blocks not written since, and
+ * must be applied to the DAT read from the super root.
+ */
+struct nilfs_dat_delta {
+	__le64 dd_vblocknr;
+	struct nilfs_dat_entry dd_entry;
+};
+
 /**
  * struct nilfs_snapshot_list - snapshot list
  * @ssl_next: next checkpoint number on snapshot list
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Helper of the nilfs2 deduplication test.
+ *
+ * Usage:
+ *   nilfs2_dedupe_ctl feature <dev>
+ *	Set NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS in both superblocks of the
+ *	unmounted file system on <dev>.
+ *
+ *   nilfs2_dedupe_ctl dedupe <src> <dst> <len>
+ *	Deduplicate the first <len> bytes of <dst> against <src> with
+ *	FIDEDUPERANGE.
+ *
+ *   nilfs2_dedupe_ctl alloc-range <mnt> <start> <end>
+ *	Limit the segments used for new logs to the byte range
+ *	[<start>, <end>) of the device (NILFS_IOCTL_SET_ALLOC_RANGE).
+ *
+ *   nilfs2_dedupe_ctl resize <mnt> <size>
+ *	Resize the file system to <size> bytes (NILFS_IOCTL_RESIZE).
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <linux/nilfs2_api.h>
+#include <linux/nilfs2_ondisk.h>
+
+static uint32_t crc32_le(uint32_t crc, const unsigned char *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+	}
+	return crc;
+}
+
+static int set_feature(int fd, off_t off)
+{
+	struct nilfs_super_block sb;
+	size_t sumoff = offsetof(struct nilfs_super_block, s_sum);
+	uint32_t crc, zero = 0;
+	uint16_t bytes;
+
+	if (pread(fd, &sb, sizeof(sb), off) != sizeof(sb)) {
+		perror("pread");
+		return -1;
+	}
+	if (le16toh(sb.s_magic) != NILFS_SUPER_MAGIC) {
+		fprintf(stderr, "no nilfs2 superblock at %lld\n",
+			(long long)off);
+		return -1;
+	}
+	bytes = le16toh(sb.s_bytes);
+	if (bytes > sizeof(sb) || bytes < sumoff + 4) {
+		fprintf(stderr, "bad superblock size %u\n", bytes);
+		return -1;
+	}
+
+	sb.s_feature_compat_ro |=
+		htole64(NILFS_FEATURE_COMPAT_RO_SHARED_BLOCKS);
+
+	crc = crc32_le(le32toh(sb.s_crc_seed), (unsigned char *)&sb, sumoff);
+	crc = crc32_le(crc, (unsigned char *)&zero, 4);
+	crc = crc32_le(crc, (unsigned char *)&sb + sumoff + 4,
+		       bytes - sumoff - 4);
+	sb.s_sum = htole32(crc);
+
+	if (pwrite(fd, &sb, sizeof(sb), off) != sizeof(sb)) {
+		perror("pwrite");
+		return -1;
+	}
+	return 0;
+}
+
+static int do_feature(const char *dev)
+{
+	off_t size;
+	int fd, ret;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	size = lseek(fd, 0, SEEK_END);
+	ret = set_feature(fd, NILFS_SB_OFFSET_BYTES);
+	if (!ret)
+		ret = set_feature(fd, NILFS_SB2_OFFSET_BYTES(size));
+	if (!ret)
+		ret = fsync(fd);
+	close(fd);
+	return ret ? 1 : 0;
+}
+
+static int do_dedupe(const char *src, const char *dst, uint64_t len)
+{
+	struct file_dedupe_range *range;
+	int sfd, dfd, ret = 1;
+
+	range = calloc(1, sizeof(*range) + sizeof(range->info[0]));
+	sfd = open(src, O_RDONLY);
+	dfd = open(dst, O_RDWR);
+	if (!range || sfd < 0 || dfd < 0) {
+		perror("open");
+		goto out;
+	}
+
+	range->src_length = len;
+	range->dest_count = 1;
+	range->info[0].dest_fd = dfd;
+	if (ioctl(sfd, FIDEDUPERANGE, range) < 0) {
+		perror("FIDEDUPERANGE");
+		goto out;
+	}
+	if (range->info[0].status < 0) {
+		fprintf(stderr, "dedupe: %s\n",
+			strerror(-range->info[0].status));
+		goto out;
+	}
+	if (range->info[0].status != FILE_DEDUPE_RANGE_SAME ||
+	    range->info[0].bytes_deduped != len) {
+		fprintf(stderr, "dedupe: %llu of %llu bytes deduplicated\n",
+			(unsigned long long)range->info[0].bytes_deduped,
+			(unsigned long long)len);
+		goto out;
+	}
+	ret = 0;
+out:
+	if (dfd >= 0)
+		close(dfd);
+	if (sfd >= 0)
+		close(sfd);
+	free(range);
+	return ret;
+}
+
+static int do_ioctl(const char *mnt, unsigned long cmd, void *arg,
+		    const char *name)
+{
+	int fd, ret;
+
+	fd = open(mnt, O_RDONLY);
+	if (fd < 0) {
+		perror(mnt);
+		return 1;
+	}
+	ret = ioctl(fd, cmd, arg);
+	if (ret < 0)
+		perror(name);
+	close(fd);
+	return ret < 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	__u64 range[2], size;
+
+	if (argc == 3 && !strcmp(argv[1], "feature"))
+		return do_feature(argv[2]);
+	if (argc == 5 && !strcmp(argv[1], "dedupe"))
+		return do_dedupe(argv[2], argv[3], strtoull(argv[4], NULL, 0));
+	if (argc == 5 && !strcmp(argv[1], "alloc-range")) {
+		range[0] = strtoull(argv[3], NULL, 0);
+		range[1] = strtoull(argv[4], NULL, 0);
+		return do_ioctl(argv[2], NILFS_IOCTL_SET_ALLOC_RANGE, range,
+				"NILFS_IOCTL_SET_ALLOC_RANGE");
+	}
+	if (argc == 4 && !strcmp(argv[1], "resize")) {
+		size = strtoull(argv[3], NULL, 0);
+		return do_ioctl(argv[2], NILFS_IOCTL_RESIZE, &size,
+				"NILFS_IOCTL_RESIZE");
+	}
+
+	fprintf(stderr,
+		"usage: %s feature <dev>\n"
+		"       %s dedupe <src> <dst> <len>\n"
+		"       %s alloc-range <mnt> <start> <end>\n"
+		"       %s resize <mnt> <size>\n",
+		argv[0], argv[0], argv[0], argv[0]);
+	return 2;
+}
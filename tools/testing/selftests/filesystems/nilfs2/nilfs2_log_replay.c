@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Minimal replayer for logs recorded by the dm-log-writes target, used by
+ * the nilfs2 crash recovery benchmark.
+ *
+ * Usage:
+ *   nilfs2_log_replay list <logdev>
+ *	Print the crash points of the log, one per line, as
+ *	"<entry> flush|fua" for entries that end a flush or FUA write, and
+ *	"<entry> mark <name>" for marks.  Replaying up to (but not including)
+ *	<entry> + 1 gives the device state right after that entry.
+ *
+ *   nilfs2_log_replay replay <logdev> <dev> <start> <end>
+ *	Apply the entries [<start>, <end>) of the log to <dev>.  Discards are
+ *	replayed as writes of zeroes.
+ *
+ * See drivers/md/dm-log-writes.c for the on-disk format.
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOG_FLUSH_FLAG		(1 << 0)
+#define LOG_FUA_FLAG		(1 << 1)
+#define LOG_DISCARD_FLAG	(1 << 2)
+#define LOG_MARK_FLAG		(1 << 3)
+
+#define WRITE_LOG_VERSION	1ULL
+#define WRITE_LOG_MAGIC		0x6a736677736872ULL
+
+struct log_write_super {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t nr_entries;
+	uint32_t sectorsize;
+} __attribute__((packed));
+
+struct log_write_entry {
+	uint64_t sector;
+	uint64_t nr_sectors;
+	uint64_t flags;
+	uint64_t data_len;
+};
+
+struct log {
+	int fd;
+	uint64_t nr_entries;
+	uint32_t sectorsize;
+	off_t pos;		/* byte offset of the next entry */
+	uint64_t index;		/* index of the next entry */
+	char *buf;		/* one sector */
+};
+
+static int log_open(struct log *log, const char *path)
+{
+	struct log_write_super super;
+
+	log->fd = open(path, O_RDONLY);
+	if (log->fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (pread(log->fd, &super, sizeof(super), 0) != sizeof(super)) {
+		fprintf(stderr, "%s: short read of log super\n", path);
+		return -1;
+	}
+	if (le64toh(super.magic) != WRITE_LOG_MAGIC ||
+	    le64toh(super.version) != WRITE_LOG_VERSION) {
+		fprintf(stderr, "%s: not a dm-log-writes log\n", path);
+		return -1;
+	}
+	log->nr_entries = le64toh(super.nr_entries);
+	log->sectorsize = le32toh(super.sectorsize);
+	if (log->sectorsize < 512 || (log->sectorsize & 511)) {
+		fprintf(stderr, "%s: bad sector size %u\n", path,
+			log->sectorsize);
+		return -1;
+	}
+	log->buf = malloc(log->sectorsize);
+	if (!log->buf) {
+		perror("malloc");
+		return -1;
+	}
+	log->pos = log->sectorsize;
+	log->index = 0;
+	return 0;
+}
+
+/*
+ * Read the header of the next entry into @entry, leaving the mark name (if
+ * any) in log->buf past the header.  log->pos is advanced to the data of
+ * the entry.
+ */
+static int log_next_entry(struct log *log, struct log_write_entry *entry)
+{
+	if (pread(log->fd, log->buf, log->sectorsize, log->pos) !=
+	    log->sectorsize) {
+		fprintf(stderr, "short read of entry %llu\n",
+			(unsigned long long)log->index);
+		return -1;
+	}
+	memcpy(entry, log->buf, sizeof(*entry));
+	entry->sector = le64toh(entry->sector);
+	entry->nr_sectors = le64toh(entry->nr_sectors);
+	entry->flags = le64toh(entry->flags);
+	entry->data_len = le64toh(entry->data_len);
+	log->pos += log->sectorsize;
+	return 0;
+}
+
+static off_t entry_data_size(struct log *log, struct log_write_entry *entry)
+{
+	if (entry->flags & LOG_DISCARD_FLAG)
+		return 0;
+	return (off_t)entry->nr_sectors * log->sectorsize;
+}
+
+static int do_list(struct log *log)
+{
+	struct log_write_entry entry;
+	size_t maxlen = log->sectorsize - sizeof(entry);
+
+	for (; log->index < log->nr_entries; log->index++) {
+		if (log_next_entry(log, &entry) < 0)
+			return 1;
+
+		if (entry.flags & LOG_MARK_FLAG) {
+			int len = entry.data_len < maxlen ? entry.data_len :
+				maxlen;
+
+			printf("%llu mark %.*s\n",
+			       (unsigned long long)log->index, len,
+			       log->buf + sizeof(entry));
+		} else if (entry.flags & LOG_FUA_FLAG) {
+			printf("%llu fua\n", (unsigned long long)log->index);
+		} else if (entry.flags & LOG_FLUSH_FLAG) {
+			printf("%llu flush\n", (unsigned long long)log->index);
+		}
+		log->pos += entry_data_size(log, &entry);
+	}
+	return 0;
+}
+
+static int replay_entry(struct log *log, struct log_write_entry *entry,
+			int devfd, char *data, size_t bufsize)
+{
+	off_t dst = (off_t)entry->sector * log->sectorsize;
+	off_t left = (off_t)entry->nr_sectors * log->sectorsize;
+	int discard = entry->flags & LOG_DISCARD_FLAG;
+	size_t len;
+
+	if (discard)
+		memset(data, 0, bufsize);
+
+	while (left > 0) {
+		len = left < (off_t)bufsize ? left : bufsize;
+		if (!discard && pread(log->fd, data, len, log->pos) != len) {
+			fprintf(stderr, "short read of data of entry %llu\n",
+				(unsigned long long)log->index);
+			return -1;
+		}
+		if (pwrite(devfd, data, len, dst) != len) {
+			perror("pwrite");
+			return -1;
+		}
+		if (!discard)
+			log->pos += len;
+		dst += len;
+		left -= len;
+	}
+	return 0;
+}
+
+static int do_replay(struct log *log, const char *dev, uint64_t start,
+		     uint64_t end)
+{
+	struct log_write_entry entry;
+	size_t bufsize = 1 << 20;
+	char *data;
+	int devfd;
+
+	if (end > log->nr_entries)
+		end = log->nr_entries;
+
+	devfd = open(dev, O_WRONLY);
+	if (devfd < 0) {
+		perror(dev);
+		return 1;
+	}
+	data = malloc(bufsize);
+	if (!data) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (; log->index < end; log->index++) {
+		if (log_next_entry(log, &entry) < 0)
+			return 1;
+		if (log->index < start || (entry.flags & LOG_MARK_FLAG)) {
+			log->pos += entry_data_size(log, &entry);
+			continue;
+		}
+		if (replay_entry(log, &entry, devfd, data, bufsize) < 0)
+			return 1;
+	}
+
+	if (fsync(devfd) < 0) {
+		perror("fsync");
+		return 1;
+	}
+	free(data);
+	close(devfd);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct log log;
+
+	if (argc == 3 && !strcmp(argv[1], "list")) {
+		if (log_open(&log, argv[2]) < 0)
+			return 1;
+		return do_list(&log);
+	}
+	if (argc == 6 && !strcmp(argv[1], "replay")) {
+		if (log_open(&log, argv[2]) < 0)
+			return 1;
+		return do_replay(&log, argv[3], strtoull(argv[4], NULL, 0),
+				 strtoull(argv[5], NULL, 0));
+	}
+
+	fprintf(stderr,
+		"usage: %s list <logdev>\n"
+		"       %s replay <logdev> <dev> <start> <end>\n",
+		argv[0], argv[0]);
+	return 2;
+}
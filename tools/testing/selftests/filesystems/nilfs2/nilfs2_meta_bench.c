@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Metadata micro-benchmark used by the nilfs2 performance suite.
+ *
+ * Usage: nilfs2_meta_bench <create|lookup|unlink> <dir> <count>
+ *
+ *   create  - create <count> 4 KiB files in <dir>
+ *   lookup  - stat() the <count> files of <dir> in random order
+ *   unlink  - remove the <count> files of <dir> in random order
+ *
+ * The result is printed as a single line of key=value pairs:
+ *   ops=<n> ops_per_sec=<n> p99_us=<n>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define FILE_SIZE	4096
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void shuffle(unsigned long *v, unsigned long n)
+{
+	unsigned long i, j, t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = (unsigned long)random() % (i + 1);
+		t = v[i];
+		v[i] = v[j];
+		v[j] = t;
+	}
+}
+
+static int do_op(const char *op, const char *path, const char *buf)
+{
+	struct stat st;
+	int fd;
+
+	if (!strcmp(op, "create")) {
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (fd < 0)
+			return -1;
+		if (write(fd, buf, FILE_SIZE) != FILE_SIZE) {
+			close(fd);
+			return -1;
+		}
+		return close(fd);
+	}
+	if (!strcmp(op, "lookup"))
+		return stat(path, &st);
+	return unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long *lat, t0, start, elapsed;
+	unsigned long count, i, *order;
+	char path[4096];
+	char *buf;
+	const char *op;
+
+	if (argc != 4 || (strcmp(argv[1], "create") &&
+			  strcmp(argv[1], "lookup") &&
+			  strcmp(argv[1], "unlink"))) {
+		fprintf(stderr,
+			"usage: %s <create|lookup|unlink> <dir> <count>\n",
+			argv[0]);
+		return 2;
+	}
+	op = argv[1];
+	count = strtoul(argv[3], NULL, 0);
+	if (!count)
+		return 2;
+
+	lat = calloc(count, sizeof(*lat));
+	order = calloc(count, sizeof(*order));
+	buf = malloc(FILE_SIZE);
+	if (!lat || !order || !buf) {
+		perror("malloc");
+		return 1;
+	}
+	memset(buf, 0x5a, FILE_SIZE);
+	for (i = 0; i < count; i++)
+		order[i] = i;
+	srandom(getpid());
+	if (strcmp(op, "create"))
+		shuffle(order, count);
+
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/f%08lu", argv[2], order[i]);
+		t0 = now_ns();
+		if (do_op(op, path, buf) < 0) {
+			fprintf(stderr, "%s %s: %s\n", op, path,
+				strerror(errno));
+			return 1;
+		}
+		lat[i] = now_ns() - t0;
+	}
+	elapsed = now_ns() - start;
+
+	qsort(lat, count, sizeof(*lat), cmp_ull);
+	printf("ops=%lu ops_per_sec=%llu p99_us=%llu\n", count,
+	       elapsed ? count * 1000000000ULL / elapsed : 0,
+	       lat[(count * 99) / 100] / 1000);
+	return 0;
+}
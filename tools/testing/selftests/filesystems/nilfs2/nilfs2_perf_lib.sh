@@ -0,0 +1,138 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Helpers shared by the nilfs2 performance and recovery benchmarks.
+#
+# The caller sets TMP_DIR and RESULTS before sourcing this file, and may set
+# NILFS2_PERF_DEV to "nullb" to run on a memory backed null_blk device
+# instead of a loop device backed by a file in TMP_DIR.
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+DEV=""
+DEV_NAME=""
+DEV_KIND=""
+IMG_PATH="${TMP_DIR}/nilfs2.img"
+
+log() {
+	echo "# $*"
+}
+
+require_root() {
+	if [ "$(id -u)" -ne 0 ]; then
+		log "must be run as root"
+		exit $ksft_skip
+	fi
+}
+
+require_cmds() {
+	local cmd
+
+	for cmd in "$@"; do
+		if ! command -v "$cmd" > /dev/null 2>&1; then
+			log "$cmd is not available"
+			exit $ksft_skip
+		fi
+	done
+}
+
+# setup_device <size in MiB>
+setup_device() {
+	local size_mb=$1
+
+	if [ "${NILFS2_PERF_DEV:-loop}" = "nullb" ]; then
+		modprobe null_blk nr_devices=1 memory_backed=1 \
+			gb=$(( (size_mb + 1023) / 1024 )) queue_mode=2 ||
+			exit $ksft_skip
+		DEV=/dev/nullb0
+		DEV_KIND=nullb
+	else
+		truncate -s "${size_mb}M" "${IMG_PATH}"
+		DEV=$(losetup --find --show "${IMG_PATH}") || exit $ksft_skip
+		DEV_KIND=loop
+	fi
+	DEV_NAME=$(basename "${DEV}")
+}
+
+teardown_device() {
+	case "${DEV_KIND}" in
+	nullb)
+		modprobe -r null_blk
+		;;
+	loop)
+		losetup -d "${DEV}"
+		rm -f "${IMG_PATH}"
+		;;
+	esac
+	DEV=""
+	DEV_KIND=""
+}
+
+# mkfs_nilfs2 [extra mkfs.nilfs2 options...]
+mkfs_nilfs2() {
+	mkfs.nilfs2 -f -q -b 4096 "$@" "${DEV}" > /dev/null
+}
+
+# mount_nilfs2 <mount point> [mount options]
+mount_nilfs2() {
+	local opts=${2:-}
+
+	mkdir -p "$1"
+	mount -t nilfs2 ${opts:+-o "$opts"} "${DEV}" "$1"
+}
+
+# Number of 512-byte sectors written to the device so far
+dev_sectors_written() {
+	awk '{ print $7 }' "/sys/block/${DEV_NAME}/stat"
+}
+
+# Directory of the nilfs2 sysfs group of the device
+nilfs2_sysfs_dir() {
+	echo "/sys/fs/nilfs2/${DEV_NAME}"
+}
+
+drop_caches() {
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+}
+
+now_ms() {
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# record <workload> <metric> <value>
+record() {
+	echo "$1 $2 $3" >> "${RESULTS}"
+	echo "$1: $2 = $3"
+}
+
+# compare_baseline <results> <baseline>
+#
+# Both files hold "<workload> <metric> <value>" lines.  Throughput metrics
+# (bw_kib, *ops_per_sec) regress when they drop, all others when they grow,
+# by more than TOLERANCE percent.
+compare_baseline() {
+	local fails=0 wl metric val base worse
+
+	while read -r wl metric val; do
+		base=$(awk -v w="$wl" -v m="$metric" \
+			'$1 == w && $2 == m { print $3 }' "$2")
+		[ -n "$base" ] || continue
+		case $metric in
+		bw_kib|*ops_per_sec)
+			worse=$(awk -v v="$val" -v b="$base" -v t="$TOLERANCE" \
+				'BEGIN { print (v < b * (100 - t) / 100) }') ;;
+		*)
+			worse=$(awk -v v="$val" -v b="$base" -v t="$TOLERANCE" \
+				'BEGIN { print (v > b * (100 + t) / 100) }') ;;
+		esac
+		if [ "$worse" = 1 ]; then
+			echo "not ok $wl $metric: $val (baseline $base)"
+			fails=$((fails + 1))
+		else
+			echo "ok $wl $metric: $val (baseline $base)"
+		fi
+	done < "$1"
+	return $fails
+}
@@ -0,0 +1,98 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Relocation of deduplicated blocks in nilfs2.
+#
+# A block of "src" is shared with "dst" by FIDEDUPERANGE and then
+# overwritten in "src".  If the overwrite were logged under the checkpoint
+# number of the original block, the garbage collector would see two live
+# blocks of the same (ino, cno, offset) and fail with "conflicting data
+# buffer".  The logs are placed in the upper half of the device, and the
+# file system is then shrunk to its lower half, which relocates them with
+# the garbage collection code.  The shrink must succeed and both files
+# must keep their data.
+#
+# Usage: run_nilfs2_dedupe.sh [-S size-MiB]
+
+set -u
+set -o pipefail
+
+BASE_DIR="$(dirname "$0")"
+TMP_DIR="$(mktemp -d /tmp/nilfs2_dedupe.XXXX)"
+MNT_PATH="${TMP_DIR}/mnt"
+CTL="${BASE_DIR}/nilfs2_dedupe_ctl"
+
+. "${BASE_DIR}/nilfs2_perf_lib.sh"
+
+SIZE_MB=512
+LEN=$((64 * 1024))
+
+usage() {
+	echo "usage: $0 [-S size-MiB]"
+	exit 2
+}
+
+while getopts "S:h" opt; do
+	case $opt in
+	S) SIZE_MB=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+cleanup() {
+	mountpoint -q "${MNT_PATH}" && umount "${MNT_PATH}"
+	[ -n "${DEV}" ] && teardown_device
+	rm -rf "${TMP_DIR}"
+}
+trap cleanup EXIT
+
+# pattern <tag> <bytes>
+pattern() {
+	yes "$1" | head -c "$2"
+}
+
+fail() {
+	echo "not ok $*"
+	exit 1
+}
+
+require_root
+require_cmds mkfs.nilfs2 losetup cmp
+grep -qw nilfs2 /proc/filesystems || modprobe nilfs2 || exit $ksft_skip
+
+setup_device "${SIZE_MB}"
+size=$((SIZE_MB * 1024 * 1024))
+mkfs_nilfs2 || exit 1
+"${CTL}" feature "${DEV}" || exit 1
+mount_nilfs2 "${MNT_PATH}" nogc || exit $ksft_skip
+
+# Move the log head to the upper half of the device.
+"${CTL}" alloc-range "${MNT_PATH}" $((size / 2)) "$size" || exit 1
+pattern filler $((32 * 1024 * 1024)) > "${MNT_PATH}/filler"
+sync
+
+pattern shared "$LEN" |
+	dd of="${MNT_PATH}/src" bs=64k conv=fdatasync status=none
+pattern shared "$LEN" |
+	dd of="${MNT_PATH}/dst" bs=64k conv=fdatasync status=none
+if ! "${CTL}" dedupe "${MNT_PATH}/src" "${MNT_PATH}/dst" "$LEN"; then
+	log "deduplication is not supported"
+	exit $ksft_skip
+fi
+pattern new "$LEN" |
+	dd of="${MNT_PATH}/src" bs=64k conv=notrunc,fdatasync status=none
+rm "${MNT_PATH}/filler"
+sync
+
+"${CTL}" alloc-range "${MNT_PATH}" 0 "$size" || exit 1
+log "shrinking to $((SIZE_MB / 2)) MiB"
+"${CTL}" resize "${MNT_PATH}" $((size / 2)) ||
+	fail "shrink over deduplicated blocks"
+
+umount "${MNT_PATH}"
+mount_nilfs2 "${MNT_PATH}" nogc || fail "remount"
+pattern new "$LEN" | cmp -s - "${MNT_PATH}/src" || fail "data of src"
+pattern shared "$LEN" | cmp -s - "${MNT_PATH}/dst" || fail "data of dst"
+
+echo "ok relocation of deduplicated blocks"
+exit 0
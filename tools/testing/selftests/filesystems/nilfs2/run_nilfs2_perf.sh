@@ -0,0 +1,211 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Performance regression suite for nilfs2.
+#
+# A nilfs2 file system is created on a loop device (or a memory backed
+# null_blk device with NILFS2_PERF_DEV=nullb) and a set of workloads is
+# run against it.  For every workload, throughput, 99th percentile
+# latency and write amplification (bytes written to the device divided
+# by bytes written by the workload, taken from /sys/block/<dev>/stat) are
+# recorded, and optionally compared against a stored baseline.
+#
+# Usage: run_nilfs2_perf.sh [-b baseline] [-s save-file] [-t tolerance]
+#                           [-S size-MiB] [-w workload[,workload...]]
+#
+# The baseline and save files hold one "<workload> <metric> <value>" line
+# per result.  A result is reported as a regression when it is worse than
+# the baseline by more than the tolerance (in percent, default 15).
+
+set -u
+set -o pipefail
+
+BASE_DIR="$(dirname "$0")"
+TMP_DIR="$(mktemp -d /tmp/nilfs2_perf.XXXX)"
+MNT_PATH="${TMP_DIR}/mnt"
+SNAP_PATH="${TMP_DIR}/snap"
+RESULTS="${TMP_DIR}/results"
+
+. "${BASE_DIR}/nilfs2_perf_lib.sh"
+
+BASELINE="${BASE_DIR}/nilfs2_perf.baseline"
+SAVE_FILE=""
+TOLERANCE=15
+SIZE_MB=2048
+RUNTIME=${NILFS2_PERF_RUNTIME:-30}
+ALL_WORKLOADS="seqwrite randoverwrite fsyncstorm smallfiles lookup snapshot gc"
+WORKLOADS="${ALL_WORKLOADS}"
+
+usage() {
+	echo "usage: $0 [-b baseline] [-s save-file] [-t tolerance] [-S size-MiB] [-w workloads]"
+	echo "workloads: ${ALL_WORKLOADS}"
+	exit 2
+}
+
+while getopts "b:s:t:S:w:h" opt; do
+	case $opt in
+	b) BASELINE=$OPTARG ;;
+	s) SAVE_FILE=$OPTARG ;;
+	t) TOLERANCE=$OPTARG ;;
+	S) SIZE_MB=$OPTARG ;;
+	w) WORKLOADS=${OPTARG//,/ } ;;
+	*) usage ;;
+	esac
+done
+
+cleanup() {
+	mountpoint -q "${SNAP_PATH}" && umount "${SNAP_PATH}"
+	mountpoint -q "${MNT_PATH}" && umount "${MNT_PATH}"
+	[ -n "${DEV}" ] && teardown_device
+	rm -rf "${TMP_DIR}"
+}
+trap cleanup EXIT
+
+# fio_run <workload> <fio options...>
+#
+# Runs fio with JSON output and records write bandwidth, p99 write
+# completion latency, and write amplification of the run.
+fio_run() {
+	local name=$1 out="${TMP_DIR}/$1.json" before after
+	shift
+
+	before=$(dev_sectors_written)
+	fio --output-format=json --output="${out}" --name="${name}" \
+		--directory="${MNT_PATH}" --group_reporting "$@" ||
+		return 1
+	sync
+	after=$(dev_sectors_written)
+
+	python3 - "${out}" "$before" "$after" <<'EOF' | while read -r m v; do
+import json, sys
+job = json.load(open(sys.argv[1]))["jobs"][0]["write"]
+written = (int(sys.argv[3]) - int(sys.argv[2])) * 512
+pct = job.get("clat_ns", {}).get("percentile", {})
+print("bw_kib", job["bw"])
+print("p99_us", int(pct.get("99.000000", 0)) // 1000)
+print("wa", "%.2f" % (written / job["io_bytes"] if job["io_bytes"] else 0))
+EOF
+		record "${name}" "$m" "$v"
+	done
+}
+
+# meta_run <workload> <create|lookup|unlink> <dir> <count>
+meta_run() {
+	local name=$1 out
+
+	out=$("${BASE_DIR}/nilfs2_meta_bench" "$2" "$3" "$4") || return 1
+	record "${name}" "$2_ops_per_sec" "$(echo "$out" | sed 's/.*ops_per_sec=\([0-9]*\).*/\1/')"
+	record "${name}" "$2_p99_us" "$(echo "$out" | sed 's/.*p99_us=\([0-9]*\).*/\1/')"
+}
+
+fresh_fs() {
+	mountpoint -q "${MNT_PATH}" && umount "${MNT_PATH}"
+	mkfs_nilfs2
+	mount_nilfs2 "${MNT_PATH}" "${1-nogc}"
+}
+
+wl_seqwrite() {
+	fresh_fs
+	fio_run seqwrite --rw=write --bs=1M --size=$((SIZE_MB / 4))M \
+		--end_fsync=1
+}
+
+wl_randoverwrite() {
+	fresh_fs
+	fio --name=prefill --directory="${MNT_PATH}" --filename=overwrite \
+		--rw=write --bs=1M --size=$((SIZE_MB / 4))M --end_fsync=1 \
+		> /dev/null || return 1
+	fio_run randoverwrite --filename=overwrite --rw=randwrite --bs=4k \
+		--size=$((SIZE_MB / 4))M --time_based --runtime="${RUNTIME}" \
+		--end_fsync=1
+}
+
+wl_fsyncstorm() {
+	fresh_fs
+	fio_run fsyncstorm --rw=randwrite --bs=4k --size=64M --numjobs=8 \
+		--fsync=1 --time_based --runtime="${RUNTIME}"
+}
+
+wl_smallfiles() {
+	fresh_fs
+	mkdir -p "${MNT_PATH}/small"
+	meta_run smallfiles create "${MNT_PATH}/small" 20000 &&
+		sync &&
+		meta_run smallfiles unlink "${MNT_PATH}/small" 20000
+}
+
+wl_lookup() {
+	fresh_fs
+	mkdir -p "${MNT_PATH}/large"
+	"${BASE_DIR}/nilfs2_meta_bench" create "${MNT_PATH}/large" 100000 \
+		> /dev/null || return 1
+	umount "${MNT_PATH}"
+	drop_caches
+	mount_nilfs2 "${MNT_PATH}" nogc
+	meta_run lookup lookup "${MNT_PATH}/large" 100000
+}
+
+wl_snapshot() {
+	local cno t0 total=0 n=0 pid
+
+	require_cmds mkcp
+	fresh_fs
+	fio_run snapshot --rw=write --bs=1M --size=$((SIZE_MB / 4))M \
+		--time_based --runtime="${RUNTIME}" &
+	pid=$!
+	sleep 2
+	while kill -0 $pid 2> /dev/null && [ $n -lt 10 ]; do
+		cno=$(mkcp -s -p "${DEV}") || break
+		t0=$(now_ms)
+		mount_nilfs2 "${SNAP_PATH}" "ro,cp=${cno}" || break
+		total=$((total + $(now_ms) - t0))
+		ls -lR "${SNAP_PATH}" > /dev/null
+		umount "${SNAP_PATH}"
+		n=$((n + 1))
+		sleep 1
+	done
+	wait $pid || return 1
+	[ $n -gt 0 ] || return 1
+	record snapshot mount_ms $((total / n))
+}
+
+wl_gc() {
+	local avail
+
+	fresh_fs ""
+	avail=$(df -k --output=avail "${MNT_PATH}" | tail -1)
+	fio --name=fill --directory="${MNT_PATH}" --filename=fill \
+		--rw=write --bs=1M --size=$((avail * 9 / 10 / 1024))M \
+		--end_fsync=1 > /dev/null || return 1
+	command -v nilfs-clean > /dev/null &&
+		nilfs-clean -p 0 "${DEV}" > /dev/null 2>&1
+	fio_run gc --filename=fill --rw=randwrite --bs=64k \
+		--size=$((avail * 9 / 10 / 1024))M --time_based \
+		--runtime="${RUNTIME}" --end_fsync=1
+}
+
+require_root
+require_cmds mkfs.nilfs2 fio python3 losetup
+grep -qw nilfs2 /proc/filesystems || modprobe nilfs2 || exit $ksft_skip
+
+: > "${RESULTS}"
+setup_device "${SIZE_MB}"
+
+failed=0
+for wl in ${WORKLOADS}; do
+	log "running ${wl}"
+	if ! "wl_${wl}"; then
+		echo "not ok ${wl}: workload failed"
+		failed=1
+	fi
+done
+
+[ -n "${SAVE_FILE}" ] && cp "${RESULTS}" "${SAVE_FILE}"
+
+if [ -f "${BASELINE}" ]; then
+	compare_baseline "${RESULTS}" "${BASELINE}" || failed=1
+else
+	log "no baseline at ${BASELINE}, results not compared"
+fi
+
+exit $failed
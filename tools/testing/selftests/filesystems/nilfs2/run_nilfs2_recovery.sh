@@ -0,0 +1,245 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Crash recovery benchmark for nilfs2.
+#
+# A workload of fsync'ed file creations and fdatasync'ed overwrites is
+# recorded through a dm-log-writes target.  The log is then replayed up to
+# a series of crash points (the flush and FUA writes of the log), and the
+# file system at each point is mounted to measure recovery latency and the
+# amount of data rolled forward, as reported in
+# /sys/fs/nilfs2/<dev>/recovery.  After each mount, every file whose fsync
+# completed before the crash point must be intact.
+#
+# Usage: run_nilfs2_recovery.sh [-b baseline] [-s save-file] [-t tolerance]
+#                               [-S size-MiB] [-p max-crash-points]
+#
+# Results are "recovery <metric> <value>" lines and are compared against a
+# baseline in the same way as run_nilfs2_perf.sh does.
+
+set -u
+set -o pipefail
+
+BASE_DIR="$(dirname "$0")"
+TMP_DIR="$(mktemp -d /tmp/nilfs2_recovery.XXXX)"
+MNT_PATH="${TMP_DIR}/mnt"
+RESULTS="${TMP_DIR}/results"
+
+. "${BASE_DIR}/nilfs2_perf_lib.sh"
+
+BASELINE="${BASE_DIR}/nilfs2_recovery.baseline"
+SAVE_FILE=""
+TOLERANCE=15
+SIZE_MB=256
+MAX_POINTS=50
+NFILES=64
+NOVERWRITES=256
+LW_NAME="nilfs2-lw-$$"
+LOG_DEV=""
+REPLAY_DEV=""
+SCRATCH_DEV=""
+
+usage() {
+	echo "usage: $0 [-b baseline] [-s save-file] [-t tolerance] [-S size-MiB] [-p max-crash-points]"
+	exit 2
+}
+
+while getopts "b:s:t:S:p:h" opt; do
+	case $opt in
+	b) BASELINE=$OPTARG ;;
+	s) SAVE_FILE=$OPTARG ;;
+	t) TOLERANCE=$OPTARG ;;
+	S) SIZE_MB=$OPTARG ;;
+	p) MAX_POINTS=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+cleanup() {
+	mountpoint -q "${MNT_PATH}" && umount "${MNT_PATH}"
+	dmsetup info "${LW_NAME}" > /dev/null 2>&1 &&
+		dmsetup remove "${LW_NAME}"
+	for d in "${LOG_DEV}" "${REPLAY_DEV}" "${SCRATCH_DEV}"; do
+		[ -n "$d" ] && losetup -d "$d"
+	done
+	[ -n "${DEV}" ] && teardown_device
+	rm -rf "${TMP_DIR}"
+}
+trap cleanup EXIT
+
+# loop_dev <image name> <size in MiB>
+loop_dev() {
+	truncate -s "$2M" "${TMP_DIR}/$1"
+	losetup --find --show "${TMP_DIR}/$1"
+}
+
+# pattern <tag> <bytes>
+pattern() {
+	yes "$1" | head -c "$2"
+}
+
+# Block overwritten by the n-th overwrite; distinct for n < 1024.
+ow_offset() {
+	echo $(( ($1 * 37 % 1024) * 4096 ))
+}
+
+mark() {
+	dmsetup message "${LW_NAME}" 0 mark "$1"
+}
+
+record_workload() {
+	local lw="/dev/mapper/${LW_NAME}" i off
+
+	dmsetup create "${LW_NAME}" --table \
+		"0 $(blockdev --getsz "${DEV}") log-writes ${DEV} ${LOG_DEV}" ||
+		return 1
+	mkfs.nilfs2 -f -q -b 4096 "$lw" > /dev/null || return 1
+	mark mkfs
+	mkdir -p "${MNT_PATH}"
+	mount -t nilfs2 -o nogc "$lw" "${MNT_PATH}" || return 1
+
+	pattern big $((1024 * 4096)) > "${MNT_PATH}/big"
+	sync
+	mark big
+
+	for i in $(seq 1 "${NFILES}"); do
+		pattern "f$i" $((i * 4096)) |
+			dd of="${MNT_PATH}/f$i" bs=64k conv=fsync status=none
+		mark "f$i"
+		off=$(ow_offset "$i")
+		pattern "ow$i" 4096 |
+			dd of="${MNT_PATH}/big" bs=4096 seek=$((off / 4096)) \
+				conv=notrunc,fdatasync status=none
+		mark "ow$i"
+	done
+	for i in $(seq $((NFILES + 1)) "${NOVERWRITES}"); do
+		off=$(ow_offset "$i")
+		pattern "ow$i" 4096 |
+			dd of="${MNT_PATH}/big" bs=4096 seek=$((off / 4096)) \
+				conv=notrunc,fdatasync status=none
+		mark "ow$i"
+	done
+
+	umount "${MNT_PATH}"
+	dmsetup remove "${LW_NAME}"
+}
+
+# verify <mark>...
+#
+# Check that the data made durable by each of the given marks survived.
+verify() {
+	local m n off err=0
+
+	for m in "$@"; do
+		case $m in
+		f*)
+			n=${m#f}
+			pattern "$m" $((n * 4096)) |
+				cmp -s - "${MNT_PATH}/$m" || err=1
+			;;
+		ow*)
+			n=${m#ow}
+			off=$(ow_offset "$n")
+			pattern "$m" 4096 |
+				cmp -s -n 4096 -i "0:${off}" - "${MNT_PATH}/big" ||
+				err=1
+			;;
+		big)
+			[ "$(stat -c %s "${MNT_PATH}/big")" -eq $((1024 * 4096)) ] ||
+				err=1
+			;;
+		esac
+		if [ $err -ne 0 ]; then
+			echo "not ok data of mark $m lost"
+			return 1
+		fi
+	done
+	find "${MNT_PATH}" -type f -exec cat {} + > /dev/null
+}
+
+require_root
+require_cmds mkfs.nilfs2 dmsetup losetup blockdev cmp
+grep -qw nilfs2 /proc/filesystems || modprobe nilfs2 || exit $ksft_skip
+modprobe dm-log-writes 2> /dev/null
+dmsetup targets | grep -qw log-writes || exit $ksft_skip
+
+: > "${RESULTS}"
+setup_device "${SIZE_MB}"
+LOG_DEV=$(loop_dev log.img $((SIZE_MB * 4))) || exit $ksft_skip
+REPLAY_DEV=$(loop_dev replay.img "${SIZE_MB}") || exit $ksft_skip
+SCRATCH_DEV=$(loop_dev scratch.img "${SIZE_MB}") || exit $ksft_skip
+
+log "recording workload"
+record_workload || exit 1
+
+"${BASE_DIR}/nilfs2_log_replay" list "${LOG_DEV}" > "${TMP_DIR}/points" ||
+	exit 1
+first=$(awk '$2 == "mark" && $3 == "mkfs" { print $1 }' "${TMP_DIR}/points")
+awk -v f="$first" '$1 > f && $2 != "mark" { print $1 }' "${TMP_DIR}/points" \
+	> "${TMP_DIR}/crash"
+total=$(wc -l < "${TMP_DIR}/crash")
+step=$(( (total + MAX_POINTS - 1) / MAX_POINTS ))
+[ "$step" -gt 0 ] || step=1
+log "${total} crash points, testing every ${step}"
+
+failed=0
+cursor=0
+n=0
+sum_ms=0
+max_ms=0
+sum_us=0
+max_us=0
+sum_salvaged=0
+sysfs="/sys/fs/nilfs2/$(basename "${SCRATCH_DEV}")/recovery"
+
+for point in $(awk -v s="$step" 'NR % s == 0 || NR == 1' "${TMP_DIR}/crash"); do
+	"${BASE_DIR}/nilfs2_log_replay" replay "${LOG_DEV}" "${REPLAY_DEV}" \
+		"$cursor" $((point + 1)) || exit 1
+	cursor=$((point + 1))
+	dd if="${REPLAY_DEV}" of="${SCRATCH_DEV}" bs=1M status=none || exit 1
+
+	t0=$(now_ms)
+	if ! mount -t nilfs2 -o nogc "${SCRATCH_DEV}" "${MNT_PATH}"; then
+		echo "not ok mount failed at entry ${point}"
+		failed=1
+		continue
+	fi
+	ms=$(( $(now_ms) - t0 ))
+	us=$(cat "${sysfs}/total_time_us")
+	salvaged=$(cat "${sysfs}/salvaged_blocks")
+
+	marks=$(awk -v p="$point" '$1 < p && $2 == "mark" && $3 != "mkfs" { print $3 }' \
+		"${TMP_DIR}/points")
+	# shellcheck disable=SC2086
+	verify $marks || failed=1
+	umount "${MNT_PATH}"
+
+	n=$((n + 1))
+	sum_ms=$((sum_ms + ms))
+	sum_us=$((sum_us + us))
+	sum_salvaged=$((sum_salvaged + salvaged))
+	[ "$ms" -gt "$max_ms" ] && max_ms=$ms
+	[ "$us" -gt "$max_us" ] && max_us=$us
+	log "entry ${point}: mount ${ms} ms, recovery ${us} us, salvaged ${salvaged} blocks"
+done
+
+if [ "$n" -eq 0 ]; then
+	echo "not ok no crash point could be mounted"
+	exit 1
+fi
+
+log "${n} crash points mounted, ${sum_salvaged} blocks salvaged in total"
+record recovery mount_ms_avg $((sum_ms / n))
+record recovery mount_ms_max "${max_ms}"
+record recovery time_us_avg $((sum_us / n))
+record recovery time_us_max "${max_us}"
+
+[ -n "${SAVE_FILE}" ] && cp "${RESULTS}" "${SAVE_FILE}"
+
+if [ -f "${BASELINE}" ]; then
+	compare_baseline "${RESULTS}" "${BASELINE}" || failed=1
+else
+	log "no baseline at ${BASELINE}, results not compared"
+fi
+
+exit $failed